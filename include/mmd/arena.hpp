@@ -0,0 +1,47 @@
+#ifndef MODEL_ARENA_H
+#define MODEL_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+/*
+ * Monotonic memory resource owning everything parsed from one model.
+ * Deallocation is a no-op and all blocks are freed together when the arena
+ * is destroyed. reserve() lets the parser size the next block from the
+ * section counts so one model's data ends up in very few blocks.
+ * Allocation is safe from several threads.
+ */
+class PMXArena: public std::pmr::memory_resource {
+    static const size_t MIN_BLOCK_SIZE = 65536;
+
+    std::vector<void *> blocks;
+    char *current;
+    size_t remaining;
+    size_t nextBlockSize;
+    size_t capacity, used;
+    std::mutex arenaMutex;
+
+    void addBlock(size_t size);
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+public:
+    PMXArena();
+    ~PMXArena();
+    PMXArena(const PMXArena&) = delete;
+    PMXArena& operator=(const PMXArena&) = delete;
+
+    // make sure the next bytes of allocations fit one block
+    void reserve(size_t bytes);
+
+    size_t getBlockNum();
+    size_t getCapacity();
+    size_t getUsed();
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MODEL_BUFFER_H
+#define MODEL_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/*
+ * Contiguous array that either owns its elements or views memory owned by
+ * someone else, e.g. a mapped file, which is kept alive through keepAlive.
+ */
+template <typename T>
+class PMXBuffer {
+    std::pmr::vector<T> owned;
+    const T *viewData;
+    size_t viewSize;
+    std::shared_ptr<const void> keepAlive;
+
+public:
+    PMXBuffer(): viewData(nullptr), viewSize(0) {}
+    // owned elements, including copies made by mutableElements, live in resource
+    explicit PMXBuffer(std::pmr::memory_resource *resource): owned(resource), viewData(nullptr), viewSize(0) {}
+
+    void assign(std::pmr::vector<T> &&elements) {
+        // pmr allocators do not propagate, a vector from another resource is copied into ours
+        if (elements.get_allocator() == owned.get_allocator()) {
+            owned.swap(elements);
+        } else {
+            owned.assign(elements.begin(), elements.end());
+        }
+        viewData = nullptr;
+        viewSize = 0;
+        keepAlive.reset();
+    }
+
+    void view(const T *data, size_t size, std::shared_ptr<const void> owner) {
+        std::pmr::vector<T>(owned.get_allocator()).swap(owned);
+        viewData = data;
+        viewSize = size;
+        keepAlive = std::move(owner);
+    }
+
+    bool isView() const { return viewData != nullptr; }
+    size_t size() const { return isView() ? viewSize : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T* data() const { return isView() ? viewData : owned.data(); }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    // element storage for in-place edits, a view is copied out first
+    std::pmr::vector<T>& mutableElements() {
+        if (isView()) {
+            std::pmr::vector<T> copied(viewData, viewData + viewSize, owned.get_allocator());
+            assign(std::move(copied));
+        }
+        return owned;
+    }
+
+    // bytes owned by this buffer, views own none
+    size_t byteSize() const { return owned.capacity() * sizeof(T); }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MODEL_FILE_SOURCE_H
+#define MODEL_FILE_SOURCE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mmd/mapped_file.hpp>
+
+/*
+ * Somewhere other than the file system that models and their textures are
+ * read from. Paths are relative to the root of the source; '/' and '\'
+ * both separate directories, "." and ".." are resolved, and ASCII letters
+ * match regardless of case, the way the Windows tools that write PMX
+ * texture paths treat them.
+ * open() may be called from several threads at once.
+ */
+class FileSource {
+public:
+    virtual ~FileSource() = default;
+
+    // whole content of the file, throws std::runtime_error when there is none
+    virtual std::shared_ptr<MappedFile> open(const std::string &path) = 0;
+
+    // the key paths are looked up by
+    static std::string normalizePath(std::string_view path);
+};
+
+/*
+ * Files held in memory, e.g. downloaded or generated ones.
+ */
+class MemoryFileSource: public FileSource {
+    std::unordered_map<std::string, std::shared_ptr<MappedFile>> files;
+    std::mutex filesMutex;
+
+public:
+    // replaces any file of the same path
+    void add(const std::string &path, std::unique_ptr<char[]> data, size_t size);
+    void add(const std::string &path, const char *data, size_t size);
+
+    std::shared_ptr<MappedFile> open(const std::string &path) override;
+};
+
+/*
+ * Members of a zip archive, inflated each time they are opened. Only the
+ * central directory is read up front; members are independent, so textures
+ * opened from different threads inflate in parallel. Member names without
+ * the UTF-8 flag are taken to be Shift_JIS, as Japanese zip tools write
+ * them. Stored and deflated members are supported, encrypted ones and
+ * ZIP64 archives are not.
+ */
+class ZipFileSource: public FileSource {
+    struct ZipEntry {
+        uint64_t localHeaderOffset;
+        uint32_t compressedSize;
+        uint32_t size;
+        uint32_t crc;
+        uint16_t method;
+        uint16_t flags;
+    };
+
+    std::shared_ptr<MappedFile> archive;
+    std::unordered_map<std::string, ZipEntry> entries;
+    // UTF-8 member names in archive order
+    std::vector<std::string> paths;
+
+    void readCentralDirectory();
+
+public:
+    explicit ZipFileSource(const std::string &zipPath);
+    // an archive that is already in memory
+    explicit ZipFileSource(std::shared_ptr<MappedFile> archive_);
+
+    const std::vector<std::string>& getPaths() const { return paths; }
+
+    std::shared_ptr<MappedFile> open(const std::string &path) override;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef MODEL_MAPPED_FILE_H
+#define MODEL_MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/*
+ * Read-only view of a whole file. The file is memory mapped when the platform
+ * supports it, otherwise (or when mapping fails) it is read into a heap buffer.
+ * Content that is already in memory, e.g. an archive member, can be wrapped
+ * as well. Parsers work on data() either way.
+ */
+class MappedFile {
+    std::string filePath;
+    const char *fileData;
+    size_t fileSize;
+    bool mapped;
+    std::unique_ptr<char[]> buffer;
+
+    bool mapFile();
+    void readFile();
+
+public:
+    MappedFile(std::string filePath_, bool allowMmap = true);
+    // take over size bytes at buffer_, filePath_ only names them
+    MappedFile(std::string filePath_, std::unique_ptr<char[]> buffer_, size_t size);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char *data() const;
+    size_t size() const;
+    bool isMapped() const;
+
+    // page cache hints, no-ops for buffered files
+    void adviseSequential(size_t offset, size_t length);
+    void adviseWillNeed(size_t offset, size_t length);
+    void adviseDontNeed(size_t offset, size_t length);
+};
+
+#endif
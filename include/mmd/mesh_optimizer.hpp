@@ -0,0 +1,91 @@
+#ifndef MODEL_MESH_OPTIMIZER_H
+#define MODEL_MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// post-transform cache size meshes are reordered for and ACMR is reported for
+static const int MESH_CACHE_SIZE = 16;
+// meshlet limits, as sized for mesh shader workgroups
+static const int MESHLET_MAX_VERTICES = 64;
+static const int MESHLET_MAX_TRIANGLES = 124;
+
+/*
+ * A run of consecutive triangles culled as a whole. A meshlet is invisible
+ * when its bounding sphere is outside the view frustum, or when the camera
+ * sees the back of every triangle: for a camera at eye that is the case if
+ * dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius.
+ * coneCutoff is the sine of the widest angle between coneAxis and a triangle
+ * normal, 1 when the triangles face too many ways or are seen from both sides.
+ */
+struct PMXMeshlet {
+    uint32_t indexOffset, indexNum;
+    float center[3], radius;
+    float coneAxis[3], coneCutoff;
+};
+
+// what meshlets are tested against, all in model space
+struct PMXCullView {
+    // (a, b, c, d) with a x + b y + c z + d >= 0 inside, (a, b, c) of unit length
+    float planes[6][4];
+    float eye[3];
+};
+
+/*
+ * Reorder the indexNum / 3 triangles at indices, all referring to vertices
+ * below vertexNum, for hits in a post-transform vertex cache of cacheSize
+ * entries. Uses Tipsify (Sander et al.), which fans around one vertex at a
+ * time and runs in linear time. Triangles keep their winding, only their
+ * order changes.
+ */
+void optimizeVertexCache(uint32_t *indices, size_t indexNum, size_t vertexNum, int cacheSize = MESH_CACHE_SIZE);
+
+/*
+ * Number the vertices in the order indices first reference them and
+ * rewrite indices to the new numbers, so vertex fetches walk the buffer
+ * front to back. Vertices no triangle references keep their relative order
+ * after the referenced ones. Returns the old index of every new vertex.
+ */
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t indexNum, size_t vertexNum);
+
+/*
+ * Simplify the triangles at indices toward targetIndexNum indices by
+ * collapsing edges in the order of their quadric error (Garland and
+ * Heckbert). Vertices only ever move onto a neighbor, so the result indexes
+ * the same vertex buffer. positions holds xyz per vertex. Vertices on an
+ * open border of the mesh and vertices split at attribute (UV, normal)
+ * seams, i.e. sharing their position with another vertex, never move, and
+ * a vertex only collapses onto one of the same skinning group. No collapse
+ * moves a vertex farther than targetError from the planes of its original
+ * triangles, so the target may not be reached; error receives the largest
+ * such distance of the collapses made.
+ */
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t indexNum, const float *positions,
+                                   const uint32_t *skinGroups, size_t vertexNum, size_t targetIndexNum,
+                                   float targetError, float &error);
+
+/*
+ * Split the triangles at indices into meshlets of at most maxVertices
+ * vertices and maxTriangles triangles, in the order the triangles are
+ * drawn, so a vertex cache optimized order also gives compact meshlets.
+ * Index offsets are relative to indices. normals, xyz per vertex, tell the
+ * side a triangle faces; without backFaceCulling every coneCutoff is 1.
+ */
+std::vector<PMXMeshlet> buildMeshlets(const uint32_t *indices, size_t indexNum, const float *positions,
+                                      const float *normals, size_t vertexNum, bool backFaceCulling,
+                                      int maxVertices = MESHLET_MAX_VERTICES, int maxTriangles = MESHLET_MAX_TRIANGLES);
+
+// frustum of a column-major model-view-projection matrix and the camera position in model space
+PMXCullView makeCullView(const float *modelViewProj, const float *eye);
+
+bool isMeshletVisible(const PMXMeshlet &meshlet, const PMXCullView &view);
+
+/*
+ * Average cache miss ratio, vertex shader invocations per triangle, of
+ * drawing indices through a FIFO post-transform cache of cacheSize
+ * entries: 3 without any reuse, about 0.5 for a perfect grid.
+ */
+float computeACMR(const uint32_t *indices, size_t indexNum, size_t vertexNum, int cacheSize = MESH_CACHE_SIZE);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef MODEL_MODEL_LOADER_H
+#define MODEL_MODEL_LOADER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mmd/parser.hpp>
+#include <mmd/thread_pool.hpp>
+
+/*
+ * Loads many models at once. Every requested file is admitted in order
+ * while the file bytes of the models being read or decoded fit in the
+ * readahead budget (a single file larger than the budget is admitted
+ * alone). On admission the kernel is asked to read the whole file ahead, so
+ * disk reads of later models overlap the decoding of earlier ones.
+ *
+ * The budget bounds readahead only, it does not bound peak memory: a
+ * decoded model, and its textures above all, can be several times its file.
+ * Each admitted model is loaded start to finish (header scan, decode,
+ * texture decode) by one of the loader's own threads, so overlap between
+ * models comes from running several of them at once, not from pipelining
+ * the stages. Those threads hand their vertex chunks and texture decodes to
+ * the shared pool like any other load.
+ */
+class ModelLoader {
+    struct Job;
+
+    size_t readaheadBudget;
+    std::mutex jobsMutex;
+    std::condition_variable jobsCond;
+    // queued jobs not admitted yet, in request order
+    std::deque<std::shared_ptr<Job>> pendingJobs;
+    size_t inFlightBytes;
+    // declared last, so destroying the loader first finishes every queued job
+    ThreadPool drivers;
+
+    std::vector<std::string> admitJobs();
+    void runJob(const std::shared_ptr<Job> &job);
+
+public:
+    static const size_t DEFAULT_READAHEAD_BUDGET = (size_t)1 << 30;
+
+    // 0 drivers means half the hardware threads, but at least 2
+    explicit ModelLoader(size_t readaheadBudget_ = DEFAULT_READAHEAD_BUDGET, size_t driverNum = 0);
+    ModelLoader(const ModelLoader&) = delete;
+    ModelLoader& operator=(const ModelLoader&) = delete;
+
+    /*
+     * Queue the files and return right away. Each future holds the model
+     * or the exception its constructor threw; loadFlags are passed to every
+     * PMXModel.
+     */
+    std::future<std::unique_ptr<PMXModel>> load(const std::string &filePath, int loadFlags = 0);
+    std::vector<std::future<std::unique_ptr<PMXModel>>> load(const std::vector<std::string> &filePaths,
+                                                             int loadFlags = 0);
+
+    size_t getReadaheadBudget() const { return readaheadBudget; }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef MODEL_MOTION_H
+#define MODEL_MOTION_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mmd/parser.hpp>
+#include <mmd/text.hpp>
+
+// cubic Bezier from (0, 0) to (127, 127), control points in [0, 127]
+struct VMDCurve {
+    unsigned char x1, y1, x2, y2;
+};
+
+/*
+ * Track indices of a VMDMotion resolved against one model, -1 when the
+ * model has no bone or morph of that name. Bone indices are sorted
+ * (evaluation order) indices of PMXBoneData, morph indices are file indices.
+ */
+struct VMDBinding {
+    std::vector<int> boneTrackBones;
+    std::vector<int> morphTrackMorphs;
+};
+
+/*
+ * Bone and morph keyframes of a VMD file, grouped into one track per name.
+ * Keys of bone track i are [getBoneKeyBegin(i), getBoneKeyEnd(i)) in the
+ * key streams, sorted by frame with duplicate frames removed (the last one
+ * in the file wins). Camera, light, shadow and IK keys are not read.
+ * Track names are kept both as UTF-8 and as the raw Shift_JIS bytes of the
+ * file, which are what bind() matches model names against.
+ */
+class VMDMotion {
+    friend class VMDCursor;
+
+    std::string filePath;
+    PMXStringArena strings;
+    std::string_view modelName;
+
+    std::vector<std::string_view> boneTrackNames;
+    std::vector<std::string_view> boneTrackRawNames;
+    std::vector<uint32_t> boneTrackOffsets;
+    std::vector<uint32_t> boneFrames;
+    std::vector<PMXFloat3XYZ> bonePositions;
+    std::vector<PMXFloat4XYZW> boneRotations;
+    // 4 curves per key for X, Y, Z and rotation, shaping the segment ending at the key
+    std::vector<VMDCurve> boneCurves;
+
+    std::vector<std::string_view> morphTrackNames;
+    std::vector<std::string_view> morphTrackRawNames;
+    std::vector<uint32_t> morphTrackOffsets;
+    std::vector<uint32_t> morphFrames;
+    std::vector<float> morphWeights;
+
+    uint32_t lastFrame;
+
+    void parseFile(const char *data, size_t size);
+
+public:
+    static const int CURVE_X = 0;
+    static const int CURVE_Y = 1;
+    static const int CURVE_Z = 2;
+    static const int CURVE_ROTATION = 3;
+
+    explicit VMDMotion(const std::string &filePath_);
+    VMDMotion(const VMDMotion&) = delete;
+    VMDMotion& operator=(const VMDMotion&) = delete;
+
+    std::string_view getModelName() const { return modelName; }
+    uint32_t getLastFrame() const { return lastFrame; }
+
+    size_t getBoneTrackNum() const { return boneTrackNames.size(); }
+    std::string_view getBoneTrackName(size_t i) const { return boneTrackNames[i]; }
+    uint32_t getBoneKeyBegin(size_t i) const { return boneTrackOffsets[i]; }
+    uint32_t getBoneKeyEnd(size_t i) const { return boneTrackOffsets[i + 1]; }
+    uint32_t getBoneFrame(size_t key) const { return boneFrames[key]; }
+    const PMXFloat3XYZ& getBonePos(size_t key) const { return bonePositions[key]; }
+    const PMXFloat4XYZW& getBoneRotation(size_t key) const { return boneRotations[key]; }
+    const VMDCurve& getBoneCurve(size_t key, int curve) const { return boneCurves[4 * key + curve]; }
+
+    size_t getMorphTrackNum() const { return morphTrackNames.size(); }
+    std::string_view getMorphTrackName(size_t i) const { return morphTrackNames[i]; }
+    uint32_t getMorphKeyBegin(size_t i) const { return morphTrackOffsets[i]; }
+    uint32_t getMorphKeyEnd(size_t i) const { return morphTrackOffsets[i + 1]; }
+    uint32_t getMorphFrame(size_t key) const { return morphFrames[key]; }
+    float getMorphWeight(size_t key) const { return morphWeights[key]; }
+
+    // resolve track names against model, done once per motion and model pair
+    VMDBinding bind(PMXModel &model) const;
+};
+
+/*
+ * Playback position in every track of a motion. Each track remembers the
+ * key it was last sampled at, so moving forward frame by frame costs O(1)
+ * per track while seeking elsewhere falls back to a binary search.
+ * One cursor per playback; cursors are cheap and not thread safe.
+ */
+class VMDCursor {
+    const VMDMotion *motion;
+    std::vector<uint32_t> boneKeys;
+    std::vector<uint32_t> morphKeys;
+
+public:
+    explicit VMDCursor(const VMDMotion &motion_);
+
+    void sampleBone(size_t track, float frame, PMXFloat3XYZ &pos, PMXFloat4XYZW &rotation);
+    float sampleMorph(size_t track, float frame);
+
+    /*
+     * Sample every bound track at frame into per-model arrays indexed like
+     * binding (bone translations and rotations, morph weights). Entries of
+     * bones and morphs without a track are left untouched; any of the
+     * outputs may be null.
+     */
+    void samplePose(float frame, const VMDBinding &binding, PMXFloat3XYZ *bonePositions,
+                    PMXFloat4XYZW *boneRotations, float *morphWeights);
+};
+
+// evaluate curve at progress t in [0, 1]
+float evalVMDCurve(const VMDCurve &curve, float t);
+
+#endif
@@ -1,15 +1,29 @@
 #ifndef MODEL_PARSER_H
 #define MODEL_PARSER_H
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <exception>
+#include <stdexcept>
 #include <fstream>
+#include <future>
 #include <memory>
+#include <memory_resource>
 #include <vector>
-#include <FreeImagePlus.h>
+
+#include <mmd/arena.hpp>
+#include <mmd/buffer.hpp>
+#include <mmd/file_source.hpp>
+#include <mmd/mapped_file.hpp>
+#include <mmd/text.hpp>
+#include <mmd/thread_pool.hpp>
 
 struct PMXTextBuf {
-    std::string text;
+    // UTF8, stored in the model's string arena
+    std::string_view text;
     int originTextLen;
 };
 
@@ -20,43 +34,105 @@ struct PMXFloat3RGB {float r, g, b;};
 struct PMXFloat4XYZW {float x, y, z, w;};
 struct PMXFloat4RGBA {float r, g, b, a;};
 
-struct PMXVertex {
-    PMXFloat3XYZ pos;
-    PMXFloat3XYZ norm;
-    PMXFloat2UV UV;
-    PMXFloat4XYZW additionalUV[4];
-    unsigned char boneDeformMethod;
-    struct {
-        size_t boneIdx;
-    } BDEF1;
-    struct {
-        size_t boneIdx[2];
-        float weight;
-    } BDEF2;
-    struct {
-        size_t boneIdx[4];
-        float weight[4];
-    } BDEF4;
-    struct {
-        size_t boneIdx[2];
-        float weight;
-        PMXFloat3XYZ C;
-        PMXFloat3XYZ R0;
-        PMXFloat3XYZ R1;
-    } SDEF;
-    float edgeSizeX;
+struct PMXSDEFParams {
+    PMXFloat3XYZ C;
+    PMXFloat3XYZ R0;
+    PMXFloat3XYZ R1;
 };
 
+/*
+ * Vertex attributes stored as separate streams. Skinning data is packed:
+ * each vertex owns getBoneNum() consecutive slots in the bone index and
+ * weight streams (1 for BDEF1, 2 for BDEF2/SDEF, 4 for BDEF4), bone indices
+ * are 16-bit unless the model uses 4-byte bone indices, and additional UVs
+ * take space only when the model has them.
+ */
+class PMXVertexData {
+    friend class PMXModel;
+
+    std::pmr::vector<PMXFloat3XYZ> positions;
+    std::pmr::vector<PMXFloat3XYZ> normals;
+    std::pmr::vector<PMXFloat2UV> UVs;
+    int additionalUVNum;
+    std::pmr::vector<PMXFloat4XYZW> additionalUVs; // vertexNum * additionalUVNum
+    std::pmr::vector<unsigned char> deformMethods;
+    std::pmr::vector<float> edgeScales;
+
+    // skinning slots of vertex i are [skinOffsets[i], skinOffsets[i + 1])
+    std::pmr::vector<uint32_t> skinOffsets;
+    bool wideBoneIdx;
+    std::pmr::vector<int16_t> boneIndices16;
+    std::pmr::vector<int32_t> boneIndices32;
+    // slot weights, BDEF1 stores 1 and BDEF2/SDEF store (w, 1 - w)
+    std::pmr::vector<float> boneWeights;
+    // SDEF parameters of the SDEF vertices listed in ascending order
+    std::pmr::vector<uint32_t> SDEFVertices;
+    std::pmr::vector<PMXSDEFParams> SDEFParams;
+
+public:
+    explicit PMXVertexData(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    static const int DEFORM_METHOD_BDEF1 = 0;
+    static const int DEFORM_METHOD_BDEF2 = 1;
+    static const int DEFORM_METHOD_BDEF4 = 2;
+    static const int DEFORM_METHOD_SDEF = 3;
+
+    size_t size() const { return positions.size(); }
+    int getAdditionalUVNum() const { return additionalUVNum; }
+
+    const PMXFloat3XYZ& getPos(size_t i) const { return positions[i]; }
+    const PMXFloat3XYZ& getNorm(size_t i) const { return normals[i]; }
+    const PMXFloat2UV& getUV(size_t i) const { return UVs[i]; }
+    const PMXFloat4XYZW& getAdditionalUV(size_t i, int j) const { return additionalUVs[i * additionalUVNum + j]; }
+    unsigned char getDeformMethod(size_t i) const { return deformMethods[i]; }
+    float getEdgeScale(size_t i) const { return edgeScales[i]; }
+
+    int getBoneNum(size_t i) const { return skinOffsets[i + 1] - skinOffsets[i]; }
+    // -1 means no bone
+    int getBoneIdx(size_t i, int j) const {
+        size_t slot = skinOffsets[i] + j;
+        return wideBoneIdx ? boneIndices32[slot] : boneIndices16[slot];
+    }
+    float getBoneWeight(size_t i, int j) const { return boneWeights[skinOffsets[i] + j]; }
+    // only valid for SDEF vertices
+    const PMXSDEFParams& getSDEF(size_t i) const;
+
+    const std::pmr::vector<PMXFloat3XYZ>& getPositions() const { return positions; }
+    const std::pmr::vector<PMXFloat3XYZ>& getNormals() const { return normals; }
+    const std::pmr::vector<PMXFloat2UV>& getUVs() const { return UVs; }
+
+    // bytes held by the streams
+    size_t byteSize() const;
+};
+
+// laid out as three uint32_t so a surface array is a GL_UNSIGNED_INT element buffer
 struct PMXSurface {
-    size_t vertexIdx[3];
+    uint32_t vertexIdx[3];
+};
+static_assert(sizeof(PMXSurface) == 3 * sizeof(uint32_t), "PMXSurface must be tightly packed");
+
+struct PMXTextureLevel {
+    int width, height;
+    size_t offset;
 };
 
 struct PMXTexture {
+    explicit PMXTexture(std::pmr::memory_resource *resource = std::pmr::get_default_resource()):
+        levels(resource), pixels(resource) {}
+
     PMXTextBuf name;
-    fipImage image;
+    int width, height;
+    // RGBA8 mip chain with the top row first, levels[0] is the full image
+    std::pmr::vector<PMXTextureLevel> levels;
+    std::pmr::vector<unsigned char> pixels;
+    // empty if the image was decoded, otherwise why it was not
+    std::string loadError;
 };
 
 struct PMXMaterial {
+    // renderFlag bit of materials drawn without back-face culling
+    static const unsigned char RENDER_FLAG_DOUBLE_SIDED = 0x01;
+
     PMXTextBuf name;
     PMXTextBuf nameEn;
 
@@ -70,13 +146,14 @@ struct PMXMaterial {
     PMXFloat4RGBA edgeColor;
     float edgeSize;
 
-    size_t textureIdx;
-    size_t sphereTextureIdx;
+    // texture indices are -1 when unused
+    int textureIdx;
+    int sphereTextureIdx;
 
     unsigned char sphereMode;
 
     unsigned char toonFlag;
-    size_t toonTextureIdx;
+    int toonTextureIdx;
     unsigned char sharedToonTextureIdx;
 
     PMXTextBuf memo;
@@ -84,23 +161,363 @@ struct PMXMaterial {
     int surfaceNum;
 };
 
+/*
+ * Bones stored as separate streams in evaluation order: bones deformed
+ * before physics come first, then the after-physics ones, each group
+ * ordered by deform layer and then by depth in the hierarchy (file order
+ * breaks ties). Evaluating world transforms is a single forward pass.
+ * Every bone index held here (parent, tail, grant parent, IK target and
+ * links) is already in this order, getSortedIdx() maps the file indices
+ * used by vertices, morphs and rigid bodies. Fields that a bone's flags
+ * leave out of the file are zero, or -1 for indices.
+ */
+class PMXBoneData {
+    friend class PMXModel;
+
+    std::pmr::vector<PMXTextBuf> names;
+    std::pmr::vector<PMXTextBuf> namesEn;
+    std::pmr::vector<PMXFloat3XYZ> positions;
+    std::pmr::vector<int> parents;
+    std::pmr::vector<int> deformLayers;
+    std::pmr::vector<uint16_t> flags;
+    std::pmr::vector<PMXFloat3XYZ> tailOffsets;
+    std::pmr::vector<int> tailBones;
+    std::pmr::vector<int> grantParents;
+    std::pmr::vector<float> grantRatios;
+    std::pmr::vector<PMXFloat3XYZ> fixedAxes;
+    std::pmr::vector<PMXFloat3XYZ> localAxesX;
+    std::pmr::vector<PMXFloat3XYZ> localAxesZ;
+    std::pmr::vector<int> externalParentKeys;
+    // index of the first after-physics bone
+    int afterPhysicsBegin;
+
+    // file index <-> evaluation order
+    std::pmr::vector<int> sortedIdx;
+    std::pmr::vector<int> fileIdx;
+
+    // IK chains of the IK bones in evaluation order, the links of chain k
+    // are [IKLinkOffsets[k], IKLinkOffsets[k + 1])
+    std::pmr::vector<int> IKBones;
+    std::pmr::vector<int> IKTargets;
+    std::pmr::vector<int> IKLoopNums;
+    std::pmr::vector<float> IKLimitAngles;
+    std::pmr::vector<uint32_t> IKLinkOffsets;
+    std::pmr::vector<int> IKLinkBones;
+    std::pmr::vector<unsigned char> IKLinkLimited;
+    std::pmr::vector<PMXFloat3XYZ> IKLinkLowers;
+    std::pmr::vector<PMXFloat3XYZ> IKLinkUppers;
+
+public:
+    explicit PMXBoneData(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    static const int BONE_FLAG_TAIL_BONE = 0x0001;
+    static const int BONE_FLAG_ROTATABLE = 0x0002;
+    static const int BONE_FLAG_MOVABLE = 0x0004;
+    static const int BONE_FLAG_VISIBLE = 0x0008;
+    static const int BONE_FLAG_OPERABLE = 0x0010;
+    static const int BONE_FLAG_IK = 0x0020;
+    static const int BONE_FLAG_LOCAL_GRANT = 0x0080;
+    static const int BONE_FLAG_ROTATION_GRANT = 0x0100;
+    static const int BONE_FLAG_TRANSLATION_GRANT = 0x0200;
+    static const int BONE_FLAG_FIXED_AXIS = 0x0400;
+    static const int BONE_FLAG_LOCAL_AXIS = 0x0800;
+    static const int BONE_FLAG_AFTER_PHYSICS = 0x1000;
+    static const int BONE_FLAG_EXTERNAL_PARENT = 0x2000;
+
+    size_t size() const { return positions.size(); }
+
+    const PMXTextBuf& getName(size_t i) const { return names[i]; }
+    const PMXTextBuf& getNameEn(size_t i) const { return namesEn[i]; }
+    const PMXFloat3XYZ& getPos(size_t i) const { return positions[i]; }
+    int getParent(size_t i) const { return parents[i]; }
+    int getDeformLayer(size_t i) const { return deformLayers[i]; }
+    uint16_t getFlags(size_t i) const { return flags[i]; }
+    bool hasFlag(size_t i, int flag) const { return (flags[i] & flag) != 0; }
+    const PMXFloat3XYZ& getTailOffset(size_t i) const { return tailOffsets[i]; }
+    int getTailBone(size_t i) const { return tailBones[i]; }
+    int getGrantParent(size_t i) const { return grantParents[i]; }
+    float getGrantRatio(size_t i) const { return grantRatios[i]; }
+    const PMXFloat3XYZ& getFixedAxis(size_t i) const { return fixedAxes[i]; }
+    const PMXFloat3XYZ& getLocalAxisX(size_t i) const { return localAxesX[i]; }
+    const PMXFloat3XYZ& getLocalAxisZ(size_t i) const { return localAxesZ[i]; }
+    int getExternalParentKey(size_t i) const { return externalParentKeys[i]; }
+    // bones [0, getAfterPhysicsBegin()) are deformed before physics
+    int getAfterPhysicsBegin() const { return afterPhysicsBegin; }
+
+    // -1 stays -1
+    int getSortedIdx(int fileBoneIdx) const { return fileBoneIdx < 0 ? -1 : sortedIdx[fileBoneIdx]; }
+    int getFileIdx(size_t i) const { return fileIdx[i]; }
+
+    size_t getIKNum() const { return IKBones.size(); }
+    int getIKBone(size_t k) const { return IKBones[k]; }
+    int getIKTarget(size_t k) const { return IKTargets[k]; }
+    int getIKLoopNum(size_t k) const { return IKLoopNums[k]; }
+    // radians per iteration
+    float getIKLimitAngle(size_t k) const { return IKLimitAngles[k]; }
+    int getIKLinkNum(size_t k) const { return IKLinkOffsets[k + 1] - IKLinkOffsets[k]; }
+    int getIKLinkBone(size_t k, int j) const { return IKLinkBones[IKLinkOffsets[k] + j]; }
+    bool isIKLinkLimited(size_t k, int j) const { return IKLinkLimited[IKLinkOffsets[k] + j] != 0; }
+    // radians, only meaningful for limited links
+    const PMXFloat3XYZ& getIKLinkLower(size_t k, int j) const { return IKLinkLowers[IKLinkOffsets[k] + j]; }
+    const PMXFloat3XYZ& getIKLinkUpper(size_t k, int j) const { return IKLinkUppers[IKLinkOffsets[k] + j]; }
+
+    // bytes held by the streams
+    size_t byteSize() const;
+};
+
+struct PMXMaterialMorphOffset {
+    // -1 applies the offset to every material
+    int materialIdx;
+    unsigned char operation;
+    PMXFloat4RGBA diffuse;
+    PMXFloat3RGB specular;
+    float specularX;
+    PMXFloat3RGB ambient;
+    PMXFloat4RGBA edgeColor;
+    float edgeSize;
+    PMXFloat4RGBA textureFactor;
+    PMXFloat4RGBA sphereTextureFactor;
+    PMXFloat4RGBA toonTextureFactor;
+};
+
+struct PMXImpulseMorphOffset {
+    int rigidIdx;
+    unsigned char local;
+    PMXFloat3XYZ velocity;
+    PMXFloat3XYZ torque;
+};
+
+/*
+ * Morphs in file order. The offsets of each morph type live in one table per
+ * type, where morph i owns the contiguous run [getOffsetBegin(i),
+ * getOffsetBegin(i) + getOffsetNum(i)); the getXs(i) accessors return the
+ * start of that run. Vertex and all UV morphs share one vertex index table
+ * layout, so applying a morph only touches the vertices it moves.
+ * Group morphs are flattened at load time into weighted lists of the
+ * non-group morphs they end up driving, flip morphs keep their list as is.
+ * Bone indices are file indices, see PMXBoneData::getSortedIdx().
+ */
+class PMXMorphData {
+    friend class PMXModel;
+
+    std::pmr::vector<PMXTextBuf> names;
+    std::pmr::vector<PMXTextBuf> namesEn;
+    std::pmr::vector<unsigned char> panels;
+    std::pmr::vector<unsigned char> types;
+    std::pmr::vector<uint32_t> offsetBegins;
+    std::pmr::vector<uint32_t> offsetNums;
+
+    // vertex morphs
+    std::pmr::vector<uint32_t> vertexIndices;
+    std::pmr::vector<PMXFloat3XYZ> positionDeltas;
+    // UV and additional UV morphs
+    std::pmr::vector<uint32_t> UVVertexIndices;
+    std::pmr::vector<PMXFloat4XYZW> UVDeltas;
+    // bone morphs
+    std::pmr::vector<int> boneIndices;
+    std::pmr::vector<PMXFloat3XYZ> boneTranslations;
+    std::pmr::vector<PMXFloat4XYZW> boneRotations;
+    // material morphs
+    std::pmr::vector<PMXMaterialMorphOffset> materialOffsets;
+    // group (flattened) and flip morphs
+    std::pmr::vector<int> morphIndices;
+    std::pmr::vector<float> morphWeights;
+    // impulse morphs
+    std::pmr::vector<PMXImpulseMorphOffset> impulseOffsets;
+
+public:
+    explicit PMXMorphData(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    static const int MORPH_TYPE_GROUP = 0;
+    static const int MORPH_TYPE_VERTEX = 1;
+    static const int MORPH_TYPE_BONE = 2;
+    static const int MORPH_TYPE_UV = 3;
+    static const int MORPH_TYPE_ADDITIONAL_UV1 = 4;
+    static const int MORPH_TYPE_ADDITIONAL_UV2 = 5;
+    static const int MORPH_TYPE_ADDITIONAL_UV3 = 6;
+    static const int MORPH_TYPE_ADDITIONAL_UV4 = 7;
+    static const int MORPH_TYPE_MATERIAL = 8;
+    static const int MORPH_TYPE_FLIP = 9;
+    static const int MORPH_TYPE_IMPULSE = 10;
+
+    static const int MATERIAL_MORPH_MULTIPLY = 0;
+    static const int MATERIAL_MORPH_ADD = 1;
+
+    size_t size() const { return types.size(); }
+
+    const PMXTextBuf& getName(size_t i) const { return names[i]; }
+    const PMXTextBuf& getNameEn(size_t i) const { return namesEn[i]; }
+    unsigned char getPanel(size_t i) const { return panels[i]; }
+    unsigned char getType(size_t i) const { return types[i]; }
+    // 0 for the UV morph, 1-4 for the additional UV morphs
+    int getUVChannel(size_t i) const { return types[i] - MORPH_TYPE_UV; }
+    uint32_t getOffsetBegin(size_t i) const { return offsetBegins[i]; }
+    uint32_t getOffsetNum(size_t i) const { return offsetNums[i]; }
+
+    const uint32_t* getVertexIndices(size_t i) const { return vertexIndices.data() + offsetBegins[i]; }
+    const PMXFloat3XYZ* getPositionDeltas(size_t i) const { return positionDeltas.data() + offsetBegins[i]; }
+    const uint32_t* getUVVertexIndices(size_t i) const { return UVVertexIndices.data() + offsetBegins[i]; }
+    const PMXFloat4XYZW* getUVDeltas(size_t i) const { return UVDeltas.data() + offsetBegins[i]; }
+    const int* getBoneIndices(size_t i) const { return boneIndices.data() + offsetBegins[i]; }
+    const PMXFloat3XYZ* getBoneTranslations(size_t i) const { return boneTranslations.data() + offsetBegins[i]; }
+    const PMXFloat4XYZW* getBoneRotations(size_t i) const { return boneRotations.data() + offsetBegins[i]; }
+    const PMXMaterialMorphOffset* getMaterialOffsets(size_t i) const { return materialOffsets.data() + offsetBegins[i]; }
+    const int* getMorphIndices(size_t i) const { return morphIndices.data() + offsetBegins[i]; }
+    const float* getMorphWeights(size_t i) const { return morphWeights.data() + offsetBegins[i]; }
+    const PMXImpulseMorphOffset* getImpulseOffsets(size_t i) const { return impulseOffsets.data() + offsetBegins[i]; }
+
+    // bytes held by the tables
+    size_t byteSize() const;
+};
+
+/*
+ * Rigid bodies and joints as separate streams, in file order. Collision
+ * filtering is precomputed as 16-bit masks, and the dynamic bodies are
+ * partitioned into islands: sets of bodies connected through joints that
+ * can be solved independently of each other. Bone-following (static)
+ * bodies have infinite mass and do not connect islands, so they belong to
+ * none (island -1). Each joint belongs to the island of its dynamic
+ * bodies, joints between two static bodies to none.
+ * Bone indices are file indices, see PMXBoneData::getSortedIdx().
+ */
+class PMXPhysicsData {
+    friend class PMXModel;
+
+    // rigid bodies
+    std::pmr::vector<PMXTextBuf> bodyNames;
+    std::pmr::vector<PMXTextBuf> bodyNamesEn;
+    std::pmr::vector<int> bodyBones;
+    std::pmr::vector<unsigned char> bodyGroups;
+    // bit g set: member of group g / collides with group g
+    std::pmr::vector<uint16_t> groupMasks;
+    std::pmr::vector<uint16_t> collisionMasks;
+    std::pmr::vector<unsigned char> shapes;
+    std::pmr::vector<PMXFloat3XYZ> shapeSizes;
+    std::pmr::vector<PMXFloat3XYZ> bodyPositions;
+    std::pmr::vector<PMXFloat3XYZ> bodyRotations;
+    std::pmr::vector<float> masses;
+    std::pmr::vector<float> linearDampings;
+    std::pmr::vector<float> angularDampings;
+    std::pmr::vector<float> restitutions;
+    std::pmr::vector<float> frictions;
+    std::pmr::vector<unsigned char> physicsModes;
+
+    // joints
+    std::pmr::vector<PMXTextBuf> jointNames;
+    std::pmr::vector<PMXTextBuf> jointNamesEn;
+    std::pmr::vector<unsigned char> jointTypes;
+    std::pmr::vector<int> jointBodiesA;
+    std::pmr::vector<int> jointBodiesB;
+    std::pmr::vector<PMXFloat3XYZ> jointPositions;
+    std::pmr::vector<PMXFloat3XYZ> jointRotations;
+    std::pmr::vector<PMXFloat3XYZ> translationLowers;
+    std::pmr::vector<PMXFloat3XYZ> translationUppers;
+    std::pmr::vector<PMXFloat3XYZ> rotationLowers;
+    std::pmr::vector<PMXFloat3XYZ> rotationUppers;
+    std::pmr::vector<PMXFloat3XYZ> translationSprings;
+    std::pmr::vector<PMXFloat3XYZ> rotationSprings;
+
+    // islands, island k holds [islandBodyOffsets[k], islandBodyOffsets[k + 1])
+    // of islandBodies and the same range of islandJointOffsets in islandJoints
+    std::pmr::vector<int> bodyIslands;
+    std::pmr::vector<int> jointIslands;
+    std::pmr::vector<uint32_t> islandBodyOffsets;
+    std::pmr::vector<int> islandBodies;
+    std::pmr::vector<uint32_t> islandJointOffsets;
+    std::pmr::vector<int> islandJoints;
+
+public:
+    explicit PMXPhysicsData(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    static const int SHAPE_SPHERE = 0;
+    static const int SHAPE_BOX = 1;
+    static const int SHAPE_CAPSULE = 2;
+
+    static const int PHYSICS_MODE_STATIC = 0;
+    static const int PHYSICS_MODE_DYNAMIC = 1;
+    static const int PHYSICS_MODE_DYNAMIC_BONE = 2;
+
+    size_t getBodyNum() const { return shapes.size(); }
+    const PMXTextBuf& getBodyName(size_t i) const { return bodyNames[i]; }
+    const PMXTextBuf& getBodyNameEn(size_t i) const { return bodyNamesEn[i]; }
+    // -1 if the body follows no bone
+    int getBodyBone(size_t i) const { return bodyBones[i]; }
+    unsigned char getBodyGroup(size_t i) const { return bodyGroups[i]; }
+    uint16_t getGroupMask(size_t i) const { return groupMasks[i]; }
+    uint16_t getCollisionMask(size_t i) const { return collisionMasks[i]; }
+    bool canCollide(size_t i, size_t j) const {
+        return (groupMasks[i] & collisionMasks[j]) && (groupMasks[j] & collisionMasks[i]);
+    }
+    unsigned char getShape(size_t i) const { return shapes[i]; }
+    const PMXFloat3XYZ& getShapeSize(size_t i) const { return shapeSizes[i]; }
+    const PMXFloat3XYZ& getBodyPos(size_t i) const { return bodyPositions[i]; }
+    // radians
+    const PMXFloat3XYZ& getBodyRotation(size_t i) const { return bodyRotations[i]; }
+    float getMass(size_t i) const { return masses[i]; }
+    float getLinearDamping(size_t i) const { return linearDampings[i]; }
+    float getAngularDamping(size_t i) const { return angularDampings[i]; }
+    float getRestitution(size_t i) const { return restitutions[i]; }
+    float getFriction(size_t i) const { return frictions[i]; }
+    unsigned char getPhysicsMode(size_t i) const { return physicsModes[i]; }
+
+    size_t getJointNum() const { return jointTypes.size(); }
+    const PMXTextBuf& getJointName(size_t i) const { return jointNames[i]; }
+    const PMXTextBuf& getJointNameEn(size_t i) const { return jointNamesEn[i]; }
+    unsigned char getJointType(size_t i) const { return jointTypes[i]; }
+    // -1 if unused
+    int getJointBodyA(size_t i) const { return jointBodiesA[i]; }
+    int getJointBodyB(size_t i) const { return jointBodiesB[i]; }
+    const PMXFloat3XYZ& getJointPos(size_t i) const { return jointPositions[i]; }
+    const PMXFloat3XYZ& getJointRotation(size_t i) const { return jointRotations[i]; }
+    const PMXFloat3XYZ& getTranslationLower(size_t i) const { return translationLowers[i]; }
+    const PMXFloat3XYZ& getTranslationUpper(size_t i) const { return translationUppers[i]; }
+    const PMXFloat3XYZ& getRotationLower(size_t i) const { return rotationLowers[i]; }
+    const PMXFloat3XYZ& getRotationUpper(size_t i) const { return rotationUppers[i]; }
+    const PMXFloat3XYZ& getTranslationSpring(size_t i) const { return translationSprings[i]; }
+    const PMXFloat3XYZ& getRotationSpring(size_t i) const { return rotationSprings[i]; }
+
+    size_t getIslandNum() const { return islandBodyOffsets.size() - 1; }
+    int getBodyIsland(size_t i) const { return bodyIslands[i]; }
+    int getJointIsland(size_t i) const { return jointIslands[i]; }
+    int getIslandBodyNum(size_t k) const { return islandBodyOffsets[k + 1] - islandBodyOffsets[k]; }
+    const int* getIslandBodies(size_t k) const { return islandBodies.data() + islandBodyOffsets[k]; }
+    int getIslandJointNum(size_t k) const { return islandJointOffsets[k + 1] - islandJointOffsets[k]; }
+    const int* getIslandJoints(size_t k) const { return islandJoints.data() + islandJointOffsets[k]; }
+
+    // bytes held by the streams
+    size_t byteSize() const;
+};
+
+/*
+ * Malformed or truncated model file, found while validating it.
+ * getOffset() is the file offset of the offending field or record.
+ */
+class PMXFormatError: public std::runtime_error {
+    size_t offset;
+
+public:
+    PMXFormatError(const std::string &message, size_t offset_);
+    size_t getOffset() const { return offset; }
+};
+
 class PMXModel {
     static const int MAGIC = 0x20584d50; // "PMX "
 
     static const int TEXT_ENCODING_UTF16 = 0;
     static const int TEXT_ENCODING_UTF8 = 1;
 
-    static const int DEFORM_METHOD_BDEF1 = 0;
-    static const int DEFORM_METHOD_BDEF2 = 1;
-    static const int DEFORM_METHOD_BDEF4 = 2;
-    static const int DEFORM_METHOD_SDEF = 3;
-
     static const int TOON_NON_SHARED_FLAG = 0;
     static const int TOON_SHARED_FLAG = 1;
 
     std::string filePath;
-    std::unique_ptr<char> memBlock;
+    // null when filePath is on the file system
+    std::shared_ptr<FileSource> fileSource;
+    int loadFlags;
+    // only alive while parsing
+    std::shared_ptr<MappedFile> fileBlock;
     size_t fileSize;
+    // owns all decoded data, so it is declared before (and freed after) it
+    PMXArena arena;
 
     // PMX header
     float ver;
@@ -116,50 +533,266 @@ class PMXModel {
     } globals;
 
     // model info
-    std::string modelName;
-    std::string modelNameEn;
-    std::string modelComment;
-    std::string modelCommentEn;
+    std::string_view modelName;
+    std::string_view modelNameEn;
+    std::string_view modelComment;
+    std::string_view modelCommentEn;
+    // backing storage of every text field
+    PMXStringArena strings;
+    // bytes of text found by the scan pass, not decoded yet
+    size_t scannedTextLen;
+
+    // location of a section in the file and its decoder, run at most once
+    struct PMXSection {
+        size_t offset;
+        size_t size;
+        void (PMXModel::*read)(const char *buf);
+        std::once_flag decoded;
+    };
+    // sections not decoded yet, the file is released when this drops to 0
+    std::atomic<int> pendingSectionNum;
 
     // vertex
     int vertexNum;
-    size_t vertexRegionSize;
-    std::vector<PMXVertex> vertices;
+    PMXSection vertexSection;
+    PMXVertexData vertices;
+    // run of vertex records decoded by one task
+    struct PMXVertexChunk {
+        int begin, end;
+        size_t bufOffset;
+        uint32_t skinOffset;
+        uint32_t SDEFOffset;
+    };
+    std::vector<PMXVertexChunk> vertexChunks;
+    uint32_t vertexSkinNum;
+    uint32_t vertexSDEFNum;
 
     // surface
     int surfaceNum;
-    size_t surfaceRegionSize;
-    std::vector<PMXSurface> surfaces;
+    PMXSection surfaceSection;
+    PMXBuffer<PMXSurface> surfaces;
 
     // texture
     int textureNum;
-    size_t textureRegionSize;
-    std::vector<PMXTexture> textures;
+    PMXSection textureSection;
+    std::pmr::vector<PMXTexture> textures;
+    // image decodes started by readTextures, joined by getTextures
+    std::vector<std::future<void>> textureJobs;
+    std::once_flag texturesJoined;
 
     // material
     int materialNum;
-    size_t materialRegionSize;
-    std::vector<PMXMaterial> materials;
+    PMXSection materialSection;
+    std::pmr::vector<PMXMaterial> materials;
+
+    // bone
+    int boneNum;
+    PMXSection boneSection;
+    PMXBoneData bones;
+    uint32_t boneIKNum;
+    uint32_t boneIKLinkNum;
+    // bone as read from the file, before sorting, with file bone indices
+    struct PMXBoneRecord {
+        PMXTextBuf name, nameEn;
+        PMXFloat3XYZ pos;
+        int parent;
+        int deformLayer;
+        uint16_t flags;
+        PMXFloat3XYZ tailOffset;
+        int tailBone;
+        int grantParent;
+        float grantRatio;
+        PMXFloat3XYZ fixedAxis;
+        PMXFloat3XYZ localAxisX, localAxisZ;
+        int externalParentKey;
+        int IKTarget;
+        int IKLoopNum;
+        float IKLimitAngle;
+        // links in [IKLinkBegin, IKLinkEnd)
+        uint32_t IKLinkBegin, IKLinkEnd;
+        int depth;
+    };
+    struct PMXBoneIKLink {
+        int bone;
+        unsigned char limited;
+        PMXFloat3XYZ lower, upper;
+    };
+
+    // morph
+    int morphNum;
+    PMXSection morphSection;
+    PMXMorphData morphs;
+    // offsets of all morphs of each type
+    uint32_t morphOffsetNums[PMXMorphData::MORPH_TYPE_IMPULSE + 1];
+
+    // display frames are only skipped
+    int displayFrameNum;
+
+    // rigid body and joint, decoded together
+    int rigidBodyNum;
+    int jointNum;
+    PMXSection physicsSection;
+    PMXPhysicsData physics;
+
+    // legacy PMD files, see pmd_parser.cpp
+    size_t pmdEnglishOffset;
+    // texture table built from the material texture fields and the toon list
+    std::vector<PMXTextBuf> pmdTextureNames;
+    // texture index of each toon slot, -1 for the shared toon of that slot
+    int pmdToonTextures[10];
 
     void readFile();
+    void releaseFileBlock();
     void parseFile();
-    size_t readIdx(char *buf, size_t idxSize);
-    PMXTextBuf readTextBuf(char *buf);
-    void readVertices(char *buf);
-    void readSurfaces(char *buf);
-    void readTextures(char *buf);
-    void readMaterials(char *buf);
+    size_t estimateDecodedSize();
+    void decodeSection(PMXSection &section);
+    size_t readIdx(const char *buf, size_t idxSize);
+    int readSignedIdx(const char *buf, size_t idxSize);
+    void readIndices(const char *buf, size_t idxSize, size_t stride, size_t num, uint32_t *dst);
+    void readIndices(const char *buf, size_t idxSize, size_t stride, size_t num, int *dst);
+    // idxSize 0 reads runtimeSize bytes through readSignedIdx
+    template <int idxSize>
+    int readSignedIdxAs(const char *buf, size_t runtimeSize);
+    PMXTextBuf readTextBuf(const char *buf);
+    size_t skipTextBuf(const char *buf);
+    /*
+     * Validation for the scan pass, which checks every section against the
+     * file size before anything is decoded. The decoders trust its results.
+     */
+    void requireBytes(const char *buf, size_t bytes, const char *what);
+    int readCount(const char *buf, const char *what);
+    size_t checkTextBuf(const char *buf);
+    void checkVertexBones();
+    void checkMaterials();
+    void checkMorphIndices(const std::vector<int> &groupMorphIndices);
+    void checkPhysicsIndices();
+    // scanX walks section X only as far as needed to find its size
+    size_t scanVertices(const char *buf);
+    void readVertices(const char *buf);
+    void allocateVertices();
+    void decodeVertexChunks(const char *buf, void (PMXModel::*decode)(const char *, const PMXVertexChunk &));
+    /*
+     * Record decoders specialized on the index widths and additional UV
+     * count they read, picked once per model from globals. A width of 0 or a
+     * UV count of -1 is the generic version reading them from globals.
+     */
+    template <int boneIdxSize, int additionalUVNum>
+    void decodeVertexChunk(const char *buf, const PMXVertexChunk &chunk);
+    void (PMXModel::*selectVertexDecoder())(const char *, const PMXVertexChunk &);
+    size_t scanSurfaces(const char *buf);
+    void readSurfaces(const char *buf);
+    size_t scanTextures(const char *buf);
+    void readTextures(const char *buf);
+    void startTextureLoads();
+    void loadTextureImage(PMXTexture &texture);
+    void joinTextures();
+    // without collecting results, for when the model goes away
+    void waitTextureJobs();
+    size_t scanMaterials(const char *buf);
+    void readMaterials(const char *buf);
+    template <int textureIdxSize>
+    void decodeMaterials(const char *buf);
+    size_t scanBones(const char *buf);
+    void readBones(const char *buf);
+    // sort the records into evaluation order and fill bones
+    void storeBones(std::vector<PMXBoneRecord> &records, const std::vector<PMXBoneIKLink> &links);
+    size_t scanMorphs(const char *buf);
+    size_t morphOffsetSize(int type);
+    void readMorphs(const char *buf);
+    size_t scanDisplayFrames(const char *buf);
+    size_t scanRigidBodies(const char *buf);
+    size_t scanJoints(const char *buf);
+    void readPhysics(const char *buf);
+    void buildPhysicsIslands();
+
+    void parsePMDFile();
+    PMXTextBuf readFixedTextBuf(const char *buf, size_t width);
+    int addPMDTexture(std::string_view name);
+    void readPMDVertices(const char *buf);
+    void decodePMDVertexChunk(const char *buf, const PMXVertexChunk &chunk);
+    void readPMDTextures(const char *buf);
+    void readPMDMaterials(const char *buf);
+    void readPMDBones(const char *buf);
+    void readPMDMorphs(const char *buf);
+    void readPMDPhysics(const char *buf);
+
+    void optimizeMesh();
+    void permuteVertices(const std::vector<uint32_t> &order);
+    // keep the old vertices order lists, old vertex v becomes newIndices[v]
+    void remapVertices(const std::vector<uint32_t> &order, const std::vector<uint32_t> &newIndices);
+    void weldKey(size_t i, float epsilon, std::vector<uint32_t> &key) const;
+    bool weldClose(size_t a, size_t b, float epsilon) const;
 
 #ifdef MODEL_PARSER_DEBUG
-    void printVertex(PMXVertex vertex);
+    void printVertex(size_t idx);
 #endif
 
 public:
-    PMXModel(std::string filePath);
-    std::vector<PMXVertex>& getVertices();
-    std::vector<PMXSurface>& getSurfaces();
-    std::vector<PMXTexture>& getTextures();
-    std::vector<PMXMaterial>& getMaterials();
+    // read the file with buffered I/O instead of memory mapping it
+    static const int LOAD_BUFFERED = 1 << 0;
+    // decode everything on the calling thread
+    static const int LOAD_SINGLE_THREADED = 1 << 1;
+    /*
+     * Only read the header and locate the sections. Each section is decoded
+     * the first time its accessor is called, from any thread, and the file
+     * stays open until all of them are.
+     */
+    static const int LOAD_LAZY = 1 << 2;
+    // decode with the generic record decoders instead of the specialized ones
+    static const int LOAD_GENERIC_DECODERS = 1 << 3;
+    /*
+     * Reorder the triangles of every material for the post-transform vertex
+     * cache, then the vertices in the order they are drawn. Morph vertex
+     * references follow the new vertex order. Vertices, surfaces, materials
+     * and morphs are decoded right away, also with LOAD_LAZY.
+     */
+    static const int LOAD_OPTIMIZE_MESH = 1 << 4;
+    // weldVertices() with bit-identical matching right after loading, before LOAD_OPTIMIZE_MESH
+    static const int LOAD_WELD_VERTICES = 1 << 5;
+
+    // reads PMX 2.0/2.1 and legacy PMD 1.0 files, getVersion() tells them apart
+    PMXModel(std::string filePath, int loadFlags = 0);
+    // read the model and its textures from fileSource instead, filePath is relative to it
+    PMXModel(std::shared_ptr<FileSource> fileSource_, std::string filePath, int loadFlags = 0);
+    ~PMXModel();
+
+    // available without decoding any section
+    float getVersion() const;
+    std::string_view getModelName() const;
+    std::string_view getModelNameEn() const;
+    std::string_view getModelComment() const;
+    std::string_view getModelCommentEn() const;
+    int getVertexNum() const;
+    int getSurfaceNum() const;
+    int getTextureNum() const;
+    int getMaterialNum() const;
+    int getBoneNum() const;
+    int getMorphNum() const;
+    int getRigidBodyNum() const;
+    int getJointNum() const;
+
+    PMXVertexData& getVertices();
+    PMXBuffer<PMXSurface>& getSurfaces();
+    std::pmr::vector<PMXTexture>& getTextures();
+    std::pmr::vector<PMXMaterial>& getMaterials();
+    PMXBoneData& getBones();
+    PMXMorphData& getMorphs();
+    PMXPhysicsData& getPhysics();
+
+    // storage of everything decoded so far
+    PMXArena& getArena();
+
+    /*
+     * Merge vertices equal in position, normal, UVs, edge scale and
+     * skinning into the first of them and point surfaces at it. Floats match
+     * bit for bit, or, with an epsilon, when every component of the position,
+     * normal, UVs and edge scale is within epsilon of the vertex merged into
+     * (skinning still matches exactly). Vertices a vertex or UV morph moves
+     * are never merged; morph and SDEF vertex references follow the new
+     * numbering. Decodes vertices, surfaces and morphs. Returns the number of
+     * vertices removed.
+     */
+    size_t weldVertices(float epsilon = 0.0f);
 };
 
 #endif
@@ -0,0 +1,79 @@
+#ifndef MODEL_POSE_H
+#define MODEL_POSE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mmd/parser.hpp>
+
+/*
+ * Bone and morph names of one model keyed by their Shift_JIS bytes, the
+ * encoding VPD files use. Built once per model, then shared read-only by
+ * every pose load so no file name has to be transcoded.
+ * Bone indices are sorted (evaluation order) indices of PMXBoneData, morph
+ * indices are file indices.
+ */
+class VPDNameMap {
+    // encoded names, the maps view into them
+    std::vector<std::string> encodedNames;
+    std::unordered_map<std::string_view, int> bones;
+    std::unordered_map<std::string_view, int> morphs;
+    size_t boneNum, morphNum;
+
+public:
+    explicit VPDNameMap(PMXModel &model);
+    VPDNameMap(const VPDNameMap&) = delete;
+    VPDNameMap& operator=(const VPDNameMap&) = delete;
+
+    size_t getBoneNum() const { return boneNum; }
+    size_t getMorphNum() const { return morphNum; }
+
+    // -1 when the model has no such name
+    int findBone(std::string_view name) const;
+    int findMorph(std::string_view name) const;
+};
+
+struct VPDBoneTransform {
+    PMXFloat3XYZ translation;
+    PMXFloat4XYZW rotation;
+};
+
+/*
+ * Poses of one model, each a fixed-size run of getBoneNum() local bone
+ * transforms and getMorphNum() morph weights in one contiguous block.
+ * Bones and morphs a file does not mention keep the identity transform and
+ * weight 0. Files that fail to load keep the rest pose and report why
+ * through getError().
+ */
+class VPDPoseSet {
+    size_t boneNum, morphNum;
+    std::vector<std::string> filePaths;
+    std::vector<VPDBoneTransform> transforms;
+    std::vector<float> morphWeights;
+    std::vector<std::string> errors;
+    // names found in the file but not in the model
+    std::vector<uint32_t> unmatchedNums;
+
+    void parsePose(size_t i, const char *data, size_t size, const VPDNameMap &names);
+
+public:
+    // read all files in parallel on the shared thread pool
+    VPDPoseSet(const std::vector<std::string> &filePaths_, const VPDNameMap &names);
+
+    size_t size() const { return filePaths.size(); }
+    size_t getBoneNum() const { return boneNum; }
+    size_t getMorphNum() const { return morphNum; }
+
+    const std::string& getFilePath(size_t i) const { return filePaths[i]; }
+    bool isLoaded(size_t i) const { return errors[i].empty(); }
+    const std::string& getError(size_t i) const { return errors[i]; }
+    uint32_t getUnmatchedNum(size_t i) const { return unmatchedNums[i]; }
+
+    const VPDBoneTransform* getBones(size_t i) const { return transforms.data() + i * boneNum; }
+    const float* getMorphWeights(size_t i) const { return morphWeights.data() + i * morphNum; }
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef MODEL_RENDER_CACHE_H
+#define MODEL_RENDER_CACHE_H
+
+#include <memory>
+#include <string>
+
+#include <mmd/render_data.hpp>
+
+/*
+ * On-disk copy of a model's PMXRenderData. Each block of the file is 8-byte
+ * aligned so a mapped cache is used in place without copying. The file
+ * records size and modification time of the PMX and of every texture and
+ * carries a checksum of its payload; a cache that is stale, corrupt or from
+ * another format version is ignored and rebuilt.
+ */
+class PMXRenderCache {
+    static const uint32_t VERSION = 4;
+
+    // empty: the cache lives next to the model
+    std::string cacheDir;
+
+public:
+    explicit PMXRenderCache(std::string cacheDir_ = "");
+
+    std::string cachePath(const std::string &modelPath) const;
+    // nullptr if there is no usable cache for the model
+    std::shared_ptr<PMXRenderData> load(const std::string &modelPath) const;
+    void store(const std::string &modelPath, const PMXRenderData &data) const;
+    // load, or parse, weld and mesh-optimize the model, build its levels of detail and store the result
+    std::shared_ptr<PMXRenderData> loadOrBuild(const std::string &modelPath, int loadFlags = 0) const;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef MODEL_RENDER_DATA_H
+#define MODEL_RENDER_DATA_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mmd/buffer.hpp>
+#include <mmd/mesh_optimizer.hpp>
+#include <mmd/parser.hpp>
+
+struct PMXRendererVertex {
+    PMXFloat3XYZ pos;
+    PMXFloat3XYZ norm;
+    PMXFloat2UV UV;
+};
+
+/*
+ * PMXRendererVertex in half the bytes: positions and UVs as 16-bit
+ * fractions of the model's bounds, normals octahedral-encoded in two 16-bit
+ * signed fractions. Uploaded with normalized attributes and expanded by
+ * vs_packed.glsl. All 16 bytes are taken, skinning goes in PMXPackedSkin.
+ */
+struct PMXPackedVertex {
+    uint16_t pos[3];
+    uint16_t padding;
+    int16_t norm[2];
+    uint16_t UV[2];
+};
+
+struct PMXPackedVertices {
+    std::vector<PMXPackedVertex> vertices;
+    // value = offset + fraction * scale
+    PMXFloat3XYZ posOffset, posScale;
+    PMXFloat2UV UVOffset, UVScale;
+};
+
+// largest differences between packed vertices, decoded as the shader does, and the originals
+struct PMXPackingError {
+    float pos;         // model units
+    float normDegrees;
+    float UV;
+};
+
+/*
+ * Optional second vertex stream for GPU skinning, in the same vertex order
+ * as PMXPackedVertices: four bone indices, 8-bit when every bone fits and
+ * 16-bit otherwise, then four 8-bit weights that sum to 255. SDEF vertices
+ * keep their linear blend weights, unused slots are bone 0 with weight 0.
+ */
+struct PMXPackedSkin {
+    static const int WEIGHT_NUM = 4;
+
+    int boneIdxSize; // 1 or 2
+    std::vector<unsigned char> data;
+
+    size_t getStride() const { return WEIGHT_NUM * (boneIdxSize + 1); }
+};
+
+// one material of one level of detail, split into meshlets
+struct PMXDrawRange {
+    uint32_t indexOffset;
+    uint32_t indexNum;
+    int32_t textureIdx; // -1 if untextured
+    uint32_t meshletOffset, meshletNum;
+};
+
+/*
+ * One level of detail: the drawRanges from drawRangeOffset on, one per
+ * material. Level 0 is the full mesh, each further level about halves the
+ * triangles of the one before.
+ */
+struct PMXLODLevel {
+    uint32_t drawRangeOffset;
+    // farthest a simplified surface strays from the full mesh, in model units
+    float error;
+};
+
+struct PMXRenderTexture {
+    int width, height; // 0 if the image failed to load
+    PMXBuffer<PMXTextureLevel> levels;
+    PMXBuffer<unsigned char> pixels;
+};
+
+/*
+ * Everything PMXRenderer uploads, in GL-ready layout: an indexed vertex
+ * buffer, its element buffer, per material draw ranges and RGBA8 mip chains.
+ * The element buffer holds every level of detail, all of them indexing the
+ * same vertices, and every draw range is covered by meshlets for culling.
+ * Built from a PMXModel or mapped from a PMXRenderCache file.
+ */
+struct PMXRenderData {
+    static const int LOD_LEVEL_NUM = 4;
+    // largest error of level 1 relative to boundsRadius, each further level allows 4 times more
+    static constexpr float LOD_ERROR_FRACTION = 1.0f / 512;
+
+    PMXBuffer<PMXRendererVertex> vertices;
+    PMXBuffer<PMXSurface> surfaces;
+    PMXBuffer<PMXDrawRange> drawRanges;
+    PMXBuffer<PMXLODLevel> lodLevels;
+    PMXBuffer<PMXMeshlet> meshlets;
+    // sphere around all vertices, for the projected size of the model
+    PMXFloat3XYZ boundsCenter;
+    float boundsRadius;
+    std::vector<PMXRenderTexture> textures;
+    // texture file names relative to the model, in texture order
+    std::vector<std::string> texturePaths;
+
+    size_t getMaterialNum() const { return lodLevels.empty() ? 0 : drawRanges.size() / lodLevels.size(); }
+
+    PMXPackedVertices packVertices() const;
+    PMXPackingError packingError(const PMXPackedVertices &packed) const;
+
+    static std::shared_ptr<PMXRenderData> fromModel(PMXModel &model);
+
+    // the vertices of fromModel(model) are the model's, in the same order
+    static PMXPackedSkin packSkin(PMXModel &model);
+    // largest difference between a packed weight and the model's, normalized to sum to 1
+    static float skinningError(PMXModel &model, const PMXPackedSkin &packed);
+};
+
+#endif
@@ -6,35 +6,40 @@
 #include <linmath.h>
 
 #include <mmd/parser.hpp>
-
-struct PMXRendererVertex {
-    PMXFloat3XYZ pos;
-    PMXFloat3XYZ norm;
-    PMXFloat2UV UV;
-};
+#include <mmd/render_data.hpp>
 
 class PMXRenderer {
     char *progPath;
 
     // model data
-    PMXModel &model;
-    size_t renderVertexNum;
-    std::unique_ptr<PMXRendererVertex> renderVertices;
+    std::shared_ptr<PMXRenderData> data;
 
     // OpenGL data
-    const char *vsName = "vs.glsl", *fsName = "fs.glsl";
+    const char *vsName = "vs.glsl", *fsName = "fs.glsl", *packedVSName = "vs_packed.glsl";
     std::string vsPath, fsPath;
-    GLuint vao, vertexBuffer, vs, fs, program;
+    GLuint vao, vertexBuffer, elementBuffer, vs, fs, program;
     std::unique_ptr<GLuint> textures;
+    // runs of visible meshlets of the material being drawn
+    std::vector<GLsizei> drawCounts;
+    std::vector<const void *> drawOffsets;
 
     // variables in shaders
     mat4x4 transMatrix, mvMatrix, projMatrix;
     GLint transLocation, mvLocation, projLocation;
     GLint posLocation, normLocation, UVLocation;
 
+    void uploadVertices();
+    void uploadPackedVertices();
+
     void loadShaders();
+    // coarsest level whose error projects to at most LOD_PIXEL_ERROR pixels
+    int selectLOD(int height) const;
 public:
-    PMXRenderer(PMXModel &model_, char *progPath_);
+    static constexpr float LOD_PIXEL_ERROR = 1.0f;
+
+    // packedVertices uploads PMXPackedVertex instead of PMXRendererVertex
+    PMXRenderer(std::shared_ptr<PMXRenderData> data_, char *progPath_, bool packedVertices = false);
+    PMXRenderer(PMXModel &model, char *progPath_, bool packedVertices = false);
     void render(GLFWwindow *window);
     void setTrans(mat4x4 newTrans);
     void setMV(mat4x4 newMV);
@@ -0,0 +1,29 @@
+#ifndef MODEL_SIMD_H
+#define MODEL_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Widen count little-endian unsigned indices of idxSize (1, 2 or 4) bytes
+ * from src into dst. src needs no particular alignment. Uses AVX2 when the
+ * CPU has it and SSE2 otherwise on x86, plain loops elsewhere.
+ */
+void widenIndices(const void *src, size_t idxSize, size_t count, uint32_t *dst);
+
+/*
+ * 2x2 box filter of a tightly packed RGBA8 image into one of
+ * max(width / 2, 1) x max(height / 2, 1) pixels. An odd last row or column
+ * is averaged with itself.
+ */
+void downsampleRGBA8(const uint8_t *src, int width, int height, uint8_t *dst);
+
+/*
+ * Split count fixed-size records of stride bytes (at least 32), each
+ * starting with a float3 position, a float3 normal and a float2 UV, into
+ * three tightly packed float streams.
+ */
+void splitVertexAttributes(const void *src, size_t stride, size_t count,
+                           float *positions, float *normals, float *UVs);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MODEL_TEXT_H
+#define MODEL_TEXT_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/*
+ * Transcode len UTF-16LE code units to UTF-8. dst must have room for
+ * 3 * len bytes. Runs of ASCII are converted 8 code units at a time and
+ * unpaired surrogates become U+FFFD. Returns the number of bytes written.
+ */
+size_t utf16ToUtf8(const char16_t *src, size_t len, char *dst);
+
+/*
+ * Transcode len bytes of Shift_JIS (code page 932, as written by PMD/VMD
+ * tools) to UTF-8. dst must have room for 3 * len bytes. Invalid sequences
+ * become U+FFFD. Returns the number of bytes written.
+ */
+size_t shiftJISToUtf8(const char *src, size_t len, char *dst);
+
+/*
+ * Transcode len bytes of UTF-8 to Shift_JIS (code page 932), e.g. to match
+ * names against the fixed-width Shift_JIS fields of VMD/VPD files. dst must
+ * have room for len bytes. Characters without a Shift_JIS encoding become
+ * '?'. Returns the number of bytes written.
+ */
+size_t utf8ToShiftJIS(const char *src, size_t len, char *dst);
+
+/*
+ * Append-only storage for the strings of one model, carved out of blocks
+ * taken from resource. Stored strings never move, so the returned views stay
+ * valid for the arena's lifetime.
+ * Safe to use from several threads.
+ */
+class PMXStringArena {
+    static const size_t BLOCK_SIZE = 16384;
+
+    std::pmr::memory_resource *resource;
+    std::vector<std::pair<char *, size_t>> blocks;
+    size_t blockUsed, blockSize;
+    std::mutex arenaMutex;
+
+public:
+    explicit PMXStringArena(std::pmr::memory_resource *resource_ = std::pmr::get_default_resource());
+    ~PMXStringArena();
+    PMXStringArena(const PMXStringArena&) = delete;
+    PMXStringArena& operator=(const PMXStringArena&) = delete;
+
+    std::string_view store(const char *text, size_t len);
+    // transcode UTF-16LE text into the arena
+    std::string_view storeUtf16(const char16_t *text, size_t len);
+    // transcode Shift_JIS text into the arena
+    std::string_view storeShiftJIS(const char *text, size_t len);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef MODEL_THREAD_POOL_H
+#define MODEL_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads fed from one FIFO queue.
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksCond;
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    // 0 means one worker per hardware thread
+    explicit ThreadPool(size_t threadNum = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const;
+
+    template <typename F>
+    auto submit(F func) -> std::future<decltype(func())> {
+        using R = decltype(func());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(func));
+        std::future<R> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.emplace_back([task]() { (*task)(); });
+        }
+        tasksCond.notify_one();
+        return result;
+    }
+
+    /*
+     * Run func(0) ... func(taskNum - 1) on the pool and wait for all of them.
+     * The calling thread takes tasks as well, so this may be called from a
+     * worker without deadlocking. The first exception thrown is rethrown.
+     */
+    void parallelFor(size_t taskNum, const std::function<void(size_t)> &func);
+
+    // process wide pool used by the parsers
+    static ThreadPool& shared();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+#include <mmd/arena.hpp>
+
+PMXArena::PMXArena(): current(nullptr), remaining(0), nextBlockSize(MIN_BLOCK_SIZE), capacity(0), used(0) {}
+
+PMXArena::~PMXArena() {
+    for (auto block: blocks) {
+        ::operator delete(block);
+    }
+}
+
+void PMXArena::addBlock(size_t size) {
+    void *block = ::operator new(size);
+    blocks.push_back(block);
+    current = (char *)block;
+    remaining = size;
+    capacity += size;
+    // grow geometrically so unplanned allocations need few blocks
+    nextBlockSize = std::max(nextBlockSize, size) * 2;
+}
+
+void *PMXArena::do_allocate(size_t bytes, size_t alignment) {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    size_t padding = (alignment - (uintptr_t)current % alignment) % alignment;
+    if (current == nullptr || padding + bytes > remaining) {
+        addBlock(std::max(nextBlockSize, bytes + alignment));
+        padding = (alignment - (uintptr_t)current % alignment) % alignment;
+    }
+    char *result = current + padding;
+    current += padding + bytes;
+    remaining -= padding + bytes;
+    used += bytes;
+    return result;
+}
+
+void PMXArena::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    // memory is returned when the arena goes away
+}
+
+bool PMXArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+void PMXArena::reserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    if (bytes > remaining) {
+        addBlock(std::max(bytes, (size_t)MIN_BLOCK_SIZE));
+    }
+}
+
+size_t PMXArena::getBlockNum() {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    return blocks.size();
+}
+
+size_t PMXArena::getCapacity() {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    return capacity;
+}
+
+size_t PMXArena::getUsed() {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    return used;
+}
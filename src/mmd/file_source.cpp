@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+#include <mmd/file_source.hpp>
+#include <mmd/text.hpp>
+
+static const uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t ZIP_END_SIGNATURE = 0x06054b50;
+static const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+static const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+static const size_t ZIP_END_SIZE = 22;
+static const size_t ZIP_MAX_COMMENT_LEN = 0xffff;
+
+static const uint16_t ZIP_FLAG_ENCRYPTED = 1 << 0;
+static const uint16_t ZIP_FLAG_UTF8 = 1 << 11;
+static const uint16_t ZIP_METHOD_STORED = 0;
+static const uint16_t ZIP_METHOD_DEFLATED = 8;
+
+std::string FileSource::normalizePath(std::string_view path) {
+    std::vector<std::string_view> parts;
+    while (!path.empty()) {
+        size_t separator = path.find_first_of("/\\");
+        std::string_view part = path.substr(0, separator);
+        path = separator == std::string_view::npos ? std::string_view() : path.substr(separator + 1);
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == "..") {
+            if (!parts.empty()) {
+                parts.pop_back();
+            }
+            continue;
+        }
+        parts.push_back(part);
+    }
+    std::string normalized;
+    for (auto &part: parts) {
+        if (!normalized.empty()) {
+            normalized += '/';
+        }
+        normalized += part;
+    }
+    // only ASCII folds, bytes of multibyte UTF-8 sequences are all >= 0x80
+    for (auto &c: normalized) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+    }
+    return normalized;
+}
+
+void MemoryFileSource::add(const std::string &path, std::unique_ptr<char[]> data, size_t size) {
+    auto file = std::make_shared<MappedFile>(path, std::move(data), size);
+    std::lock_guard<std::mutex> lock(filesMutex);
+    files[normalizePath(path)] = file;
+}
+
+void MemoryFileSource::add(const std::string &path, const char *data, size_t size) {
+    std::unique_ptr<char[]> copy(new char[size]);
+    memcpy(copy.get(), data, size);
+    add(path, std::move(copy), size);
+}
+
+std::shared_ptr<MappedFile> MemoryFileSource::open(const std::string &path) {
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto found = files.find(normalizePath(path));
+    if (found == files.end()) {
+        throw std::runtime_error("No such file " + path);
+    }
+    return found->second;
+}
+
+ZipFileSource::ZipFileSource(const std::string &zipPath) {
+    try {
+        archive = std::make_shared<MappedFile>(zipPath);
+    } catch (std::runtime_error &e) {
+        throw std::runtime_error("Unable to open zip archive");
+    }
+    readCentralDirectory();
+}
+
+ZipFileSource::ZipFileSource(std::shared_ptr<MappedFile> archive_): archive(archive_) {
+    readCentralDirectory();
+}
+
+void ZipFileSource::readCentralDirectory() {
+    const char *data = archive->data();
+    size_t size = archive->size();
+
+    // the end record is last, followed only by the archive comment
+    if (size < ZIP_END_SIZE) {
+        throw std::runtime_error("Invalid zip archive");
+    }
+    size_t endOffset = size - ZIP_END_SIZE;
+    size_t searchEnd = size > ZIP_END_SIZE + ZIP_MAX_COMMENT_LEN ? size - ZIP_END_SIZE - ZIP_MAX_COMMENT_LEN : 0;
+    while (*(uint32_t *)(data + endOffset) != ZIP_END_SIGNATURE) {
+        if (endOffset == searchEnd) {
+            throw std::runtime_error("Invalid zip archive");
+        }
+        endOffset--;
+    }
+    const char *end = data + endOffset;
+    uint16_t entryNum = *(uint16_t *)(end + 10);
+    uint32_t directorySize = *(uint32_t *)(end + 12);
+    uint32_t directoryOffset = *(uint32_t *)(end + 16);
+    if (entryNum == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+        throw std::runtime_error("ZIP64 archives are not supported");
+    }
+    if ((uint64_t)directoryOffset + directorySize > endOffset) {
+        throw std::runtime_error("Invalid zip central directory");
+    }
+
+    size_t bufIdx = directoryOffset;
+    size_t directoryEnd = (size_t)directoryOffset + directorySize;
+    paths.reserve(entryNum);
+    for (auto i = 0; i < entryNum; i++) {
+        if (directoryEnd - bufIdx < ZIP_CENTRAL_HEADER_SIZE
+            || *(uint32_t *)(data + bufIdx) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+            throw std::runtime_error("Invalid zip central directory");
+        }
+        const char *header = data + bufIdx;
+        ZipEntry entry;
+        entry.flags = *(uint16_t *)(header + 8);
+        entry.method = *(uint16_t *)(header + 10);
+        entry.crc = *(uint32_t *)(header + 16);
+        entry.compressedSize = *(uint32_t *)(header + 20);
+        entry.size = *(uint32_t *)(header + 24);
+        uint16_t nameLen = *(uint16_t *)(header + 28);
+        uint16_t extraLen = *(uint16_t *)(header + 30);
+        uint16_t commentLen = *(uint16_t *)(header + 32);
+        entry.localHeaderOffset = *(uint32_t *)(header + 42);
+        size_t recordSize = ZIP_CENTRAL_HEADER_SIZE + nameLen + extraLen + commentLen;
+        if (directoryEnd - bufIdx < recordSize) {
+            throw std::runtime_error("Invalid zip central directory");
+        }
+
+        std::string path;
+        if (entry.flags & ZIP_FLAG_UTF8) {
+            path.assign(header + ZIP_CENTRAL_HEADER_SIZE, nameLen);
+        } else {
+            path.resize(3 * (size_t)nameLen);
+            path.resize(shiftJISToUtf8(header + ZIP_CENTRAL_HEADER_SIZE, nameLen, &path[0]));
+        }
+        bufIdx += recordSize;
+
+        // directories have no content of their own
+        if (path.empty() || path.back() == '/' || path.back() == '\\') {
+            continue;
+        }
+        // like the file system, the first of equal names wins
+        entries.emplace(normalizePath(path), entry);
+        paths.push_back(std::move(path));
+    }
+}
+
+std::shared_ptr<MappedFile> ZipFileSource::open(const std::string &path) {
+    auto found = entries.find(normalizePath(path));
+    if (found == entries.end()) {
+        throw std::runtime_error("No such archive member " + path);
+    }
+    const ZipEntry &entry = found->second;
+    if (entry.flags & ZIP_FLAG_ENCRYPTED) {
+        throw std::runtime_error("Encrypted archive member " + path);
+    }
+
+    // the local header repeats the name, its extra field may differ from the central one
+    const char *data = archive->data();
+    size_t archiveSize = archive->size();
+    if (entry.localHeaderOffset > archiveSize || archiveSize - entry.localHeaderOffset < ZIP_LOCAL_HEADER_SIZE
+        || *(uint32_t *)(data + entry.localHeaderOffset) != ZIP_LOCAL_HEADER_SIGNATURE) {
+        throw std::runtime_error("Invalid zip local header of " + path);
+    }
+    const char *header = data + entry.localHeaderOffset;
+    size_t contentOffset = entry.localHeaderOffset + ZIP_LOCAL_HEADER_SIZE
+                         + *(uint16_t *)(header + 26) + *(uint16_t *)(header + 28);
+    if (contentOffset > archiveSize || archiveSize - contentOffset < entry.compressedSize) {
+        throw std::runtime_error("Truncated archive member " + path);
+    }
+    const char *content = data + contentOffset;
+
+    std::unique_ptr<char[]> buffer(new char[entry.size]);
+    if (entry.method == ZIP_METHOD_STORED) {
+        if (entry.compressedSize != entry.size) {
+            throw std::runtime_error("Invalid archive member " + path);
+        }
+        memcpy(buffer.get(), content, entry.size);
+    } else if (entry.method == ZIP_METHOD_DEFLATED) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        // raw deflate data, zip keeps its own headers
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("Unable to inflate " + path);
+        }
+        stream.next_in = (Bytef *)content;
+        stream.avail_in = entry.compressedSize;
+        stream.next_out = (Bytef *)buffer.get();
+        stream.avail_out = entry.size;
+        int result = inflate(&stream, Z_FINISH);
+        size_t inflatedSize = stream.total_out;
+        inflateEnd(&stream);
+        if (result != Z_STREAM_END || inflatedSize != entry.size) {
+            throw std::runtime_error("Corrupt archive member " + path);
+        }
+    } else {
+        throw std::runtime_error("Unsupported compression method of " + path);
+    }
+    if (crc32(0, (const Bytef *)buffer.get(), entry.size) != entry.crc) {
+        throw std::runtime_error("Checksum mismatch in archive member " + path);
+    }
+    return std::make_shared<MappedFile>(path, std::move(buffer), entry.size);
+}
@@ -0,0 +1,122 @@
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <mmd/mapped_file.hpp>
+
+bool MappedFile::mapFile() {
+#ifdef MAPPED_FILE_HAS_MMAP
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    fileSize = fileStat.st_size;
+    void *addr = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping holds its own reference to the file
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    fileData = (const char *)addr;
+    mapped = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MappedFile::readFile() {
+    std::fstream file(filePath, std::ios::in | std::ios::binary | std::ios::ate);
+    if (file.is_open()) {
+        fileSize = file.tellg();
+        buffer = std::unique_ptr<char[]>(new char[fileSize]);
+        file.seekg(0, std::ios::beg);
+        file.read(buffer.get(), fileSize);
+        file.close();
+        fileData = buffer.get();
+        mapped = false;
+    } else {
+        throw std::runtime_error("Unable to open file");
+    }
+}
+
+MappedFile::MappedFile(std::string filePath_, bool allowMmap):
+    filePath(filePath_), fileData(nullptr), fileSize(0), mapped(false) {
+    if (!allowMmap || !mapFile()) {
+        readFile();
+    }
+}
+
+MappedFile::MappedFile(std::string filePath_, std::unique_ptr<char[]> buffer_, size_t size):
+    filePath(filePath_), fileData(buffer_.get()), fileSize(size), mapped(false), buffer(std::move(buffer_)) {}
+
+MappedFile::~MappedFile() {
+#ifdef MAPPED_FILE_HAS_MMAP
+    if (mapped) {
+        munmap((void *)fileData, fileSize);
+    }
+#endif
+}
+
+const char *MappedFile::data() const {
+    return fileData;
+}
+
+size_t MappedFile::size() const {
+    return fileSize;
+}
+
+bool MappedFile::isMapped() const {
+    return mapped;
+}
+
+#ifdef MAPPED_FILE_HAS_MMAP
+// madvise wants a page aligned start address
+static void adviseRange(const char *base, size_t size, size_t offset, size_t length, int advice) {
+    if (offset >= size) {
+        return;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t alignedOffset = offset / pageSize * pageSize;
+    madvise((void *)(base + alignedOffset), length + (offset - alignedOffset), advice);
+}
+#endif
+
+void MappedFile::adviseSequential(size_t offset, size_t length) {
+#ifdef MAPPED_FILE_HAS_MMAP
+    if (mapped) {
+        adviseRange(fileData, fileSize, offset, length, MADV_SEQUENTIAL);
+    }
+#endif
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t length) {
+#ifdef MAPPED_FILE_HAS_MMAP
+    if (mapped) {
+        adviseRange(fileData, fileSize, offset, length, MADV_WILLNEED);
+    }
+#endif
+}
+
+void MappedFile::adviseDontNeed(size_t offset, size_t length) {
+#ifdef MAPPED_FILE_HAS_MMAP
+    if (mapped) {
+        adviseRange(fileData, fileSize, offset, length, MADV_DONTNEED);
+    }
+#endif
+}
@@ -0,0 +1,830 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+#include <mmd/mesh_optimizer.hpp>
+#include <mmd/parser.hpp>
+
+void optimizeVertexCache(uint32_t *indices, size_t indexNum, size_t vertexNum, int cacheSize) {
+    const size_t triangleNum = indexNum / 3;
+    const int64_t NO_VERTEX = -1;
+    if (triangleNum < 2) {
+        return;
+    }
+
+    // triangles around each vertex, and how many of them are not drawn yet
+    std::vector<uint32_t> adjacencyOffsets(vertexNum + 1, 0);
+    for (size_t i = 0; i < indexNum; i++) {
+        adjacencyOffsets[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < vertexNum; v++) {
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<uint32_t> adjacency(indexNum);
+    std::vector<uint32_t> liveNums(vertexNum, 0);
+    for (size_t i = 0; i < indexNum; i++) {
+        uint32_t v = indices[i];
+        adjacency[adjacencyOffsets[v] + liveNums[v]++] = i / 3;
+    }
+
+    // same FIFO model as computeACMR: cached while fewer than cacheSize misses happened since
+    std::vector<uint32_t> cacheTimes(vertexNum, 0);
+    uint32_t time = cacheSize + 1;
+    std::vector<char> emitted(triangleNum, 0);
+    std::vector<uint32_t> output, deadEnds, candidates;
+    output.reserve(indexNum);
+    size_t cursor = 0;
+
+    // draw every remaining triangle around the fanning vertex, then pick the next one
+    int64_t fan = indices[0];
+    while (fan != NO_VERTEX) {
+        candidates.clear();
+        for (uint32_t j = adjacencyOffsets[fan]; j < adjacencyOffsets[fan + 1]; j++) {
+            uint32_t t = adjacency[j];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = 1;
+            for (auto k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * t + k];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveNums[v]--;
+                if (time - cacheTimes[v] > (uint32_t)cacheSize) {
+                    cacheTimes[v] = time++;
+                }
+            }
+        }
+
+        // the oldest candidate that stays cached through its own fan, any live one otherwise
+        fan = NO_VERTEX;
+        int64_t bestPriority = -1;
+        for (auto v: candidates) {
+            if (liveNums[v] == 0) {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTimes[v] + 2 * liveNums[v] <= (uint32_t)cacheSize) {
+                priority = time - cacheTimes[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fan = v;
+            }
+        }
+        if (fan == NO_VERTEX) {
+            // dead end: the most recently drawn vertex with triangles left, or the next in index order
+            while (!deadEnds.empty() && fan == NO_VERTEX) {
+                if (liveNums[deadEnds.back()] > 0) {
+                    fan = deadEnds.back();
+                }
+                deadEnds.pop_back();
+            }
+            while (fan == NO_VERTEX && cursor < vertexNum) {
+                if (liveNums[cursor] > 0) {
+                    fan = cursor;
+                } else {
+                    cursor++;
+                }
+            }
+        }
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t indexNum, size_t vertexNum) {
+    const uint32_t UNUSED = UINT32_MAX;
+    std::vector<uint32_t> newIndices(vertexNum, UNUSED);
+    std::vector<uint32_t> oldIndices;
+    oldIndices.reserve(vertexNum);
+    for (size_t i = 0; i < indexNum; i++) {
+        uint32_t &v = newIndices[indices[i]];
+        if (v == UNUSED) {
+            v = oldIndices.size();
+            oldIndices.push_back(indices[i]);
+        }
+        indices[i] = v;
+    }
+    for (size_t v = 0; v < vertexNum; v++) {
+        if (newIndices[v] == UNUSED) {
+            oldIndices.push_back(v);
+        }
+    }
+    return oldIndices;
+}
+
+namespace {
+
+// sum of squared distances to planes, weighted by triangle area, as the 10
+// coefficients of a symmetric 4x4 matrix
+struct Quadric {
+    double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2, weight;
+
+    void addPlane(double a, double b, double c, double d, double w) {
+        a2 += w * a * a; b2 += w * b * b; c2 += w * c * c;
+        ab += w * a * b; ac += w * a * c; bc += w * b * c;
+        ad += w * a * d; bd += w * b * d; cd += w * c * d;
+        d2 += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric &q) {
+        a2 += q.a2; b2 += q.b2; c2 += q.c2;
+        ab += q.ab; ac += q.ac; bc += q.bc;
+        ad += q.ad; bd += q.bd; cd += q.cd;
+        d2 += q.d2;
+        weight += q.weight;
+    }
+
+    // mean squared distance of p to the planes
+    double error(const float *p) const {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a2 * x * x + b2 * y * y + c2 * z * z
+                 + 2 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z) + d2;
+        return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+struct Collapse {
+    double error;
+    uint32_t from, to;
+};
+
+struct PositionKey {
+    float x, y, z;
+    bool operator==(const PositionKey &other) const {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey &key) const {
+        uint32_t bits[3];
+        memcpy(bits, &key, sizeof(bits));
+        return ((size_t)bits[0] * 73856093) ^ ((size_t)bits[1] * 19349663) ^ ((size_t)bits[2] * 83492791);
+    }
+};
+
+void cross(const float *a, const float *b, const float *c, float *n) {
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+}
+
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t indexNum, const float *positions,
+                                   const uint32_t *skinGroups, size_t vertexNum, size_t targetIndexNum,
+                                   float targetError, float &error) {
+    const uint32_t UNUSED = UINT32_MAX;
+    error = 0.0f;
+
+    // number the referenced vertices locally, so scratch data scales with this mesh
+    std::vector<uint32_t> localIndices(vertexNum, UNUSED);
+    std::vector<uint32_t> globalIndices;
+    std::vector<uint32_t> triangles(indexNum);
+    for (size_t i = 0; i < indexNum; i++) {
+        uint32_t &v = localIndices[indices[i]];
+        if (v == UNUSED) {
+            v = globalIndices.size();
+            globalIndices.push_back(indices[i]);
+        }
+        triangles[i] = v;
+    }
+    const size_t localNum = globalIndices.size();
+    auto position = [&](uint32_t v) { return positions + 3 * (size_t)globalIndices[v]; };
+
+    // vertices sharing a position are split at a seam, moving one would tear it open
+    std::vector<char> locked(localNum, 0);
+    std::unordered_map<PositionKey, uint32_t, PositionKeyHash> firstAtPosition;
+    for (uint32_t v = 0; v < localNum; v++) {
+        const float *p = position(v);
+        auto found = firstAtPosition.emplace(PositionKey{p[0], p[1], p[2]}, v);
+        if (!found.second) {
+            locked[v] = 1;
+            locked[found.first->second] = 1;
+        }
+    }
+    // edges of a single triangle are on the border, here also the border to other materials
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    edgeUses.reserve(indexNum);
+    for (size_t i = 0; i < indexNum; i++) {
+        uint32_t a = triangles[i], b = triangles[i % 3 == 2 ? i - 2 : i + 1];
+        edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+    }
+    for (auto &edge: edgeUses) {
+        if (edge.second == 1) {
+            locked[edge.first >> 32] = 1;
+            locked[edge.first & 0xffffffff] = 1;
+        }
+    }
+
+    std::vector<Quadric> quadrics(localNum, Quadric{});
+    for (size_t i = 0; i < indexNum; i += 3) {
+        const float *p0 = position(triangles[i]);
+        float n[3];
+        cross(p0, position(triangles[i + 1]), position(triangles[i + 2]), n);
+        double length = std::sqrt((double)n[0] * n[0] + (double)n[1] * n[1] + (double)n[2] * n[2]);
+        if (length == 0.0) {
+            continue;
+        }
+        double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+        double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+        for (auto k = 0; k < 3; k++) {
+            quadrics[triangles[i + k]].addPlane(a, b, c, d, length * 0.5);
+        }
+    }
+
+    std::vector<uint32_t> adjacencyOffsets, adjacency, remap(localNum);
+    std::vector<char> touched(localNum);
+    std::vector<Collapse> collapses;
+    double maxError = 0.0;
+    while (triangles.size() > targetIndexNum) {
+        // triangles around each vertex
+        adjacencyOffsets.assign(localNum + 1, 0);
+        for (auto v: triangles) {
+            adjacencyOffsets[v + 1]++;
+        }
+        for (size_t v = 0; v < localNum; v++) {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        adjacency.resize(triangles.size());
+        std::vector<uint32_t> filled(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < triangles.size(); i++) {
+            adjacency[filled[triangles[i]]++] = i / 3;
+        }
+
+        // cheapest collapse of every free vertex onto a neighbor
+        collapses.clear();
+        for (uint32_t v = 0; v < localNum; v++) {
+            if (locked[v]) {
+                continue;
+            }
+            Collapse best{std::numeric_limits<double>::max(), v, v};
+            for (uint32_t j = adjacencyOffsets[v]; j < adjacencyOffsets[v + 1]; j++) {
+                const uint32_t *triangle = &triangles[3 * adjacency[j]];
+                for (auto k = 0; k < 3; k++) {
+                    uint32_t to = triangle[k];
+                    if (to == v || skinGroups[globalIndices[to]] != skinGroups[globalIndices[v]]) {
+                        continue;
+                    }
+                    double e = quadrics[v].error(position(to));
+                    if (e < best.error) {
+                        best = {e, v, to};
+                    }
+                }
+            }
+            if (best.to != v) {
+                collapses.push_back(best);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](auto &a, auto &b) { return a.error < b.error; });
+        if (collapses.empty() || collapses[0].error > (double)targetError * targetError) {
+            break;
+        }
+        // a collapse mostly removes two triangles; collapses far costlier than the
+        // ones that would reach the target wait for a later pass to be re-rated
+        size_t goal = std::min((triangles.size() - targetIndexNum) / 6, collapses.size() - 1);
+        double errorLimit = std::min(collapses[goal].error * 1.5, (double)targetError * targetError);
+
+        // collapses of one pass touch disjoint neighborhoods, so the adjacency stays valid
+        for (uint32_t v = 0; v < localNum; v++) {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t indexNumLeft = triangles.size();
+        size_t collapseNum = 0;
+        for (auto &collapse: collapses) {
+            if (indexNumLeft <= targetIndexNum || collapse.error > errorLimit) {
+                break;
+            }
+            uint32_t from = collapse.from, to = collapse.to;
+            if (touched[from] || touched[to]) {
+                continue;
+            }
+            // moving from onto to must not flip a triangle that stays
+            bool flips = false;
+            size_t removedNum = 0;
+            for (uint32_t j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1] && !flips; j++) {
+                const uint32_t *triangle = &triangles[3 * adjacency[j]];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                    removedNum++;
+                    continue;
+                }
+                const float *before[3], *after[3];
+                for (auto k = 0; k < 3; k++) {
+                    before[k] = position(triangle[k]);
+                    after[k] = triangle[k] == from ? position(to) : before[k];
+                }
+                float n0[3], n1[3];
+                cross(before[0], before[1], before[2], n0);
+                cross(after[0], after[1], after[2], n1);
+                flips = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0f;
+            }
+            if (flips) {
+                continue;
+            }
+            remap[from] = to;
+            quadrics[to].add(quadrics[from]);
+            for (uint32_t j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1]; j++) {
+                for (auto k = 0; k < 3; k++) {
+                    touched[triangles[3 * adjacency[j] + k]] = 1;
+                }
+            }
+            indexNumLeft -= 3 * removedNum;
+            maxError = std::max(maxError, collapse.error);
+            collapseNum++;
+        }
+        if (collapseNum == 0) {
+            break;
+        }
+
+        // collapsed edges leave degenerate triangles behind
+        size_t kept = 0;
+        for (size_t i = 0; i < triangles.size(); i += 3) {
+            uint32_t a = remap[triangles[i]], b = remap[triangles[i + 1]], c = remap[triangles[i + 2]];
+            if (a != b && b != c && c != a) {
+                triangles[kept++] = a;
+                triangles[kept++] = b;
+                triangles[kept++] = c;
+            }
+        }
+        triangles.resize(kept);
+    }
+
+    for (auto &v: triangles) {
+        v = globalIndices[v];
+    }
+    error = std::sqrt(maxError);
+    return triangles;
+}
+
+static void finishMeshlet(PMXMeshlet &meshlet, const uint32_t *indices, const float *positions,
+                          const float *normals, bool backFaceCulling) {
+    const uint32_t *begin = indices + meshlet.indexOffset, *end = begin + meshlet.indexNum;
+    float lower[3], upper[3];
+    for (auto k = 0; k < 3; k++) {
+        lower[k] = upper[k] = positions[3 * (size_t)begin[0] + k];
+    }
+    for (const uint32_t *v = begin; v != end; v++) {
+        for (auto k = 0; k < 3; k++) {
+            lower[k] = std::min(lower[k], positions[3 * (size_t)*v + k]);
+            upper[k] = std::max(upper[k], positions[3 * (size_t)*v + k]);
+        }
+    }
+    float radius2 = 0.0f;
+    for (auto k = 0; k < 3; k++) {
+        meshlet.center[k] = (lower[k] + upper[k]) / 2;
+    }
+    for (const uint32_t *v = begin; v != end; v++) {
+        const float *p = positions + 3 * (size_t)*v;
+        float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1], dz = p[2] - meshlet.center[2];
+        radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+    }
+    meshlet.radius = std::sqrt(radius2);
+
+    // unit triangle normals, turned to the side the vertex normals face
+    std::vector<float> faceNormals;
+    float axis[3] = {0.0f, 0.0f, 0.0f};
+    for (const uint32_t *t = begin; t != end; t += 3) {
+        float n[3];
+        cross(positions + 3 * (size_t)t[0], positions + 3 * (size_t)t[1], positions + 3 * (size_t)t[2], n);
+        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0f) {
+            continue;
+        }
+        float side = 0.0f;
+        for (auto j = 0; j < 3; j++) {
+            const float *vn = normals + 3 * (size_t)t[j];
+            side += vn[0] * n[0] + vn[1] * n[1] + vn[2] * n[2];
+        }
+        float scale = (side < 0.0f ? -1.0f : 1.0f) / length;
+        for (auto k = 0; k < 3; k++) {
+            faceNormals.push_back(n[k] * scale);
+            axis[k] += n[k] * scale;
+        }
+    }
+    float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    meshlet.coneCutoff = 1.0f;
+    meshlet.coneAxis[0] = meshlet.coneAxis[1] = meshlet.coneAxis[2] = 0.0f;
+    if (!backFaceCulling || axisLength == 0.0f) {
+        return;
+    }
+    float minDot = 1.0f;
+    for (auto k = 0; k < 3; k++) {
+        meshlet.coneAxis[k] = axis[k] / axisLength;
+    }
+    for (size_t i = 0; i < faceNormals.size(); i += 3) {
+        minDot = std::min(minDot, faceNormals[i] * meshlet.coneAxis[0] + faceNormals[i + 1] * meshlet.coneAxis[1]
+                                  + faceNormals[i + 2] * meshlet.coneAxis[2]);
+    }
+    // a cone of 90 degrees or more has some triangle facing every camera
+    if (minDot > 0.0f) {
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+std::vector<PMXMeshlet> buildMeshlets(const uint32_t *indices, size_t indexNum, const float *positions,
+                                      const float *normals, size_t vertexNum, bool backFaceCulling,
+                                      int maxVertices, int maxTriangles) {
+    std::vector<PMXMeshlet> meshlets;
+    // meshlet each vertex was last counted for
+    std::vector<uint32_t> counted(vertexNum, UINT32_MAX);
+    PMXMeshlet current{};
+    int vertexNumInMeshlet = 0;
+    for (size_t i = 0; i + 2 < indexNum; i += 3) {
+        int newVertexNum = 0;
+        for (auto k = 0; k < 3; k++) {
+            uint32_t v = indices[i + k];
+            // a vertex repeated within the triangle counts once
+            newVertexNum += counted[v] != meshlets.size() && (k == 0 || v != indices[i])
+                         && (k < 2 || v != indices[i + 1]);
+        }
+        if (current.indexNum > 0 && (vertexNumInMeshlet + newVertexNum > maxVertices
+                                     || (int)current.indexNum / 3 >= maxTriangles)) {
+            finishMeshlet(current, indices, positions, normals, backFaceCulling);
+            meshlets.push_back(current);
+            current = PMXMeshlet{};
+            current.indexOffset = i;
+            vertexNumInMeshlet = 0;
+        }
+        for (auto k = 0; k < 3; k++) {
+            uint32_t &mark = counted[indices[i + k]];
+            if (mark != meshlets.size()) {
+                mark = meshlets.size();
+                vertexNumInMeshlet++;
+            }
+        }
+        current.indexNum += 3;
+    }
+    if (current.indexNum > 0) {
+        finishMeshlet(current, indices, positions, normals, backFaceCulling);
+        meshlets.push_back(current);
+    }
+    return meshlets;
+}
+
+PMXCullView makeCullView(const float *modelViewProj, const float *eye) {
+    // Gribb and Hartmann: clip space bounds as planes on rows of the matrix
+    PMXCullView view;
+    auto row = [&](int i, int j) { return modelViewProj[4 * j + i]; };
+    for (auto p = 0; p < 6; p++) {
+        int axis = p / 2;
+        float sign = p % 2 == 0 ? 1.0f : -1.0f;
+        float *plane = view.planes[p];
+        for (auto j = 0; j < 4; j++) {
+            plane[j] = row(3, j) + sign * row(axis, j);
+        }
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f) {
+            for (auto j = 0; j < 4; j++) {
+                plane[j] /= length;
+            }
+        }
+    }
+    std::copy_n(eye, 3, view.eye);
+    return view;
+}
+
+bool isMeshletVisible(const PMXMeshlet &meshlet, const PMXCullView &view) {
+    for (auto &plane: view.planes) {
+        float distance = plane[0] * meshlet.center[0] + plane[1] * meshlet.center[1] + plane[2] * meshlet.center[2]
+                       + plane[3];
+        if (distance < -meshlet.radius) {
+            return false;
+        }
+    }
+    float toCenter[3] = {meshlet.center[0] - view.eye[0], meshlet.center[1] - view.eye[1],
+                         meshlet.center[2] - view.eye[2]};
+    float length = std::sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+    float along = toCenter[0] * meshlet.coneAxis[0] + toCenter[1] * meshlet.coneAxis[1]
+                + toCenter[2] * meshlet.coneAxis[2];
+    return along < meshlet.coneCutoff * length + meshlet.radius;
+}
+
+float computeACMR(const uint32_t *indices, size_t indexNum, size_t vertexNum, int cacheSize) {
+    if (indexNum < 3) {
+        return 0.0f;
+    }
+    // a vertex is cached while fewer than cacheSize misses happened since its own
+    std::vector<uint32_t> missTimes(vertexNum, 0);
+    uint32_t time = cacheSize + 1;
+    size_t missNum = 0;
+    for (size_t i = 0; i < indexNum; i++) {
+        uint32_t &missTime = missTimes[indices[i]];
+        if (time - missTime > (uint32_t)cacheSize) {
+            missTime = time++;
+            missNum++;
+        }
+    }
+    return (float)missNum / (indexNum / 3);
+}
+
+template <typename T>
+static void gatherStream(std::pmr::vector<T> &stream, const std::vector<uint32_t> &order, size_t stride) {
+    std::vector<T> gathered(order.size() * stride);
+    for (size_t i = 0; i < order.size(); i++) {
+        std::copy_n(stream.begin() + order[i] * stride, stride, gathered.begin() + i * stride);
+    }
+    // at most the same size, so the gathered stream stays in its arena block
+    std::copy(gathered.begin(), gathered.end(), stream.begin());
+    stream.resize(gathered.size());
+}
+
+template <typename T>
+static void gatherSlots(std::pmr::vector<T> &slots, const std::pmr::vector<uint32_t> &offsets,
+                        const std::vector<uint32_t> &order) {
+    std::vector<T> gathered;
+    gathered.reserve(slots.size());
+    for (auto v: order) {
+        gathered.insert(gathered.end(), slots.begin() + offsets[v], slots.begin() + offsets[v + 1]);
+    }
+    std::copy(gathered.begin(), gathered.end(), slots.begin());
+    slots.resize(gathered.size());
+}
+
+void PMXModel::permuteVertices(const std::vector<uint32_t> &order) {
+    std::vector<uint32_t> newIndices(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        newIndices[order[i]] = i;
+    }
+    remapVertices(order, newIndices);
+}
+
+void PMXModel::remapVertices(const std::vector<uint32_t> &order, const std::vector<uint32_t> &newIndices) {
+    gatherStream(vertices.positions, order, 1);
+    gatherStream(vertices.normals, order, 1);
+    gatherStream(vertices.UVs, order, 1);
+    if (vertices.additionalUVNum > 0) {
+        gatherStream(vertices.additionalUVs, order, vertices.additionalUVNum);
+    }
+    gatherStream(vertices.deformMethods, order, 1);
+    gatherStream(vertices.edgeScales, order, 1);
+
+    // skinning slots move with their vertex, the offsets are rebuilt last
+    if (vertices.wideBoneIdx) {
+        gatherSlots(vertices.boneIndices32, vertices.skinOffsets, order);
+    } else {
+        gatherSlots(vertices.boneIndices16, vertices.skinOffsets, order);
+    }
+    gatherSlots(vertices.boneWeights, vertices.skinOffsets, order);
+    std::vector<uint32_t> skinOffsets(order.size() + 1);
+    skinOffsets[0] = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        skinOffsets[i + 1] = skinOffsets[i] + vertices.skinOffsets[order[i] + 1] - vertices.skinOffsets[order[i]];
+    }
+    std::copy(skinOffsets.begin(), skinOffsets.end(), vertices.skinOffsets.begin());
+    vertices.skinOffsets.resize(skinOffsets.size());
+
+    // the SDEF list stays sorted by vertex and drops vertices merged into others
+    std::vector<std::pair<uint32_t, PMXSDEFParams>> SDEFs;
+    for (size_t i = 0; i < vertices.SDEFVertices.size(); i++) {
+        uint32_t v = vertices.SDEFVertices[i];
+        if (order[newIndices[v]] == v) {
+            SDEFs.push_back({newIndices[v], vertices.SDEFParams[i]});
+        }
+    }
+    std::sort(SDEFs.begin(), SDEFs.end(), [](auto &a, auto &b) { return a.first < b.first; });
+    for (size_t i = 0; i < SDEFs.size(); i++) {
+        vertices.SDEFVertices[i] = SDEFs[i].first;
+        vertices.SDEFParams[i] = SDEFs[i].second;
+    }
+    vertices.SDEFVertices.resize(SDEFs.size());
+    vertices.SDEFParams.resize(SDEFs.size());
+
+    for (auto &v: morphs.vertexIndices) {
+        v = newIndices[v];
+    }
+    for (auto &v: morphs.UVVertexIndices) {
+        v = newIndices[v];
+    }
+    vertexNum = order.size();
+}
+
+void PMXModel::optimizeMesh() {
+    getVertices();
+    getMaterials();
+    getMorphs();
+    std::pmr::vector<PMXSurface> &surfaceElements = getSurfaces().mutableElements();
+    uint32_t *indices = surfaceElements.empty() ? nullptr : surfaceElements.data()->vertexIdx;
+    size_t indexNum = surfaceElements.size() * 3;
+#ifdef MODEL_PARSER_DEBUG
+    float ACMRBefore = computeACMR(indices, indexNum, vertexNum);
+#endif
+
+    // each material is drawn on its own, so its triangles are reordered on their own
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t surfaceOffset = 0;
+    for (auto &material: materials) {
+        ranges.push_back({surfaceOffset, (size_t)material.surfaceNum});
+        surfaceOffset += material.surfaceNum;
+    }
+    if (surfaceOffset < surfaceElements.size()) {
+        ranges.push_back({surfaceOffset, surfaceElements.size() - surfaceOffset});
+    }
+    auto optimizeRange = [&](size_t i) {
+        optimizeVertexCache(indices + 3 * ranges[i].first, 3 * ranges[i].second, vertexNum);
+    };
+    if (loadFlags & LOAD_SINGLE_THREADED) {
+        for (size_t i = 0; i < ranges.size(); i++) {
+            optimizeRange(i);
+        }
+    } else {
+        ThreadPool::shared().parallelFor(ranges.size(), optimizeRange);
+    }
+
+    permuteVertices(optimizeVertexFetch(indices, indexNum, vertexNum));
+#ifdef MODEL_PARSER_DEBUG
+    std::cout << "PMX ACMR: " << ACMRBefore << " -> " << computeACMR(indices, indexNum, vertexNum) << std::endl;
+#endif
+}
+
+// the words weldVertices matches exactly: the skinning, and without an epsilon every float's bits
+void PMXModel::weldKey(size_t i, float epsilon, std::vector<uint32_t> &key) const {
+    key.clear();
+    auto addFloats = [&](const float *values, size_t num) {
+        for (size_t j = 0; j < num; j++) {
+            uint32_t bits;
+            memcpy(&bits, values + j, sizeof(bits));
+            key.push_back(bits);
+        }
+    };
+    if (epsilon <= 0.0f) {
+        addFloats(&vertices.positions[i].x, 3);
+        addFloats(&vertices.normals[i].x, 3);
+        addFloats(&vertices.UVs[i].u, 2);
+        if (vertices.additionalUVNum > 0) {
+            addFloats(&vertices.additionalUVs[i * vertices.additionalUVNum].x, 4 * vertices.additionalUVNum);
+        }
+        addFloats(&vertices.edgeScales[i], 1);
+    }
+    // bone weights and SDEF parameters are compared exactly, they decide the deformation
+    key.push_back(vertices.deformMethods[i]);
+    for (auto j = 0; j < vertices.getBoneNum(i); j++) {
+        float weight = vertices.getBoneWeight(i, j);
+        key.push_back(vertices.getBoneIdx(i, j));
+        addFloats(&weight, 1);
+    }
+    if (vertices.deformMethods[i] == PMXVertexData::DEFORM_METHOD_SDEF) {
+        const PMXSDEFParams &SDEF = vertices.getSDEF(i);
+        const size_t wordNum = sizeof(PMXSDEFParams) / sizeof(uint32_t);
+        uint32_t words[wordNum];
+        memcpy(words, &SDEF, sizeof(words));
+        key.insert(key.end(), words, words + wordNum);
+    }
+}
+
+// every float weldKey leaves out with an epsilon, component by component
+bool PMXModel::weldClose(size_t a, size_t b, float epsilon) const {
+    auto close = [&](const float *x, const float *y, size_t num) {
+        for (size_t j = 0; j < num; j++) {
+            if (!(std::abs(x[j] - y[j]) <= epsilon)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const size_t UVNum = vertices.additionalUVNum;
+    return close(&vertices.positions[a].x, &vertices.positions[b].x, 3)
+        && close(&vertices.normals[a].x, &vertices.normals[b].x, 3)
+        && close(&vertices.UVs[a].u, &vertices.UVs[b].u, 2)
+        && (UVNum == 0 || close(&vertices.additionalUVs[a * UVNum].x, &vertices.additionalUVs[b * UVNum].x, 4 * UVNum))
+        && close(&vertices.edgeScales[a], &vertices.edgeScales[b], 1);
+}
+
+static uint64_t hashWords(uint64_t hash, const uint32_t *words, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// cubes of side epsilon, positions within epsilon of each other lie in the same or adjacent cubes
+static void positionCell(const PMXFloat3XYZ &pos, float epsilon, int64_t *cell) {
+    const float *coords = &pos.x;
+    for (auto j = 0; j < 3; j++) {
+        double steps = std::floor((double)coords[j] / epsilon);
+        // non-finite positions are never within epsilon of anything, any cell will do
+        cell[j] = std::abs(steps) < 1e18 ? (int64_t)steps : 0;
+    }
+}
+
+static uint64_t cellHash(uint64_t keyHash, const int64_t *cell) {
+    uint32_t words[6];
+    memcpy(words, cell, sizeof(words));
+    return hashWords(keyHash, words, 6);
+}
+
+size_t PMXModel::weldVertices(float epsilon) {
+    getVertices();
+    getMorphs();
+    std::pmr::vector<PMXSurface> &surfaceElements = getSurfaces().mutableElements();
+    const size_t oldVertexNum = vertexNum;
+
+    // morphs move vertices apart, so vertices a morph references keep their own
+    std::vector<char> morphed(oldVertexNum, 0);
+    for (auto v: morphs.vertexIndices) {
+        morphed[v] = 1;
+    }
+    for (auto v: morphs.UVVertexIndices) {
+        morphed[v] = 1;
+    }
+
+    // keys are hashed in parallel, then looked up in order so the first of equal vertices survives
+    std::vector<uint64_t> hashes(oldVertexNum);
+    const size_t chunkSize = 4096;
+    auto hashChunk = [&](size_t chunk) {
+        std::vector<uint32_t> key;
+        for (size_t i = chunk * chunkSize; i < std::min((chunk + 1) * chunkSize, oldVertexNum); i++) {
+            weldKey(i, epsilon, key);
+            hashes[i] = hashWords(0xcbf29ce484222325ULL, key.data(), key.size());
+        }
+    };
+    size_t chunkNum = (oldVertexNum + chunkSize - 1) / chunkSize;
+    if (loadFlags & LOAD_SINGLE_THREADED) {
+        for (size_t chunk = 0; chunk < chunkNum; chunk++) {
+            hashChunk(chunk);
+        }
+    } else {
+        ThreadPool::shared().parallelFor(chunkNum, hashChunk);
+    }
+
+    // open addressing table of surviving vertices, at most half full
+    const uint32_t EMPTY = UINT32_MAX;
+    size_t tableSize = 1;
+    while (tableSize < 2 * oldVertexNum) {
+        tableSize *= 2;
+    }
+    std::vector<uint32_t> table(tableSize, EMPTY);
+    // the hash each survivor is filed under: its key's, with an epsilon mixed with its position cell
+    std::vector<uint64_t> tableHashes(oldVertexNum);
+    std::vector<uint32_t> order, newIndices(oldVertexNum);
+    std::vector<uint32_t> key, otherKey;
+    order.reserve(oldVertexNum);
+    // with an epsilon a vertex may merge into survivors in its own cell and the 26 around it
+    const int reach = epsilon > 0.0f ? 1 : 0;
+    for (size_t i = 0; i < oldVertexNum; i++) {
+        if (morphed[i]) {
+            newIndices[i] = order.size();
+            order.push_back(i);
+            continue;
+        }
+        weldKey(i, epsilon, key);
+        int64_t cell[3] = {0, 0, 0};
+        if (reach) {
+            positionCell(vertices.positions[i], epsilon, cell);
+        }
+        // the first survivor that matches, so merging does not depend on probing order
+        uint32_t match = EMPTY;
+        for (auto dx = -reach; dx <= reach; dx++) {
+            for (auto dy = -reach; dy <= reach; dy++) {
+                for (auto dz = -reach; dz <= reach; dz++) {
+                    int64_t neighbour[3] = {cell[0] + dx, cell[1] + dy, cell[2] + dz};
+                    uint64_t hash = reach ? cellHash(hashes[i], neighbour) : hashes[i];
+                    for (size_t slot = hash & (tableSize - 1); table[slot] != EMPTY; slot = (slot + 1) & (tableSize - 1)) {
+                        uint32_t other = table[slot];
+                        if (tableHashes[other] != hash || other >= match) {
+                            continue;
+                        }
+                        weldKey(other, epsilon, otherKey);
+                        if (key == otherKey && (!reach || weldClose(i, other, epsilon))) {
+                            match = other;
+                        }
+                    }
+                }
+            }
+        }
+        if (match != EMPTY) {
+            newIndices[i] = newIndices[match];
+            continue;
+        }
+        tableHashes[i] = reach ? cellHash(hashes[i], cell) : hashes[i];
+        size_t slot = tableHashes[i] & (tableSize - 1);
+        while (table[slot] != EMPTY) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        table[slot] = i;
+        newIndices[i] = order.size();
+        order.push_back(i);
+    }
+    if (order.size() == oldVertexNum) {
+        return 0;
+    }
+
+    for (auto &surface: surfaceElements) {
+        for (auto &v: surface.vertexIdx) {
+            v = newIndices[v];
+        }
+    }
+    remapVertices(order, newIndices);
+#ifdef MODEL_PARSER_DEBUG
+    std::cout << "PMX welded vertices: " << oldVertexNum << " -> " << vertexNum << std::endl;
+#endif
+    return oldVertexNum - vertexNum;
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <mmd/model_loader.hpp>
+
+namespace fsys = boost::filesystem;
+
+struct ModelLoader::Job {
+    std::string filePath;
+    int loadFlags;
+    size_t fileSize;
+    bool admitted;
+    std::promise<std::unique_ptr<PMXModel>> result;
+};
+
+// start reading the whole file into the page cache without waiting for it
+static void prefetchFile(const std::string &filePath) {
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+}
+
+ModelLoader::ModelLoader(size_t readaheadBudget_, size_t driverNum):
+    readaheadBudget(readaheadBudget_), inFlightBytes(0),
+    drivers(driverNum ? driverNum : std::max(2u, std::thread::hardware_concurrency() / 2)) {}
+
+std::future<std::unique_ptr<PMXModel>> ModelLoader::load(const std::string &filePath, int loadFlags) {
+    return std::move(load(std::vector<std::string>{filePath}, loadFlags)[0]);
+}
+
+std::vector<std::future<std::unique_ptr<PMXModel>>> ModelLoader::load(const std::vector<std::string> &filePaths,
+                                                                      int loadFlags) {
+    std::vector<std::shared_ptr<Job>> jobs;
+    std::vector<std::future<std::unique_ptr<PMXModel>>> results;
+    for (auto &filePath: filePaths) {
+        auto job = std::make_shared<Job>();
+        job->filePath = filePath;
+        job->loadFlags = loadFlags;
+        // missing files cost nothing, their constructor reports them
+        boost::system::error_code error;
+        job->fileSize = fsys::file_size(filePath, error);
+        if (error) {
+            job->fileSize = 0;
+        }
+        job->admitted = false;
+        results.push_back(job->result.get_future());
+        jobs.push_back(job);
+    }
+    std::vector<std::string> admitted;
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        pendingJobs.insert(pendingJobs.end(), jobs.begin(), jobs.end());
+        // drivers take jobs in the order they are admitted in, also across
+        // concurrent calls, so an admitted job never waits behind a pending one
+        for (auto &job: jobs) {
+            drivers.submit([this, job]() { runJob(job); });
+        }
+        admitted = admitJobs();
+    }
+    jobsCond.notify_all();
+    for (auto &filePath: admitted) {
+        prefetchFile(filePath);
+    }
+    return results;
+}
+
+std::vector<std::string> ModelLoader::admitJobs() {
+    // called with jobsMutex held, returns the files to prefetch once it is released
+    std::vector<std::string> admitted;
+    while (!pendingJobs.empty()) {
+        auto &job = pendingJobs.front();
+        if (inFlightBytes > 0 && inFlightBytes + job->fileSize > readaheadBudget) {
+            break;
+        }
+        inFlightBytes += job->fileSize;
+        job->admitted = true;
+        admitted.push_back(job->filePath);
+        pendingJobs.pop_front();
+    }
+    return admitted;
+}
+
+void ModelLoader::runJob(const std::shared_ptr<Job> &job) {
+    {
+        // every job admitted before this one is running on another driver
+        // and frees its bytes when done, so this wait always ends
+        std::unique_lock<std::mutex> lock(jobsMutex);
+        jobsCond.wait(lock, [&]() { return job->admitted; });
+    }
+    try {
+        job->result.set_value(std::make_unique<PMXModel>(job->filePath, job->loadFlags));
+    } catch (...) {
+        job->result.set_exception(std::current_exception());
+    }
+    std::vector<std::string> admitted;
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        inFlightBytes -= job->fileSize;
+        admitted = admitJobs();
+    }
+    jobsCond.notify_all();
+    for (auto &filePath: admitted) {
+        prefetchFile(filePath);
+    }
+}
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <mmd/mapped_file.hpp>
+#include <mmd/motion.hpp>
+
+static const size_t VMD_SIGNATURE_LEN = 30;
+static const size_t VMD_NAME_LEN = 15;
+static const size_t VMD_BONE_KEY_SIZE = VMD_NAME_LEN + sizeof(uint32_t) + sizeof(PMXFloat3XYZ)
+                                      + sizeof(PMXFloat4XYZW) + 64;
+static const size_t VMD_MORPH_KEY_SIZE = VMD_NAME_LEN + sizeof(uint32_t) + sizeof(float);
+
+namespace {
+
+// keys grouped by name, records lists file key indices track by track
+struct VMDTrackLayout {
+    std::vector<std::string_view> rawNames;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> records;
+};
+
+/*
+ * Group num records of recordSize bytes, each starting with a name and a
+ * frame number, into tracks. Keys stay in file order within a track unless
+ * the file is out of order, and of keys sharing a frame the last one is kept.
+ */
+void groupKeys(const char *buf, uint32_t num, size_t recordSize, VMDTrackLayout &layout) {
+    auto keyFrame = [&](uint32_t key) {
+        return *(uint32_t *)(buf + (size_t)key * recordSize + VMD_NAME_LEN);
+    };
+
+    std::unordered_map<std::string_view, uint32_t> trackIndices;
+    std::vector<uint32_t> keyTracks(num);
+    std::vector<uint32_t> counts;
+    for (uint32_t i = 0; i < num; i++) {
+        const char *record = buf + (size_t)i * recordSize;
+        std::string_view name(record, strnlen(record, VMD_NAME_LEN));
+        auto found = trackIndices.try_emplace(name, layout.rawNames.size());
+        if (found.second) {
+            layout.rawNames.push_back(name);
+            counts.push_back(0);
+        }
+        keyTracks[i] = found.first->second;
+        counts[keyTracks[i]]++;
+    }
+
+    // counting sort by track keeps file order within each track
+    size_t trackNum = layout.rawNames.size();
+    std::vector<uint32_t> starts(trackNum + 1, 0);
+    for (size_t i = 0; i < trackNum; i++) {
+        starts[i + 1] = starts[i] + counts[i];
+    }
+    std::vector<uint32_t> order(num);
+    std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+    for (uint32_t i = 0; i < num; i++) {
+        order[fill[keyTracks[i]]++] = i;
+    }
+
+    layout.offsets.resize(trackNum + 1);
+    layout.records.clear();
+    layout.records.reserve(num);
+    for (size_t i = 0; i < trackNum; i++) {
+        auto begin = order.begin() + starts[i], end = order.begin() + starts[i + 1];
+        auto byFrame = [&](uint32_t a, uint32_t b) { return keyFrame(a) < keyFrame(b); };
+        if (!std::is_sorted(begin, end, byFrame)) {
+            std::stable_sort(begin, end, byFrame);
+        }
+        layout.offsets[i] = layout.records.size();
+        for (auto it = begin; it != end; ++it) {
+            if (layout.records.size() > layout.offsets[i] && keyFrame(layout.records.back()) == keyFrame(*it)) {
+                layout.records.back() = *it;
+            } else {
+                layout.records.push_back(*it);
+            }
+        }
+    }
+    layout.offsets[trackNum] = layout.records.size();
+}
+
+/*
+ * Index of the key starting the segment that contains frame, or the first
+ * key before the track starts. Sequential playback stays on or moves one
+ * past the previous key, anything else is a binary search.
+ */
+uint32_t seekKey(const uint32_t *frames, uint32_t begin, uint32_t end, uint32_t key, float frame) {
+    if (frame < frames[begin]) {
+        return begin;
+    }
+    if (frames[key] <= frame) {
+        if (key + 1 == end || frame < frames[key + 1]) {
+            return key;
+        }
+        if (key + 2 == end || frame < frames[key + 2]) {
+            return key + 1;
+        }
+    }
+    return std::upper_bound(frames + begin, frames + end, frame) - frames - 1;
+}
+
+PMXFloat4XYZW slerp(const PMXFloat4XYZW &a, PMXFloat4XYZW b, float t) {
+    float cosTheta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    // take the short way round
+    if (cosTheta < 0.0f) {
+        b = {-b.x, -b.y, -b.z, -b.w};
+        cosTheta = -cosTheta;
+    }
+    float wa = 1.0f - t, wb = t;
+    if (cosTheta < 0.9995f) {
+        float theta = std::acos(cosTheta), sinTheta = std::sin(theta);
+        wa = std::sin(wa * theta) / sinTheta;
+        wb = std::sin(wb * theta) / sinTheta;
+    }
+    PMXFloat4XYZW result = {wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z, wa * a.w + wb * b.w};
+    float len = std::sqrt(result.x * result.x + result.y * result.y + result.z * result.z + result.w * result.w);
+    return {result.x / len, result.y / len, result.z / len, result.w / len};
+}
+
+}
+
+float evalVMDCurve(const VMDCurve &curve, float t) {
+    if (curve.x1 == curve.y1 && curve.x2 == curve.y2) {
+        return t;
+    }
+    const float x1 = curve.x1 / 127.0f, y1 = curve.y1 / 127.0f;
+    const float x2 = curve.x2 / 127.0f, y2 = curve.y2 / 127.0f;
+    auto bezier = [](float p1, float p2, float s) {
+        float r = 1.0f - s;
+        return 3.0f * r * r * s * p1 + 3.0f * r * s * s * p2 + s * s * s;
+    };
+
+    // find s with x(s) = t, Newton steps falling back to bisection
+    float s = t, low = 0.0f, high = 1.0f;
+    for (auto i = 0; i < 16; i++) {
+        float error = bezier(x1, x2, s) - t;
+        if (std::fabs(error) < 1e-5f) {
+            break;
+        }
+        if (error > 0.0f) {
+            high = s;
+        } else {
+            low = s;
+        }
+        float r = 1.0f - s;
+        float slope = 3.0f * r * r * x1 + 6.0f * r * s * (x2 - x1) + 3.0f * s * s * (1.0f - x2);
+        float next = slope > 1e-6f ? s - error / slope : low - 1.0f;
+        s = (next > low && next < high) ? next : 0.5f * (low + high);
+    }
+    return bezier(y1, y2, s);
+}
+
+VMDMotion::VMDMotion(const std::string &filePath_): filePath(filePath_), lastFrame(0) {
+    std::unique_ptr<MappedFile> file;
+    try {
+        file = std::make_unique<MappedFile>(filePath);
+    } catch (std::runtime_error &e) {
+        throw std::runtime_error("Unable to open VMD file");
+    }
+    file->adviseSequential(0, file->size());
+    parseFile(file->data(), file->size());
+}
+
+void VMDMotion::parseFile(const char *data, size_t size) {
+    size_t bufIdx = 0;
+    auto require = [&](size_t bytes) {
+        if (bufIdx + bytes > size) {
+            throw std::runtime_error("Truncated VMD file");
+        }
+    };
+
+    // "Vocaloid Motion Data 0002" has 20 byte model names, older files 10
+    require(VMD_SIGNATURE_LEN);
+    if (memcmp(data, "Vocaloid Motion Data ", 21) != 0) {
+        throw std::runtime_error("Invalid VMD file");
+    }
+    size_t modelNameLen = memcmp(data + 21, "0002", 4) == 0 ? 20 : 10;
+    bufIdx += VMD_SIGNATURE_LEN;
+    require(modelNameLen);
+    modelName = strings.storeShiftJIS(data + bufIdx, strnlen(data + bufIdx, modelNameLen));
+    bufIdx += modelNameLen;
+
+    VMDTrackLayout layout;
+
+    // bone keys
+    require(sizeof(uint32_t));
+    uint32_t boneKeyNum = *(uint32_t *)(data + bufIdx);
+    bufIdx += sizeof(uint32_t);
+    require((size_t)boneKeyNum * VMD_BONE_KEY_SIZE);
+    const char *boneBuf = data + bufIdx;
+    bufIdx += (size_t)boneKeyNum * VMD_BONE_KEY_SIZE;
+    groupKeys(boneBuf, boneKeyNum, VMD_BONE_KEY_SIZE, layout);
+
+    for (auto rawName: layout.rawNames) {
+        boneTrackRawNames.push_back(strings.store(rawName.data(), rawName.size()));
+        boneTrackNames.push_back(strings.storeShiftJIS(rawName.data(), rawName.size()));
+    }
+    boneTrackOffsets = layout.offsets;
+    size_t keyNum = layout.records.size();
+    boneFrames.resize(keyNum);
+    bonePositions.resize(keyNum);
+    boneRotations.resize(keyNum);
+    boneCurves.resize(4 * keyNum);
+    for (size_t i = 0; i < keyNum; i++) {
+        const char *record = boneBuf + (size_t)layout.records[i] * VMD_BONE_KEY_SIZE + VMD_NAME_LEN;
+        boneFrames[i] = *(uint32_t *)record;
+        lastFrame = std::max(lastFrame, boneFrames[i]);
+        bonePositions[i] = *(PMXFloat3XYZ *)(record + 4);
+        boneRotations[i] = *(PMXFloat4XYZW *)(record + 16);
+        // the first row of the 4x16 table holds x1 of X, Y, Z, R, then y1, x2 and y2
+        const unsigned char *table = (const unsigned char *)(record + 32);
+        for (auto j = 0; j < 4; j++) {
+            boneCurves[4 * i + j] = {table[j], table[4 + j], table[8 + j], table[12 + j]};
+        }
+    }
+
+    // morph keys, missing in files holding only bone keys
+    layout = VMDTrackLayout();
+    uint32_t morphKeyNum = 0;
+    if (bufIdx + sizeof(uint32_t) <= size) {
+        morphKeyNum = *(uint32_t *)(data + bufIdx);
+        bufIdx += sizeof(uint32_t);
+        require((size_t)morphKeyNum * VMD_MORPH_KEY_SIZE);
+    }
+    const char *morphBuf = data + bufIdx;
+    groupKeys(morphBuf, morphKeyNum, VMD_MORPH_KEY_SIZE, layout);
+
+    for (auto rawName: layout.rawNames) {
+        morphTrackRawNames.push_back(strings.store(rawName.data(), rawName.size()));
+        morphTrackNames.push_back(strings.storeShiftJIS(rawName.data(), rawName.size()));
+    }
+    morphTrackOffsets = layout.offsets;
+    keyNum = layout.records.size();
+    morphFrames.resize(keyNum);
+    morphWeights.resize(keyNum);
+    for (size_t i = 0; i < keyNum; i++) {
+        const char *record = morphBuf + (size_t)layout.records[i] * VMD_MORPH_KEY_SIZE + VMD_NAME_LEN;
+        morphFrames[i] = *(uint32_t *)record;
+        lastFrame = std::max(lastFrame, morphFrames[i]);
+        morphWeights[i] = *(float *)(record + 4);
+    }
+}
+
+VMDBinding VMDMotion::bind(PMXModel &model) const {
+    /*
+     * VMD names are Shift_JIS cut to 15 bytes, possibly mid character, so
+     * model names are encoded and cut the same way and compared as bytes.
+     */
+    auto bindNames = [](const std::vector<std::string_view> &rawNames, size_t nameNum,
+                        const std::function<std::string_view(size_t)> &getName, std::vector<int> &tracks) {
+        std::unordered_map<std::string_view, int> trackIndices;
+        for (size_t i = 0; i < rawNames.size(); i++) {
+            trackIndices.emplace(rawNames[i], i);
+        }
+        tracks.assign(rawNames.size(), -1);
+        std::string encoded;
+        for (size_t i = 0; i < nameNum; i++) {
+            std::string_view name = getName(i);
+            encoded.resize(name.size());
+            size_t len = utf8ToShiftJIS(name.data(), name.size(), &encoded[0]);
+            auto found = trackIndices.find(std::string_view(encoded.data(), std::min(len, VMD_NAME_LEN)));
+            // the first of several names cut to the same bytes wins
+            if (found != trackIndices.end() && tracks[found->second] < 0) {
+                tracks[found->second] = i;
+            }
+        }
+    };
+
+    VMDBinding binding;
+    PMXBoneData &bones = model.getBones();
+    bindNames(boneTrackRawNames, bones.size(), [&](size_t i) { return bones.getName(i).text; },
+              binding.boneTrackBones);
+    PMXMorphData &morphs = model.getMorphs();
+    bindNames(morphTrackRawNames, morphs.size(), [&](size_t i) { return morphs.getName(i).text; },
+              binding.morphTrackMorphs);
+    return binding;
+}
+
+VMDCursor::VMDCursor(const VMDMotion &motion_): motion(&motion_) {
+    boneKeys.assign(motion->boneTrackOffsets.begin(), motion->boneTrackOffsets.end() - 1);
+    morphKeys.assign(motion->morphTrackOffsets.begin(), motion->morphTrackOffsets.end() - 1);
+}
+
+void VMDCursor::sampleBone(size_t track, float frame, PMXFloat3XYZ &pos, PMXFloat4XYZW &rotation) {
+    uint32_t begin = motion->boneTrackOffsets[track], end = motion->boneTrackOffsets[track + 1];
+    if (begin == end) {
+        pos = {0.0f, 0.0f, 0.0f};
+        rotation = {0.0f, 0.0f, 0.0f, 1.0f};
+        return;
+    }
+    const uint32_t *frames = motion->boneFrames.data();
+    uint32_t key = boneKeys[track] = seekKey(frames, begin, end, boneKeys[track], frame);
+    if (key + 1 == end || frame <= frames[key]) {
+        pos = motion->bonePositions[key];
+        rotation = motion->boneRotations[key];
+        return;
+    }
+
+    // the curves of the next key shape the segment leading to it
+    uint32_t next = key + 1;
+    float t = (frame - frames[key]) / (frames[next] - frames[key]);
+    const PMXFloat3XYZ &p0 = motion->bonePositions[key], &p1 = motion->bonePositions[next];
+    const VMDCurve *curves = &motion->boneCurves[4 * next];
+    pos.x = p0.x + (p1.x - p0.x) * evalVMDCurve(curves[VMDMotion::CURVE_X], t);
+    pos.y = p0.y + (p1.y - p0.y) * evalVMDCurve(curves[VMDMotion::CURVE_Y], t);
+    pos.z = p0.z + (p1.z - p0.z) * evalVMDCurve(curves[VMDMotion::CURVE_Z], t);
+    rotation = slerp(motion->boneRotations[key], motion->boneRotations[next],
+                     evalVMDCurve(curves[VMDMotion::CURVE_ROTATION], t));
+}
+
+float VMDCursor::sampleMorph(size_t track, float frame) {
+    uint32_t begin = motion->morphTrackOffsets[track], end = motion->morphTrackOffsets[track + 1];
+    if (begin == end) {
+        return 0.0f;
+    }
+    const uint32_t *frames = motion->morphFrames.data();
+    uint32_t key = morphKeys[track] = seekKey(frames, begin, end, morphKeys[track], frame);
+    if (key + 1 == end || frame <= frames[key]) {
+        return motion->morphWeights[key];
+    }
+    float t = (frame - frames[key]) / (frames[key + 1] - frames[key]);
+    return motion->morphWeights[key] + (motion->morphWeights[key + 1] - motion->morphWeights[key]) * t;
+}
+
+void VMDCursor::samplePose(float frame, const VMDBinding &binding, PMXFloat3XYZ *bonePositions,
+                           PMXFloat4XYZW *boneRotations, float *morphWeights) {
+    if (bonePositions || boneRotations) {
+        for (size_t i = 0; i < binding.boneTrackBones.size(); i++) {
+            int bone = binding.boneTrackBones[i];
+            if (bone < 0) {
+                continue;
+            }
+            PMXFloat3XYZ pos;
+            PMXFloat4XYZW rotation;
+            sampleBone(i, frame, pos, rotation);
+            if (bonePositions) {
+                bonePositions[bone] = pos;
+            }
+            if (boneRotations) {
+                boneRotations[bone] = rotation;
+            }
+        }
+    }
+    if (morphWeights) {
+        for (size_t i = 0; i < binding.morphTrackMorphs.size(); i++) {
+            int morph = binding.morphTrackMorphs[i];
+            if (morph >= 0) {
+                morphWeights[morph] = sampleMorph(i, frame);
+            }
+        }
+    }
+}
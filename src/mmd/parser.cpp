@@ -1,194 +1,738 @@
-#include <codecvt>
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <locale>
 #include <boost/filesystem.hpp>
+#include <FreeImagePlus.h>
 
 #include <mmd/parser.hpp>
+#include <mmd/simd.hpp>
 
 namespace fsys = boost::filesystem;
 
 void PMXModel::readFile() {
-    std::fstream PMXFile(filePath, std::ios::in | std::ios::binary | std::ios::ate);
-    if (PMXFile.is_open()) {
-        fileSize = PMXFile.tellg();
-#ifdef MODEL_PARSER_DEBUG
-        std::cout << filePath << std::endl;
-        std::cout << "PMX file size: " << fileSize << std::endl;
-#endif
-        memBlock = std::unique_ptr<char>(new char[fileSize]);
-        PMXFile.seekg(0, std::ios::beg);
-        PMXFile.read(memBlock.get(), fileSize);
-        PMXFile.close();
-    } else {
+    try {
+        if (fileSource) {
+            fileBlock = fileSource->open(filePath);
+        } else {
+            fileBlock = std::make_shared<MappedFile>(filePath, !(loadFlags & LOAD_BUFFERED));
+        }
+    } catch (std::runtime_error &e) {
         throw std::runtime_error("Unable to open PMX file");
     }
+    fileSize = fileBlock->size();
+    // the parser walks the file front to back exactly once
+    fileBlock->adviseSequential(0, fileSize);
+#ifdef MODEL_PARSER_DEBUG
+    std::cout << filePath << std::endl;
+    std::cout << "PMX file size: " << fileSize << (fileBlock->isMapped() ? " (mapped)" : " (buffered)") << std::endl;
+#endif
     return;
 }
 
-PMXTextBuf PMXModel::readTextBuf(char *buf) {
+PMXVertexData::PMXVertexData(std::pmr::memory_resource *resource):
+    positions(resource), normals(resource), UVs(resource), additionalUVs(resource),
+    deformMethods(resource), edgeScales(resource), skinOffsets(resource),
+    boneIndices16(resource), boneIndices32(resource), boneWeights(resource),
+    SDEFVertices(resource), SDEFParams(resource) {}
+
+const PMXSDEFParams& PMXVertexData::getSDEF(size_t i) const {
+    auto it = std::lower_bound(SDEFVertices.begin(), SDEFVertices.end(), i);
+    if (it == SDEFVertices.end() || *it != i) {
+        throw std::runtime_error("Vertex is not SDEF");
+    }
+    return SDEFParams[it - SDEFVertices.begin()];
+}
+
+size_t PMXVertexData::byteSize() const {
+    return positions.capacity() * sizeof(PMXFloat3XYZ)
+         + normals.capacity() * sizeof(PMXFloat3XYZ)
+         + UVs.capacity() * sizeof(PMXFloat2UV)
+         + additionalUVs.capacity() * sizeof(PMXFloat4XYZW)
+         + deformMethods.capacity() * sizeof(unsigned char)
+         + edgeScales.capacity() * sizeof(float)
+         + skinOffsets.capacity() * sizeof(uint32_t)
+         + boneIndices16.capacity() * sizeof(int16_t)
+         + boneIndices32.capacity() * sizeof(int32_t)
+         + boneWeights.capacity() * sizeof(float)
+         + SDEFVertices.capacity() * sizeof(uint32_t)
+         + SDEFParams.capacity() * sizeof(PMXSDEFParams);
+}
+
+size_t PMXModel::estimateDecodedSize() {
+    // each stream may need up to alignof(std::max_align_t) bytes of padding
+    const size_t padding = alignof(std::max_align_t);
+    size_t result = 0;
+    result += (size_t)vertexNum * (2 * sizeof(PMXFloat3XYZ) + sizeof(PMXFloat2UV)
+                                   + globals.additionalUVNum * sizeof(PMXFloat4XYZW)
+                                   + sizeof(unsigned char) + sizeof(float) + sizeof(uint32_t));
+    result += vertexSkinNum * ((globals.boneIdxSize > 2 ? sizeof(int32_t) : sizeof(int16_t)) + sizeof(float));
+    result += vertexSDEFNum * (sizeof(uint32_t) + sizeof(PMXSDEFParams));
+    if (globals.vertexIdxSize != 4 || !fileBlock->isMapped()) {
+        result += (size_t)surfaceNum * sizeof(PMXSurface);
+    }
+    result += textureNum * sizeof(PMXTexture) + materialNum * sizeof(PMXMaterial);
+    result += (size_t)boneNum * (2 * sizeof(PMXTextBuf) + 5 * sizeof(PMXFloat3XYZ) + 7 * sizeof(int)
+                                 + sizeof(uint16_t) + sizeof(float));
+    result += boneIKNum * (3 * sizeof(int) + sizeof(float) + sizeof(uint32_t)) + sizeof(uint32_t);
+    result += boneIKLinkNum * (sizeof(int) + sizeof(unsigned char) + 2 * sizeof(PMXFloat3XYZ));
+    result += (size_t)morphNum * (2 * sizeof(PMXTextBuf) + 2 * sizeof(unsigned char) + 2 * sizeof(uint32_t));
+    uint32_t morphUVNum = 0;
+    for (auto type = PMXMorphData::MORPH_TYPE_UV; type <= PMXMorphData::MORPH_TYPE_ADDITIONAL_UV4; type++) {
+        morphUVNum += morphOffsetNums[type];
+    }
+    result += morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX] * (sizeof(uint32_t) + sizeof(PMXFloat3XYZ));
+    result += morphUVNum * (sizeof(uint32_t) + sizeof(PMXFloat4XYZW));
+    result += morphOffsetNums[PMXMorphData::MORPH_TYPE_BONE] * (sizeof(int) + sizeof(PMXFloat3XYZ) + sizeof(PMXFloat4XYZW));
+    result += morphOffsetNums[PMXMorphData::MORPH_TYPE_MATERIAL] * sizeof(PMXMaterialMorphOffset);
+    result += (morphOffsetNums[PMXMorphData::MORPH_TYPE_GROUP] + morphOffsetNums[PMXMorphData::MORPH_TYPE_FLIP])
+              * (sizeof(int) + sizeof(float));
+    result += morphOffsetNums[PMXMorphData::MORPH_TYPE_IMPULSE] * sizeof(PMXImpulseMorphOffset);
+    result += (size_t)rigidBodyNum * (2 * sizeof(PMXTextBuf) + 4 * sizeof(unsigned char) + 2 * sizeof(uint16_t)
+                                      + 3 * sizeof(PMXFloat3XYZ) + 5 * sizeof(float) + 3 * sizeof(int));
+    result += (size_t)jointNum * (2 * sizeof(PMXTextBuf) + sizeof(unsigned char) + 8 * sizeof(PMXFloat3XYZ)
+                                  + 4 * sizeof(int) + 2 * sizeof(uint32_t));
+    // UTF-16 text grows by at most half when transcoded to UTF-8
+    result += scannedTextLen * 3 / 2;
+    return result + 112 * padding;
+}
+
+PMXBoneData::PMXBoneData(std::pmr::memory_resource *resource):
+    names(resource), namesEn(resource), positions(resource), parents(resource),
+    deformLayers(resource), flags(resource), tailOffsets(resource), tailBones(resource),
+    grantParents(resource), grantRatios(resource), fixedAxes(resource),
+    localAxesX(resource), localAxesZ(resource), externalParentKeys(resource),
+    afterPhysicsBegin(0), sortedIdx(resource), fileIdx(resource),
+    IKBones(resource), IKTargets(resource), IKLoopNums(resource), IKLimitAngles(resource),
+    IKLinkOffsets(resource), IKLinkBones(resource), IKLinkLimited(resource),
+    IKLinkLowers(resource), IKLinkUppers(resource) {}
+
+size_t PMXBoneData::byteSize() const {
+    return (names.capacity() + namesEn.capacity()) * sizeof(PMXTextBuf)
+         + (positions.capacity() + tailOffsets.capacity() + fixedAxes.capacity()
+            + localAxesX.capacity() + localAxesZ.capacity()) * sizeof(PMXFloat3XYZ)
+         + (parents.capacity() + deformLayers.capacity() + tailBones.capacity()
+            + grantParents.capacity() + externalParentKeys.capacity()
+            + sortedIdx.capacity() + fileIdx.capacity()) * sizeof(int)
+         + flags.capacity() * sizeof(uint16_t)
+         + grantRatios.capacity() * sizeof(float)
+         + (IKBones.capacity() + IKTargets.capacity() + IKLoopNums.capacity()) * sizeof(int)
+         + IKLimitAngles.capacity() * sizeof(float)
+         + IKLinkOffsets.capacity() * sizeof(uint32_t)
+         + IKLinkBones.capacity() * sizeof(int)
+         + IKLinkLimited.capacity() * sizeof(unsigned char)
+         + (IKLinkLowers.capacity() + IKLinkUppers.capacity()) * sizeof(PMXFloat3XYZ);
+}
+
+PMXMorphData::PMXMorphData(std::pmr::memory_resource *resource):
+    names(resource), namesEn(resource), panels(resource), types(resource),
+    offsetBegins(resource), offsetNums(resource),
+    vertexIndices(resource), positionDeltas(resource), UVVertexIndices(resource), UVDeltas(resource),
+    boneIndices(resource), boneTranslations(resource), boneRotations(resource),
+    materialOffsets(resource), morphIndices(resource), morphWeights(resource),
+    impulseOffsets(resource) {}
+
+size_t PMXMorphData::byteSize() const {
+    return (names.capacity() + namesEn.capacity()) * sizeof(PMXTextBuf)
+         + (panels.capacity() + types.capacity()) * sizeof(unsigned char)
+         + (offsetBegins.capacity() + offsetNums.capacity()) * sizeof(uint32_t)
+         + (vertexIndices.capacity() + UVVertexIndices.capacity()) * sizeof(uint32_t)
+         + positionDeltas.capacity() * sizeof(PMXFloat3XYZ)
+         + UVDeltas.capacity() * sizeof(PMXFloat4XYZW)
+         + boneIndices.capacity() * sizeof(int)
+         + boneTranslations.capacity() * sizeof(PMXFloat3XYZ)
+         + boneRotations.capacity() * sizeof(PMXFloat4XYZW)
+         + materialOffsets.capacity() * sizeof(PMXMaterialMorphOffset)
+         + morphIndices.capacity() * sizeof(int)
+         + morphWeights.capacity() * sizeof(float)
+         + impulseOffsets.capacity() * sizeof(PMXImpulseMorphOffset);
+}
+
+PMXPhysicsData::PMXPhysicsData(std::pmr::memory_resource *resource):
+    bodyNames(resource), bodyNamesEn(resource), bodyBones(resource), bodyGroups(resource),
+    groupMasks(resource), collisionMasks(resource), shapes(resource), shapeSizes(resource),
+    bodyPositions(resource), bodyRotations(resource), masses(resource),
+    linearDampings(resource), angularDampings(resource), restitutions(resource),
+    frictions(resource), physicsModes(resource),
+    jointNames(resource), jointNamesEn(resource), jointTypes(resource),
+    jointBodiesA(resource), jointBodiesB(resource), jointPositions(resource), jointRotations(resource),
+    translationLowers(resource), translationUppers(resource),
+    rotationLowers(resource), rotationUppers(resource),
+    translationSprings(resource), rotationSprings(resource),
+    bodyIslands(resource), jointIslands(resource), islandBodyOffsets(resource),
+    islandBodies(resource), islandJointOffsets(resource), islandJoints(resource) {}
+
+size_t PMXPhysicsData::byteSize() const {
+    return (bodyNames.capacity() + bodyNamesEn.capacity()
+            + jointNames.capacity() + jointNamesEn.capacity()) * sizeof(PMXTextBuf)
+         + (bodyGroups.capacity() + shapes.capacity() + physicsModes.capacity()
+            + jointTypes.capacity()) * sizeof(unsigned char)
+         + (groupMasks.capacity() + collisionMasks.capacity()) * sizeof(uint16_t)
+         + (shapeSizes.capacity() + bodyPositions.capacity() + bodyRotations.capacity()
+            + jointPositions.capacity() + jointRotations.capacity()
+            + translationLowers.capacity() + translationUppers.capacity()
+            + rotationLowers.capacity() + rotationUppers.capacity()
+            + translationSprings.capacity() + rotationSprings.capacity()) * sizeof(PMXFloat3XYZ)
+         + (masses.capacity() + linearDampings.capacity() + angularDampings.capacity()
+            + restitutions.capacity() + frictions.capacity()) * sizeof(float)
+         + (bodyBones.capacity() + jointBodiesA.capacity() + jointBodiesB.capacity()
+            + bodyIslands.capacity() + jointIslands.capacity()
+            + islandBodies.capacity() + islandJoints.capacity()) * sizeof(int)
+         + (islandBodyOffsets.capacity() + islandJointOffsets.capacity()) * sizeof(uint32_t);
+}
+
+void PMXModel::releaseFileBlock() {
+    if (surfaces.isView()) {
+        // keep only the index pages resident
+        size_t surfaceOffset = (const char *)surfaces.data() - fileBlock->data();
+        size_t surfaceBytes = surfaces.size() * sizeof(PMXSurface);
+        fileBlock->adviseDontNeed(0, surfaceOffset);
+        fileBlock->adviseDontNeed(surfaceOffset + surfaceBytes, fileSize);
+    }
+    fileBlock.reset();
+}
+
+PMXTextBuf PMXModel::readTextBuf(const char *buf) {
     PMXTextBuf result;
     int textLen = *(int *)buf;
     result.originTextLen = textLen;
     if (globals.encoding == TEXT_ENCODING_UTF8) {
         // encoding=0, UTF8
-        result.text = std::string(buf + sizeof(textLen), textLen);
+        result.text = strings.store(buf + sizeof(textLen), textLen);
     } else if (globals.encoding == TEXT_ENCODING_UTF16) {
         // convert UTF16 to UTF8
-        std::u16string u16Str((char16_t *)(buf + sizeof(textLen)), textLen / sizeof(char16_t));
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> cvt;
-        result.text = cvt.to_bytes(u16Str);
+        result.text = strings.storeUtf16((const char16_t *)(buf + sizeof(textLen)), textLen / sizeof(char16_t));
     } else {
-        throw std::runtime_error("Invalid text encoding");
+        throw PMXFormatError("Invalid text encoding", buf - fileBlock->data());
     }
     return result;
 }
 
+size_t PMXModel::skipTextBuf(const char *buf) {
+    size_t size = checkTextBuf(buf);
+    scannedTextLen += size - sizeof(int);
+    return size;
+}
+
+PMXFormatError::PMXFormatError(const std::string &message, size_t offset_):
+    std::runtime_error(message + " at offset " + std::to_string(offset_)), offset(offset_) {}
+
+void PMXModel::requireBytes(const char *buf, size_t bytes, const char *what) {
+    size_t offset = buf - fileBlock->data();
+    if (offset > fileSize || bytes > fileSize - offset) {
+        throw PMXFormatError(std::string("Truncated ") + what, offset);
+    }
+}
+
+int PMXModel::readCount(const char *buf, const char *what) {
+    requireBytes(buf, sizeof(int), what);
+    int count = *(int *)buf;
+    if (count < 0) {
+        throw PMXFormatError(std::string("Negative ") + what, buf - fileBlock->data());
+    }
+    return count;
+}
+
+size_t PMXModel::checkTextBuf(const char *buf) {
+    int textLen = readCount(buf, "text length");
+    requireBytes(buf + sizeof(textLen), textLen, "text");
+    return sizeof(textLen) + textLen;
+}
+
 #ifdef MODEL_PARSER_DEBUG
-void PMXModel::printVertex(PMXVertex vertex) {
-    std::cout << "pos: " << vertex.pos.x << " " << vertex.pos.y << " " << vertex.pos.z << std::endl;
-    std::cout << "norm: " << vertex.norm.x << " " << vertex.norm.y << " " << vertex.norm.z << std::endl;
-    std::cout << "UV: " << vertex.UV.u << " " << vertex.UV.v << std::endl;
-    std::cout << "boneDeformMethod: " << (unsigned)vertex.boneDeformMethod << std::endl;
-    if (vertex.boneDeformMethod == DEFORM_METHOD_SDEF) {
-        std::cout << "bone1: " << vertex.SDEF.boneIdx[0] << std::endl;
-        std::cout << "bone2: " << vertex.SDEF.boneIdx[1] << std::endl;
-        std::cout << "weight: " << vertex.SDEF.weight << std::endl;
-        std::cout << "C_x: " << vertex.SDEF.C.x
-                  << " C_y: " << vertex.SDEF.C.y
-                  << " C_z: " << vertex.SDEF.C.z << std::endl;
-        std::cout << "R0_x: " << vertex.SDEF.R0.x
-                  << " R0_y: " << vertex.SDEF.R0.y
-                  << " R0_z: " << vertex.SDEF.R0.z << std::endl;
-        std::cout << "R1_x: " << vertex.SDEF.R1.x
-                  << " R1_y: " << vertex.SDEF.R1.y
-                  << " R1_z: " << vertex.SDEF.R1.z << std::endl;
-    }
-    std::cout << "edgeSizeX: " << vertex.edgeSizeX << std::endl;
+void PMXModel::printVertex(size_t idx) {
+    const PMXFloat3XYZ &pos = vertices.getPos(idx), &norm = vertices.getNorm(idx);
+    const PMXFloat2UV &UV = vertices.getUV(idx);
+    std::cout << "pos: " << pos.x << " " << pos.y << " " << pos.z << std::endl;
+    std::cout << "norm: " << norm.x << " " << norm.y << " " << norm.z << std::endl;
+    std::cout << "UV: " << UV.u << " " << UV.v << std::endl;
+    std::cout << "boneDeformMethod: " << (unsigned)vertices.getDeformMethod(idx) << std::endl;
+    for (auto j = 0; j < vertices.getBoneNum(idx); j++) {
+        std::cout << "bone" << j + 1 << ": " << vertices.getBoneIdx(idx, j)
+                  << " weight: " << vertices.getBoneWeight(idx, j) << std::endl;
+    }
+    if (vertices.getDeformMethod(idx) == PMXVertexData::DEFORM_METHOD_SDEF) {
+        const PMXSDEFParams &SDEF = vertices.getSDEF(idx);
+        std::cout << "C_x: " << SDEF.C.x
+                  << " C_y: " << SDEF.C.y
+                  << " C_z: " << SDEF.C.z << std::endl;
+        std::cout << "R0_x: " << SDEF.R0.x
+                  << " R0_y: " << SDEF.R0.y
+                  << " R0_z: " << SDEF.R0.z << std::endl;
+        std::cout << "R1_x: " << SDEF.R1.x
+                  << " R1_y: " << SDEF.R1.y
+                  << " R1_z: " << SDEF.R1.z << std::endl;
+    }
+    std::cout << "edgeSizeX: " << vertices.getEdgeScale(idx) << std::endl;
 }
 #endif
 
-size_t PMXModel::readIdx(char *buf, size_t idxSize) {
+size_t PMXModel::readIdx(const char *buf, size_t idxSize) {
     switch (idxSize) {
         case 1: return (size_t)*(unsigned char*)buf;
         case 2: return (size_t)*(unsigned short*)buf;
         case 4: return (size_t)*(unsigned *)buf;
         default:
-            throw std::runtime_error("Invalid index size");
+            throw PMXFormatError("Invalid index size", buf - fileBlock->data());
     }
 }
 
-void PMXModel::readVertices(char *buf) {
-    size_t bufIdx = 0;
-    vertexNum = *(int *)(buf);
-    bufIdx += sizeof(vertexNum);
-    vertices.resize(vertexNum);
-    for (auto i = 0; i < vertexNum; i++) {
-        PMXVertex currVertex;
+// bone, texture, material, morph and rigid body indices are signed, -1 is none
+int PMXModel::readSignedIdx(const char *buf, size_t idxSize) {
+    switch (idxSize) {
+        case 1: return (int)*(signed char*)buf;
+        case 2: return (int)*(short*)buf;
+        case 4: return *(int *)buf;
+        default:
+            throw PMXFormatError("Invalid index size", buf - fileBlock->data());
+    }
+}
+
+template <typename Src, typename Dst>
+static void gatherIndices(const char *buf, size_t stride, size_t num, Dst *dst) {
+    for (size_t i = 0; i < num; i++, buf += stride) {
+        dst[i] = (Dst)*(const Src *)buf;
+    }
+}
 
-        currVertex.pos = *(PMXFloat3XYZ *)(buf + bufIdx);
-        bufIdx += sizeof(currVertex.pos);
-        currVertex.norm = *(PMXFloat3XYZ *)(buf + bufIdx);
-        bufIdx += sizeof(currVertex.norm);
-        currVertex.UV = *(PMXFloat2UV *)(buf + bufIdx);
-        bufIdx += sizeof(currVertex.UV);
+// the leading index of num records stride bytes apart, the size switch is taken once per run;
+// vertex indices are unsigned, signed destinations sign-extend like readSignedIdx
+void PMXModel::readIndices(const char *buf, size_t idxSize, size_t stride, size_t num, uint32_t *dst) {
+    switch (idxSize) {
+        case 1: return gatherIndices<unsigned char>(buf, stride, num, dst);
+        case 2: return gatherIndices<unsigned short>(buf, stride, num, dst);
+        case 4: return gatherIndices<unsigned>(buf, stride, num, dst);
+        default:
+            throw PMXFormatError("Invalid index size", buf - fileBlock->data());
+    }
+}
+
+void PMXModel::readIndices(const char *buf, size_t idxSize, size_t stride, size_t num, int *dst) {
+    switch (idxSize) {
+        case 1: return gatherIndices<signed char>(buf, stride, num, dst);
+        case 2: return gatherIndices<short>(buf, stride, num, dst);
+        case 4: return gatherIndices<int>(buf, stride, num, dst);
+        default:
+            throw PMXFormatError("Invalid index size", buf - fileBlock->data());
+    }
+}
+
+// a min/max reduction over a decoded index stream, instead of a check per field in the decode loop
+template <typename Idx>
+static bool indicesWithin(const Idx *indices, size_t num, int64_t lower, int64_t upper) {
+    if (num == 0) {
+        return true;
+    }
+    Idx minIdx = indices[0], maxIdx = indices[0];
+    for (size_t i = 1; i < num; i++) {
+        minIdx = std::min(minIdx, indices[i]);
+        maxIdx = std::max(maxIdx, indices[i]);
+    }
+    return (int64_t)minIdx >= lower && (int64_t)maxIdx < upper;
+}
+
+template <int idxSize>
+inline int PMXModel::readSignedIdxAs(const char *buf, size_t runtimeSize) {
+    if constexpr (idxSize == 1) {
+        return *(signed char *)buf;
+    } else if constexpr (idxSize == 2) {
+        return *(int16_t *)buf;
+    } else if constexpr (idxSize == 4) {
+        return *(int32_t *)buf;
+    } else {
+        return readSignedIdx(buf, runtimeSize);
+    }
+}
 
-        for (auto j = 0; j < globals.additionalUVNum; j++) {
-            currVertex.additionalUV[j] = *(PMXFloat4XYZW *)(buf + bufIdx);
-            bufIdx += sizeof(currVertex.additionalUV[j]);
+template <int boneIdxSize, int additionalUVNum>
+void PMXModel::decodeVertexChunk(const char *buf, const PMXVertexChunk &chunk) {
+    // compile time constants in the specialized versions
+    const size_t boneIdxStride = boneIdxSize ? boneIdxSize : globals.boneIdxSize;
+    const int UVNum = additionalUVNum >= 0 ? additionalUVNum : globals.additionalUVNum;
+    const bool wideBoneIdx = boneIdxSize ? boneIdxSize == 4 : vertices.wideBoneIdx;
+    size_t bufIdx = chunk.bufOffset;
+    uint32_t skinIdx = chunk.skinOffset;
+    uint32_t SDEFIdx = chunk.SDEFOffset;
+
+    auto readBone = [&](float weight) {
+        int boneIdx = readSignedIdxAs<boneIdxSize>(buf + bufIdx, boneIdxStride);
+        if (wideBoneIdx) {
+            vertices.boneIndices32[skinIdx] = boneIdx;
+        } else {
+            vertices.boneIndices16[skinIdx] = boneIdx;
         }
+        vertices.boneWeights[skinIdx] = weight;
+        skinIdx++;
+        bufIdx += boneIdxStride;
+    };
 
-        currVertex.boneDeformMethod = *(unsigned char *)(buf + bufIdx);
-        bufIdx += sizeof(currVertex.boneDeformMethod);
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+        vertices.skinOffsets[i] = skinIdx;
 
-        switch (currVertex.boneDeformMethod) {
-            case DEFORM_METHOD_BDEF1:
-                currVertex.BDEF1.boneIdx = readIdx(buf + bufIdx, globals.boneIdxSize);
-                bufIdx += globals.boneIdxSize;
+        vertices.positions[i] = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat3XYZ);
+        vertices.normals[i] = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat3XYZ);
+        vertices.UVs[i] = *(PMXFloat2UV *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat2UV);
+
+        for (auto j = 0; j < UVNum; j++) {
+            vertices.additionalUVs[(size_t)i * UVNum + j] = *(PMXFloat4XYZW *)(buf + bufIdx);
+            bufIdx += sizeof(PMXFloat4XYZW);
+        }
+
+        unsigned char boneDeformMethod = *(unsigned char *)(buf + bufIdx);
+        vertices.deformMethods[i] = boneDeformMethod;
+        bufIdx += sizeof(boneDeformMethod);
+
+        // deform methods were validated by the scan in readVertices
+        switch (boneDeformMethod) {
+            case PMXVertexData::DEFORM_METHOD_BDEF1:
+                readBone(1.0f);
                 break;
-            case DEFORM_METHOD_BDEF2:
-                for (auto j = 0; j < 2; j++) {
-                    currVertex.BDEF2.boneIdx[j] = readIdx(buf + bufIdx, globals.boneIdxSize);
-                    bufIdx += globals.boneIdxSize;
+            case PMXVertexData::DEFORM_METHOD_BDEF2:
+            case PMXVertexData::DEFORM_METHOD_SDEF: {
+                // weight follows both indices
+                float weight = *(float *)(buf + bufIdx + 2 * boneIdxStride);
+                readBone(weight);
+                readBone(1.0f - weight);
+                bufIdx += sizeof(weight);
+                if (boneDeformMethod == PMXVertexData::DEFORM_METHOD_SDEF) {
+                    vertices.SDEFVertices[SDEFIdx] = i;
+                    vertices.SDEFParams[SDEFIdx] = *(PMXSDEFParams *)(buf + bufIdx);
+                    SDEFIdx++;
+                    bufIdx += sizeof(PMXSDEFParams);
                 }
-                currVertex.BDEF2.weight = *(float *)(buf + bufIdx);
-                bufIdx += sizeof(currVertex.BDEF2.weight);
                 break;
-            case DEFORM_METHOD_BDEF4:
-                for (auto j = 0; j < 4; j++) {
-                    currVertex.BDEF4.boneIdx[j] = readIdx(buf + bufIdx, globals.boneIdxSize);
-                    bufIdx += globals.boneIdxSize;
-                }
+            }
+            case PMXVertexData::DEFORM_METHOD_BDEF4: {
+                const float *weights = (float *)(buf + bufIdx + 4 * boneIdxStride);
                 for (auto j = 0; j < 4; j++) {
-                    currVertex.BDEF4.weight[j] = *(float *)(buf + bufIdx);
-                    bufIdx += sizeof(currVertex.BDEF4.weight[j]);
-                }
-                break;
-            case DEFORM_METHOD_SDEF:
-                for (auto j = 0; j < 2; j++) {
-                    currVertex.SDEF.boneIdx[j] = readIdx(buf + bufIdx, globals.boneIdxSize);
-                    bufIdx += globals.boneIdxSize;
+                    readBone(weights[j]);
                 }
-                currVertex.SDEF.weight = *(float *)(buf + bufIdx);
-                bufIdx += sizeof(currVertex.SDEF.weight);
-                currVertex.SDEF.C = *(PMXFloat3XYZ *)(buf + bufIdx);
-                bufIdx += sizeof(currVertex.SDEF.C);
-                currVertex.SDEF.R0 = *(PMXFloat3XYZ *)(buf + bufIdx);
-                bufIdx += sizeof(currVertex.SDEF.R0);
-                currVertex.SDEF.R1 = *(PMXFloat3XYZ *)(buf + bufIdx);
-                bufIdx += sizeof(currVertex.SDEF.R1);
+                bufIdx += 4 * sizeof(float);
                 break;
-            default:
-                throw std::runtime_error("Invalid deform method");
+            }
         }
 
-        currVertex.edgeSizeX = *(float *)(buf + bufIdx);
-        bufIdx += sizeof(currVertex.edgeSizeX);
+        vertices.edgeScales[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+    }
+}
 
-        vertices[i] = currVertex;
+void (PMXModel::*PMXModel::selectVertexDecoder())(const char *, const PMXVertexChunk &) {
+    typedef void (PMXModel::*Decoder)(const char *, const PMXVertexChunk &);
+    if (loadFlags & LOAD_GENERIC_DECODERS) {
+        return &PMXModel::decodeVertexChunk<0, -1>;
     }
-    vertexRegionSize = bufIdx;
+    static const Decoder decoders[3][5] = {
+        {&PMXModel::decodeVertexChunk<1, 0>, &PMXModel::decodeVertexChunk<1, 1>, &PMXModel::decodeVertexChunk<1, 2>,
+         &PMXModel::decodeVertexChunk<1, 3>, &PMXModel::decodeVertexChunk<1, 4>},
+        {&PMXModel::decodeVertexChunk<2, 0>, &PMXModel::decodeVertexChunk<2, 1>, &PMXModel::decodeVertexChunk<2, 2>,
+         &PMXModel::decodeVertexChunk<2, 3>, &PMXModel::decodeVertexChunk<2, 4>},
+        {&PMXModel::decodeVertexChunk<4, 0>, &PMXModel::decodeVertexChunk<4, 1>, &PMXModel::decodeVertexChunk<4, 2>,
+         &PMXModel::decodeVertexChunk<4, 3>, &PMXModel::decodeVertexChunk<4, 4>},
+    };
+    // both were validated by scanVertices
+    int widthIdx = globals.boneIdxSize == 1 ? 0 : (globals.boneIdxSize == 2 ? 1 : 2);
+    return decoders[widthIdx][globals.additionalUVNum];
 }
 
-void PMXModel::readSurfaces(char *buf) {
+size_t PMXModel::scanVertices(const char *buf) {
+    static const int CHUNK_VERTEX_NUM = 16384;
+
     size_t bufIdx = 0;
-    surfaceNum = *(int *)(buf) / 3;
-    bufIdx += sizeof(surfaceNum);
-    surfaces.resize(surfaceNum);
-    for (auto i = 0; i < surfaceNum; i++) {
-        PMXSurface currSurface;
-        for (auto j = 0; j < 3; j++) {
-            currSurface.vertexIdx[j] = readIdx(buf + bufIdx, globals.vertexIdxSize);
-            bufIdx += globals.vertexIdxSize;
+    vertexNum = readCount(buf, "vertex count");
+    bufIdx += sizeof(vertexNum);
+
+    /*
+     * Records are variable length, so walk the deform method bytes to find
+     * where each chunk starts in the file and in the skinning streams.
+     */
+    const size_t fixedSize = 2 * sizeof(PMXFloat3XYZ) + sizeof(PMXFloat2UV)
+                           + globals.additionalUVNum * sizeof(PMXFloat4XYZW);
+    const size_t boneIdxSize = globals.boneIdxSize;
+    const size_t skinSize[4] = {
+        boneIdxSize,
+        2 * boneIdxSize + sizeof(float),
+        4 * boneIdxSize + 4 * sizeof(float),
+        2 * boneIdxSize + sizeof(float) + sizeof(PMXSDEFParams)
+    };
+    const uint32_t slotNum[4] = {1, 2, 4, 2};
+
+    vertexChunks.clear();
+    vertexSkinNum = 0;
+    vertexSDEFNum = 0;
+    for (auto i = 0; i < vertexNum; i++) {
+        if (i % CHUNK_VERTEX_NUM == 0) {
+            vertexChunks.push_back({i, std::min(i + CHUNK_VERTEX_NUM, vertexNum), bufIdx, vertexSkinNum, vertexSDEFNum});
+        }
+        requireBytes(buf + bufIdx, fixedSize + sizeof(unsigned char), "vertex");
+        unsigned char boneDeformMethod = *(unsigned char *)(buf + bufIdx + fixedSize);
+        if (boneDeformMethod > PMXVertexData::DEFORM_METHOD_SDEF) {
+            throw PMXFormatError("Invalid deform method", buf + bufIdx + fixedSize - fileBlock->data());
+        }
+        size_t recordSize = fixedSize + sizeof(boneDeformMethod) + skinSize[boneDeformMethod] + sizeof(float);
+        requireBytes(buf + bufIdx, recordSize, "vertex");
+        bufIdx += recordSize;
+        vertexSkinNum += slotNum[boneDeformMethod];
+        vertexSDEFNum += boneDeformMethod == PMXVertexData::DEFORM_METHOD_SDEF;
+    }
+    return bufIdx;
+}
+
+void PMXModel::readVertices(const char *buf) {
+    allocateVertices();
+    decodeVertexChunks(buf, selectVertexDecoder());
+    checkVertexBones();
+}
+
+void PMXModel::checkVertexBones() {
+    // one pass over the finished stream instead of a check per field
+    bool valid = vertices.wideBoneIdx
+               ? indicesWithin(vertices.boneIndices32.data(), vertices.boneIndices32.size(), -1, boneNum)
+               : indicesWithin(vertices.boneIndices16.data(), vertices.boneIndices16.size(), -1, boneNum);
+    if (!valid) {
+        throw PMXFormatError("Invalid vertex bone index", vertexSection.offset);
+    }
+}
+
+void PMXModel::allocateVertices() {
+    vertices.additionalUVNum = globals.additionalUVNum;
+    vertices.wideBoneIdx = globals.boneIdxSize == 4;
+    vertices.positions.resize(vertexNum);
+    vertices.normals.resize(vertexNum);
+    vertices.UVs.resize(vertexNum);
+    vertices.additionalUVs.resize((size_t)vertexNum * globals.additionalUVNum);
+    vertices.deformMethods.resize(vertexNum);
+    vertices.edgeScales.resize(vertexNum);
+    vertices.skinOffsets.resize(vertexNum + 1);
+    vertices.boneWeights.resize(vertexSkinNum);
+    if (vertices.wideBoneIdx) {
+        vertices.boneIndices32.resize(vertexSkinNum);
+    } else {
+        vertices.boneIndices16.resize(vertexSkinNum);
+    }
+    vertices.SDEFVertices.resize(vertexSDEFNum);
+    vertices.SDEFParams.resize(vertexSDEFNum);
+    vertices.skinOffsets[vertexNum] = vertexSkinNum;
+}
+
+void PMXModel::decodeVertexChunks(const char *buf, void (PMXModel::*decode)(const char *, const PMXVertexChunk &)) {
+    // chunks found by the scan pass write disjoint ranges of the streams
+    if (loadFlags & LOAD_SINGLE_THREADED) {
+        for (auto &chunk: vertexChunks) {
+            (this->*decode)(buf, chunk);
         }
-        surfaces[i] = currSurface;
+    } else {
+        ThreadPool::shared().parallelFor(vertexChunks.size(), [&](size_t i) {
+            (this->*decode)(buf, vertexChunks[i]);
+        });
+    }
+    vertexChunks = std::vector<PMXVertexChunk>();
+}
+
+size_t PMXModel::scanSurfaces(const char *buf) {
+    int indexNum = readCount(buf, "surface index count");
+    if (indexNum % 3 != 0) {
+        throw PMXFormatError("Surface index count is not a multiple of 3", buf - fileBlock->data());
     }
-    surfaceRegionSize = bufIdx;
+    surfaceNum = indexNum / 3;
+    requireBytes(buf + sizeof(indexNum), (size_t)indexNum * globals.vertexIdxSize, "surface section");
+    return sizeof(indexNum) + (size_t)indexNum * globals.vertexIdxSize;
 }
 
-void PMXModel::readTextures(char *buf) {
+void PMXModel::readSurfaces(const char *buf) {
+    const char *indexBuf = buf + sizeof(surfaceNum);
+    size_t indexNum = (size_t)surfaceNum * 3;
+    if (globals.vertexIdxSize == 4 && fileBlock->isMapped()
+        && (uintptr_t)indexBuf % alignof(PMXSurface) == 0) {
+        // already in element buffer layout, use the mapped pages directly
+        surfaces.view((const PMXSurface *)indexBuf, surfaceNum, fileBlock);
+    } else {
+        std::pmr::vector<PMXSurface> decoded(surfaceNum, &arena);
+        // PMXSurface is three packed indices, and data() may be null for an empty vector
+        widenIndices(indexBuf, globals.vertexIdxSize, indexNum, reinterpret_cast<uint32_t *>(decoded.data()));
+        surfaces.assign(std::move(decoded));
+    }
+    // a single vectorizable reduction, the element buffer must stay inside the vertices
+    const uint32_t *indices = reinterpret_cast<const uint32_t *>(surfaces.data());
+    uint32_t maxIdx = 0;
+    for (size_t i = 0; i < indexNum; i++) {
+        maxIdx = std::max(maxIdx, indices[i]);
+    }
+    if (indexNum > 0 && maxIdx >= (uint32_t)vertexNum) {
+        throw PMXFormatError("Invalid surface vertex index", surfaceSection.offset);
+    }
+}
+
+size_t PMXModel::scanTextures(const char *buf) {
     size_t bufIdx = 0;
-    textureNum = *(int *)(buf);
+    textureNum = readCount(buf, "texture count");
     bufIdx += sizeof(textureNum);
-    textures.resize(textureNum);
+    for (auto i = 0; i < textureNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+    }
+    return bufIdx;
+}
+
+void PMXModel::loadTextureImage(PMXTexture &texture) {
+    // read in image file, assume relative path
+    std::string path = fsys::path(filePath).remove_filename().append(std::string(texture.name.text)).string();
+    texture.width = texture.height = 0;
+    fipImage image;
+    if (fileSource) {
+        std::shared_ptr<MappedFile> imageFile;
+        try {
+            imageFile = fileSource->open(path);
+        } catch (std::runtime_error &e) {
+            texture.loadError = "Unable to load texture " + path;
+            return;
+        }
+        fipMemoryIO imageData((BYTE *)imageFile->data(), imageFile->size());
+        if (!image.loadFromMemory(imageData)) {
+            texture.loadError = "Unable to load texture " + path;
+            return;
+        }
+    } else if (!image.load(path.c_str())) {
+        texture.loadError = "Unable to load texture " + path;
+        return;
+    }
+    if (!image.convertTo32Bits()) {
+        texture.loadError = "Unable to convert texture " + path;
+        return;
+    }
+    texture.width = image.getWidth();
+    texture.height = image.getHeight();
+
+    // whole chain down to 1x1
+    size_t pixelNum = 0;
+    int levelWidth = texture.width, levelHeight = texture.height;
+    while (true) {
+        texture.levels.push_back({levelWidth, levelHeight, pixelNum * 4});
+        pixelNum += (size_t)levelWidth * levelHeight;
+        if (levelWidth == 1 && levelHeight == 1) {
+            break;
+        }
+        levelWidth = std::max(levelWidth / 2, 1);
+        levelHeight = std::max(levelHeight / 2, 1);
+    }
+    texture.pixels.resize(pixelNum * 4);
+
+    /*
+     * FreeImage stores rows bottom up in its native channel order. PMX UVs
+     * have their origin at the top left and OpenGL at the bottom left, so the
+     * top row goes first, swizzled to RGBA.
+     */
+    unsigned char *dst = texture.pixels.data();
+    for (auto y = 0; y < texture.height; y++) {
+        const BYTE *src = image.getScanLine(texture.height - 1 - y);
+        for (auto x = 0; x < texture.width; x++, src += 4, dst += 4) {
+            dst[0] = src[FI_RGBA_RED];
+            dst[1] = src[FI_RGBA_GREEN];
+            dst[2] = src[FI_RGBA_BLUE];
+            dst[3] = src[FI_RGBA_ALPHA];
+        }
+    }
+    // level 0 is copied, release FreeImage's copy before filtering
+    image.clear();
+    for (size_t i = 1; i < texture.levels.size(); i++) {
+        const PMXTextureLevel &src = texture.levels[i - 1];
+        downsampleRGBA8(texture.pixels.data() + src.offset, src.width, src.height,
+                        texture.pixels.data() + texture.levels[i].offset);
+    }
+}
+
+void PMXModel::readTextures(const char *buf) {
+    size_t bufIdx = sizeof(textureNum);
+    textures.reserve(textureNum);
+    for (auto i = 0; i < textureNum; i++) {
+        textures.emplace_back(&arena);
+    }
     for (auto i = 0; i < textureNum; i++) {
         textures[i].name = readTextBuf(buf + bufIdx);
         bufIdx += sizeof(textures[i].name.originTextLen) + textures[i].name.originTextLen;
-        // read in image file, assume relative path
-        std::string path = fsys::path(filePath).remove_filename().append(textures[i].name.text).string();
-        textures[i].image.load(path.c_str());
-        textures[i].image.flipVertical(); // OpenGL UV origin is the bottom left
-        textures[i].image.convertToRGBAF();
     }
-    textureRegionSize = bufIdx;
+    startTextureLoads();
 }
 
-void PMXModel::readMaterials(char *buf) {
+void PMXModel::startTextureLoads() {
+    // image decoding does not need the file, let it run alongside the other sections
+    for (auto &texture: textures) {
+        if (loadFlags & LOAD_SINGLE_THREADED) {
+            loadTextureImage(texture);
+        } else {
+            textureJobs.push_back(ThreadPool::shared().submit([this, &texture]() {
+                loadTextureImage(texture);
+            }));
+        }
+    }
+}
+
+void PMXModel::joinTextures() {
+    std::call_once(texturesJoined, [this]() {
+        for (size_t i = 0; i < textureJobs.size(); i++) {
+            try {
+                textureJobs[i].get();
+            } catch (std::exception &e) {
+                textures[i].loadError = e.what();
+            }
+        }
+        textureJobs.clear();
+    });
+}
+
+size_t PMXModel::scanMaterials(const char *buf) {
+    // name, English name, colors, flags and texture references
+    const size_t fixedSize = sizeof(PMXFloat4RGBA) + sizeof(PMXFloat3RGB) + sizeof(float) + sizeof(PMXFloat3RGB)
+                           + sizeof(unsigned char) + sizeof(PMXFloat4RGBA) + sizeof(float)
+                           + 2 * globals.textureIdxSize + sizeof(unsigned char);
     size_t bufIdx = 0;
-    materialNum = *(int *)(buf);
+    materialNum = readCount(buf, "material count");
     bufIdx += sizeof(materialNum);
+    for (auto i = 0; i < materialNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+        bufIdx += skipTextBuf(buf + bufIdx);
+        requireBytes(buf + bufIdx, fixedSize + sizeof(unsigned char), "material");
+        bufIdx += fixedSize;
+        unsigned char toonFlag = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(toonFlag);
+        if (toonFlag == TOON_NON_SHARED_FLAG) {
+            bufIdx += globals.textureIdxSize;
+        } else if (toonFlag == TOON_SHARED_FLAG) {
+            bufIdx += sizeof(unsigned char);
+        } else {
+            throw PMXFormatError("Invalid toon flag", buf + bufIdx - sizeof(toonFlag) - fileBlock->data());
+        }
+        bufIdx += skipTextBuf(buf + bufIdx);
+        readCount(buf + bufIdx, "material surface count");
+        bufIdx += sizeof(int);
+    }
+    return bufIdx;
+}
+
+void PMXModel::readMaterials(const char *buf) {
+    if (loadFlags & LOAD_GENERIC_DECODERS) {
+        decodeMaterials<0>(buf);
+        return;
+    }
+    switch (globals.textureIdxSize) {
+        case 1: decodeMaterials<1>(buf); break;
+        case 2: decodeMaterials<2>(buf); break;
+        case 4: decodeMaterials<4>(buf); break;
+        default:
+            throw PMXFormatError("Invalid index size", buf - fileBlock->data());
+    }
+}
+
+template <int textureIdxSize>
+void PMXModel::decodeMaterials(const char *buf) {
+    const size_t textureIdxStride = textureIdxSize ? textureIdxSize : globals.textureIdxSize;
+    size_t bufIdx = sizeof(materialNum);
     materials.resize(materialNum);
     for (auto i = 0; i < materialNum; i++) {
-        PMXMaterial currMaterial;
+        // the toon index the flag does not select stays 0
+        PMXMaterial currMaterial = PMXMaterial();
         // material name
         currMaterial.name = readTextBuf(buf + bufIdx);
         bufIdx += sizeof(currMaterial.name.originTextLen) + currMaterial.name.originTextLen;
@@ -212,10 +756,10 @@ void PMXModel::readMaterials(char *buf) {
         currMaterial.edgeSize = *(float *)(buf + bufIdx);
         bufIdx += sizeof(currMaterial.edgeSize);
 
-        currMaterial.textureIdx = readIdx(buf + bufIdx, globals.textureIdxSize);
-        bufIdx += sizeof(globals.textureIdxSize);
-        currMaterial.sphereTextureIdx = readIdx(buf + bufIdx, globals.textureIdxSize);
-        bufIdx += sizeof(globals.textureIdxSize);
+        currMaterial.textureIdx = readSignedIdxAs<textureIdxSize>(buf + bufIdx, textureIdxStride);
+        bufIdx += textureIdxStride;
+        currMaterial.sphereTextureIdx = readSignedIdxAs<textureIdxSize>(buf + bufIdx, textureIdxStride);
+        bufIdx += textureIdxStride;
 
         currMaterial.sphereMode = *(unsigned char *)(buf + bufIdx);
         bufIdx += sizeof(currMaterial.sphereMode);
@@ -223,13 +767,13 @@ void PMXModel::readMaterials(char *buf) {
         currMaterial.toonFlag = *(unsigned char *)(buf + bufIdx);
         bufIdx += sizeof(currMaterial.toonFlag);
         if (currMaterial.toonFlag == TOON_NON_SHARED_FLAG) {
-            currMaterial.toonTextureIdx = readIdx(buf + bufIdx, globals.textureIdxSize);
-            bufIdx += sizeof(globals.textureIdxSize);
+            currMaterial.toonTextureIdx = readSignedIdxAs<textureIdxSize>(buf + bufIdx, textureIdxStride);
+            bufIdx += textureIdxStride;
         } else if (currMaterial.toonFlag == TOON_SHARED_FLAG) {
             currMaterial.sharedToonTextureIdx = *(unsigned char *)(buf + bufIdx);
             bufIdx += sizeof(currMaterial.sharedToonTextureIdx);
         } else {
-            throw std::runtime_error("Invalid toon flag");
+            throw PMXFormatError("Invalid toon flag", buf + bufIdx - sizeof(currMaterial.toonFlag) - fileBlock->data());
         }
 
         currMaterial.memo = readTextBuf(buf + bufIdx);
@@ -240,10 +784,823 @@ void PMXModel::readMaterials(char *buf) {
 
         materials[i] = currMaterial;
     }
-    materialRegionSize = bufIdx;
+    checkMaterials();
+}
+
+void PMXModel::checkMaterials() {
+    // draw ranges and texture lookups index with these directly
+    int64_t materialSurfaceNum = 0;
+    for (auto &material: materials) {
+        materialSurfaceNum += material.surfaceNum;
+        // only the toon index the flag selects is read from the file
+        bool validToon = material.toonFlag == TOON_SHARED_FLAG
+                       ? material.sharedToonTextureIdx < 10
+                       : material.toonTextureIdx >= -1 && material.toonTextureIdx < textureNum;
+        if (material.textureIdx < -1 || material.textureIdx >= textureNum
+            || material.sphereTextureIdx < -1 || material.sphereTextureIdx >= textureNum || !validToon) {
+            throw PMXFormatError("Invalid material texture index", materialSection.offset);
+        }
+    }
+    if (materialSurfaceNum > surfaceNum) {
+        throw PMXFormatError("Materials cover more surfaces than the model has", materialSection.offset);
+    }
+}
+
+size_t PMXModel::scanBones(const char *buf) {
+    size_t bufIdx = 0;
+    boneNum = readCount(buf, "bone count");
+    bufIdx += sizeof(boneNum);
+    boneIKNum = 0;
+    boneIKLinkNum = 0;
+    for (auto i = 0; i < boneNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+        bufIdx += skipTextBuf(buf + bufIdx);
+        // position, parent, deform layer
+        const size_t headSize = sizeof(PMXFloat3XYZ) + globals.boneIdxSize + sizeof(int);
+        requireBytes(buf + bufIdx, headSize + sizeof(uint16_t), "bone");
+        bufIdx += headSize;
+        uint16_t flags = *(uint16_t *)(buf + bufIdx);
+        bufIdx += sizeof(flags);
+        // the flags fix the size of everything up to the IK links
+        size_t tailSize = (flags & PMXBoneData::BONE_FLAG_TAIL_BONE) ? globals.boneIdxSize : sizeof(PMXFloat3XYZ);
+        if (flags & (PMXBoneData::BONE_FLAG_ROTATION_GRANT | PMXBoneData::BONE_FLAG_TRANSLATION_GRANT)) {
+            tailSize += globals.boneIdxSize + sizeof(float);
+        }
+        if (flags & PMXBoneData::BONE_FLAG_FIXED_AXIS) {
+            tailSize += sizeof(PMXFloat3XYZ);
+        }
+        if (flags & PMXBoneData::BONE_FLAG_LOCAL_AXIS) {
+            tailSize += 2 * sizeof(PMXFloat3XYZ);
+        }
+        if (flags & PMXBoneData::BONE_FLAG_EXTERNAL_PARENT) {
+            tailSize += sizeof(int);
+        }
+        if (flags & PMXBoneData::BONE_FLAG_IK) {
+            // target, loop count, limit angle
+            tailSize += globals.boneIdxSize + sizeof(int) + sizeof(float);
+        }
+        requireBytes(buf + bufIdx, tailSize, "bone");
+        bufIdx += tailSize;
+        if (flags & PMXBoneData::BONE_FLAG_IK) {
+            int linkNum = readCount(buf + bufIdx, "IK link count");
+            bufIdx += sizeof(linkNum);
+            for (auto j = 0; j < linkNum; j++) {
+                requireBytes(buf + bufIdx, globals.boneIdxSize + sizeof(unsigned char), "IK link");
+                bufIdx += globals.boneIdxSize;
+                unsigned char limited = *(unsigned char *)(buf + bufIdx);
+                bufIdx += sizeof(limited);
+                if (limited) {
+                    requireBytes(buf + bufIdx, 2 * sizeof(PMXFloat3XYZ), "IK link");
+                    bufIdx += 2 * sizeof(PMXFloat3XYZ);
+                }
+            }
+            boneIKNum++;
+            boneIKLinkNum += linkNum;
+        }
+    }
+    return bufIdx;
+}
+
+void PMXModel::readBones(const char *buf) {
+    // stored as read, storeBones checks every bone index at once
+    auto readBoneIdx = [&](size_t &bufIdx) {
+        int boneIdx = readSignedIdx(buf + bufIdx, globals.boneIdxSize);
+        bufIdx += globals.boneIdxSize;
+        return boneIdx;
+    };
+
+    std::vector<PMXBoneRecord> records(boneNum);
+    std::vector<PMXBoneIKLink> links;
+    links.reserve(boneIKLinkNum);
+    size_t bufIdx = sizeof(boneNum);
+    for (auto &record: records) {
+        record = PMXBoneRecord();
+        record.name = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(record.name.originTextLen) + record.name.originTextLen;
+        record.nameEn = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(record.nameEn.originTextLen) + record.nameEn.originTextLen;
+        record.pos = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(record.pos);
+        record.parent = readBoneIdx(bufIdx);
+        record.deformLayer = *(int *)(buf + bufIdx);
+        bufIdx += sizeof(record.deformLayer);
+        record.flags = *(uint16_t *)(buf + bufIdx);
+        bufIdx += sizeof(record.flags);
+
+        record.tailBone = -1;
+        if (record.flags & PMXBoneData::BONE_FLAG_TAIL_BONE) {
+            record.tailBone = readBoneIdx(bufIdx);
+        } else {
+            record.tailOffset = *(PMXFloat3XYZ *)(buf + bufIdx);
+            bufIdx += sizeof(record.tailOffset);
+        }
+        record.grantParent = -1;
+        if (record.flags & (PMXBoneData::BONE_FLAG_ROTATION_GRANT | PMXBoneData::BONE_FLAG_TRANSLATION_GRANT)) {
+            record.grantParent = readBoneIdx(bufIdx);
+            record.grantRatio = *(float *)(buf + bufIdx);
+            bufIdx += sizeof(record.grantRatio);
+        }
+        if (record.flags & PMXBoneData::BONE_FLAG_FIXED_AXIS) {
+            record.fixedAxis = *(PMXFloat3XYZ *)(buf + bufIdx);
+            bufIdx += sizeof(record.fixedAxis);
+        }
+        if (record.flags & PMXBoneData::BONE_FLAG_LOCAL_AXIS) {
+            record.localAxisX = *(PMXFloat3XYZ *)(buf + bufIdx);
+            bufIdx += sizeof(record.localAxisX);
+            record.localAxisZ = *(PMXFloat3XYZ *)(buf + bufIdx);
+            bufIdx += sizeof(record.localAxisZ);
+        }
+        if (record.flags & PMXBoneData::BONE_FLAG_EXTERNAL_PARENT) {
+            record.externalParentKey = *(int *)(buf + bufIdx);
+            bufIdx += sizeof(record.externalParentKey);
+        }
+        record.IKTarget = -1;
+        record.IKLinkBegin = record.IKLinkEnd = links.size();
+        if (record.flags & PMXBoneData::BONE_FLAG_IK) {
+            record.IKTarget = readBoneIdx(bufIdx);
+            record.IKLoopNum = *(int *)(buf + bufIdx);
+            bufIdx += sizeof(record.IKLoopNum);
+            record.IKLimitAngle = *(float *)(buf + bufIdx);
+            bufIdx += sizeof(record.IKLimitAngle);
+            int linkNum = *(int *)(buf + bufIdx);
+            bufIdx += sizeof(linkNum);
+            for (auto j = 0; j < linkNum; j++) {
+                PMXBoneIKLink link = PMXBoneIKLink();
+                link.bone = readBoneIdx(bufIdx);
+                link.limited = *(unsigned char *)(buf + bufIdx);
+                bufIdx += sizeof(link.limited);
+                if (link.limited) {
+                    link.lower = *(PMXFloat3XYZ *)(buf + bufIdx);
+                    bufIdx += sizeof(link.lower);
+                    link.upper = *(PMXFloat3XYZ *)(buf + bufIdx);
+                    bufIdx += sizeof(link.upper);
+                }
+                links.push_back(link);
+            }
+            record.IKLinkEnd = links.size();
+        }
+    }
+    storeBones(records, links);
+}
+
+void PMXModel::storeBones(std::vector<PMXBoneRecord> &records, const std::vector<PMXBoneIKLink> &links) {
+    // one pass over the decoded indices instead of a check per field, everything below follows them
+    int minIdx = -1, maxIdx = -1;
+    for (auto &record: records) {
+        minIdx = std::min({minIdx, record.parent, record.tailBone, record.grantParent, record.IKTarget});
+        maxIdx = std::max({maxIdx, record.parent, record.tailBone, record.grantParent, record.IKTarget});
+    }
+    for (auto &link: links) {
+        minIdx = std::min(minIdx, link.bone);
+        maxIdx = std::max(maxIdx, link.bone);
+    }
+    if (minIdx < -1 || maxIdx >= boneNum) {
+        throw PMXFormatError("Invalid bone index", boneSection.offset);
+    }
+
+    for (auto &record: records) {
+        record.depth = -1;
+    }
+
+    // hierarchy depth, parents may come after their children in the file
+    std::vector<int> chain;
+    for (auto i = 0; i < boneNum; i++) {
+        int curr = i;
+        while (curr >= 0 && records[curr].depth < 0) {
+            if ((int)chain.size() == boneNum) {
+                throw PMXFormatError("Bone hierarchy has a cycle", boneSection.offset);
+            }
+            chain.push_back(curr);
+            curr = records[curr].parent;
+        }
+        int depth = curr < 0 ? 0 : records[curr].depth + 1;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            records[*it].depth = depth++;
+        }
+        chain.clear();
+    }
+
+    // evaluation order
+    PMXBoneData &data = bones;
+    data.fileIdx.resize(boneNum);
+    for (auto i = 0; i < boneNum; i++) {
+        data.fileIdx[i] = i;
+    }
+    auto afterPhysics = [&](int i) {
+        return (records[i].flags & PMXBoneData::BONE_FLAG_AFTER_PHYSICS) != 0;
+    };
+    std::stable_sort(data.fileIdx.begin(), data.fileIdx.end(), [&](int a, int b) {
+        if (afterPhysics(a) != afterPhysics(b)) {
+            return afterPhysics(b);
+        }
+        if (records[a].deformLayer != records[b].deformLayer) {
+            return records[a].deformLayer < records[b].deformLayer;
+        }
+        return records[a].depth < records[b].depth;
+    });
+    data.sortedIdx.resize(boneNum);
+    for (auto i = 0; i < boneNum; i++) {
+        data.sortedIdx[data.fileIdx[i]] = i;
+    }
+    auto remap = [&](int fileBoneIdx) {
+        return data.getSortedIdx(fileBoneIdx);
+    };
+
+    data.names.resize(boneNum);
+    data.namesEn.resize(boneNum);
+    data.positions.resize(boneNum);
+    data.parents.resize(boneNum);
+    data.deformLayers.resize(boneNum);
+    data.flags.resize(boneNum);
+    data.tailOffsets.resize(boneNum);
+    data.tailBones.resize(boneNum);
+    data.grantParents.resize(boneNum);
+    data.grantRatios.resize(boneNum);
+    data.fixedAxes.resize(boneNum);
+    data.localAxesX.resize(boneNum);
+    data.localAxesZ.resize(boneNum);
+    data.externalParentKeys.resize(boneNum);
+    data.IKBones.reserve(boneIKNum);
+    data.IKTargets.reserve(boneIKNum);
+    data.IKLoopNums.reserve(boneIKNum);
+    data.IKLimitAngles.reserve(boneIKNum);
+    data.IKLinkOffsets.reserve(boneIKNum + 1);
+    data.IKLinkBones.reserve(boneIKLinkNum);
+    data.IKLinkLimited.reserve(boneIKLinkNum);
+    data.IKLinkLowers.reserve(boneIKLinkNum);
+    data.IKLinkUppers.reserve(boneIKLinkNum);
+    data.IKLinkOffsets.push_back(0);
+    data.afterPhysicsBegin = boneNum;
+    for (auto i = 0; i < boneNum; i++) {
+        const PMXBoneRecord &record = records[data.fileIdx[i]];
+        data.names[i] = record.name;
+        data.namesEn[i] = record.nameEn;
+        data.positions[i] = record.pos;
+        data.parents[i] = remap(record.parent);
+        data.deformLayers[i] = record.deformLayer;
+        data.flags[i] = record.flags;
+        data.tailOffsets[i] = record.tailOffset;
+        data.tailBones[i] = remap(record.tailBone);
+        data.grantParents[i] = remap(record.grantParent);
+        data.grantRatios[i] = record.grantRatio;
+        data.fixedAxes[i] = record.fixedAxis;
+        data.localAxesX[i] = record.localAxisX;
+        data.localAxesZ[i] = record.localAxisZ;
+        data.externalParentKeys[i] = record.externalParentKey;
+        if ((record.flags & PMXBoneData::BONE_FLAG_AFTER_PHYSICS) && data.afterPhysicsBegin == boneNum) {
+            data.afterPhysicsBegin = i;
+        }
+        if (record.flags & PMXBoneData::BONE_FLAG_IK) {
+            data.IKBones.push_back(i);
+            data.IKTargets.push_back(remap(record.IKTarget));
+            data.IKLoopNums.push_back(record.IKLoopNum);
+            data.IKLimitAngles.push_back(record.IKLimitAngle);
+            for (auto j = record.IKLinkBegin; j < record.IKLinkEnd; j++) {
+                data.IKLinkBones.push_back(remap(links[j].bone));
+                data.IKLinkLimited.push_back(links[j].limited);
+                data.IKLinkLowers.push_back(links[j].lower);
+                data.IKLinkUppers.push_back(links[j].upper);
+            }
+            data.IKLinkOffsets.push_back(data.IKLinkBones.size());
+        }
+    }
+}
+
+size_t PMXModel::morphOffsetSize(int type) {
+    switch (type) {
+        case PMXMorphData::MORPH_TYPE_GROUP:
+        case PMXMorphData::MORPH_TYPE_FLIP:
+            return globals.morphIdxSize + sizeof(float);
+        case PMXMorphData::MORPH_TYPE_VERTEX:
+            return globals.vertexIdxSize + sizeof(PMXFloat3XYZ);
+        case PMXMorphData::MORPH_TYPE_BONE:
+            return globals.boneIdxSize + sizeof(PMXFloat3XYZ) + sizeof(PMXFloat4XYZW);
+        case PMXMorphData::MORPH_TYPE_UV:
+        case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV1:
+        case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV2:
+        case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV3:
+        case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV4:
+            return globals.vertexIdxSize + sizeof(PMXFloat4XYZW);
+        case PMXMorphData::MORPH_TYPE_MATERIAL:
+            // operation, diffuse, specular, specularX, ambient, edge color, edge size, 3 texture factors
+            return globals.materialIdxSize + sizeof(unsigned char) + sizeof(PMXFloat4RGBA)
+                 + sizeof(PMXFloat3RGB) + sizeof(float) + sizeof(PMXFloat3RGB)
+                 + sizeof(PMXFloat4RGBA) + sizeof(float) + 3 * sizeof(PMXFloat4RGBA);
+        case PMXMorphData::MORPH_TYPE_IMPULSE:
+            return globals.rigidIdxSize + sizeof(unsigned char) + 2 * sizeof(PMXFloat3XYZ);
+        default:
+            // the scan rejects unknown types before anything asks for their size
+            throw PMXFormatError("Invalid morph type", morphSection.offset);
+    }
+}
+
+size_t PMXModel::scanMorphs(const char *buf) {
+    size_t bufIdx = 0;
+    morphNum = readCount(buf, "morph count");
+    bufIdx += sizeof(morphNum);
+    std::fill(std::begin(morphOffsetNums), std::end(morphOffsetNums), 0);
+    for (auto i = 0; i < morphNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+        bufIdx += skipTextBuf(buf + bufIdx);
+        // panel
+        requireBytes(buf + bufIdx, 2 * sizeof(unsigned char), "morph");
+        bufIdx += sizeof(unsigned char);
+        unsigned char type = *(unsigned char *)(buf + bufIdx);
+        if (type > PMXMorphData::MORPH_TYPE_IMPULSE) {
+            throw PMXFormatError("Invalid morph type", buf + bufIdx - fileBlock->data());
+        }
+        bufIdx += sizeof(type);
+        int offsetNum = readCount(buf + bufIdx, "morph offset count");
+        bufIdx += sizeof(offsetNum);
+        requireBytes(buf + bufIdx, (size_t)offsetNum * morphOffsetSize(type), "morph offsets");
+        bufIdx += (size_t)offsetNum * morphOffsetSize(type);
+        morphOffsetNums[type] += offsetNum;
+    }
+    return bufIdx;
+}
+
+void PMXModel::readMorphs(const char *buf) {
+    PMXMorphData &data = morphs;
+    data.names.resize(morphNum);
+    data.namesEn.resize(morphNum);
+    data.panels.resize(morphNum);
+    data.types.resize(morphNum);
+    data.offsetBegins.resize(morphNum);
+    data.offsetNums.resize(morphNum);
+    uint32_t UVOffsetNum = 0;
+    for (auto type = PMXMorphData::MORPH_TYPE_UV; type <= PMXMorphData::MORPH_TYPE_ADDITIONAL_UV4; type++) {
+        UVOffsetNum += morphOffsetNums[type];
+    }
+    data.vertexIndices.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX]);
+    data.positionDeltas.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX]);
+    data.UVVertexIndices.reserve(UVOffsetNum);
+    data.UVDeltas.reserve(UVOffsetNum);
+    data.boneIndices.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_BONE]);
+    data.boneTranslations.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_BONE]);
+    data.boneRotations.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_BONE]);
+    data.materialOffsets.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_MATERIAL]);
+    data.morphIndices.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_GROUP]
+                              + morphOffsetNums[PMXMorphData::MORPH_TYPE_FLIP]);
+    data.morphWeights.reserve(data.morphIndices.capacity());
+    data.impulseOffsets.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_IMPULSE]);
+
+    // index runs are read as stored and checked by checkMorphIndices once the section is decoded
+    auto appendIndices = [&](auto &indices, const char *offsetBuf, size_t idxSize, size_t offsetSize, int offsetNum) {
+        size_t begin = indices.size();
+        indices.resize(begin + offsetNum);
+        readIndices(offsetBuf, idxSize, offsetSize, offsetNum, indices.data() + begin);
+    };
+    // material and impulse indices sit inside their offset structs
+    std::vector<int> runIndices;
+
+    // group offsets as stored, flattened once every morph type is known
+    std::vector<int> groupMorphIndices;
+    std::vector<float> groupMorphWeights;
+    groupMorphIndices.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_GROUP]);
+    groupMorphWeights.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_GROUP]);
+
+    size_t bufIdx = sizeof(morphNum);
+    for (auto i = 0; i < morphNum; i++) {
+        PMXTextBuf name = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(name.originTextLen) + name.originTextLen;
+        data.names[i] = name;
+        PMXTextBuf nameEn = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(nameEn.originTextLen) + nameEn.originTextLen;
+        data.namesEn[i] = nameEn;
+        data.panels[i] = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(unsigned char);
+        unsigned char type = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(type);
+        data.types[i] = type;
+        int offsetNum = *(int *)(buf + bufIdx);
+        bufIdx += sizeof(offsetNum);
+        data.offsetNums[i] = offsetNum;
+
+        // every offset of a morph has the same fixed size
+        const size_t offsetSize = morphOffsetSize(type);
+        const char *offsetBuf = buf + bufIdx;
+        bufIdx += (size_t)offsetNum * offsetSize;
+        switch (type) {
+            case PMXMorphData::MORPH_TYPE_VERTEX:
+                data.offsetBegins[i] = data.vertexIndices.size();
+                appendIndices(data.vertexIndices, offsetBuf, globals.vertexIdxSize, offsetSize, offsetNum);
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    data.positionDeltas.push_back(*(PMXFloat3XYZ *)(offsetBuf + globals.vertexIdxSize));
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_UV:
+            case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV1:
+            case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV2:
+            case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV3:
+            case PMXMorphData::MORPH_TYPE_ADDITIONAL_UV4:
+                data.offsetBegins[i] = data.UVVertexIndices.size();
+                appendIndices(data.UVVertexIndices, offsetBuf, globals.vertexIdxSize, offsetSize, offsetNum);
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    data.UVDeltas.push_back(*(PMXFloat4XYZW *)(offsetBuf + globals.vertexIdxSize));
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_BONE:
+                data.offsetBegins[i] = data.boneIndices.size();
+                appendIndices(data.boneIndices, offsetBuf, globals.boneIdxSize, offsetSize, offsetNum);
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    const char *valueBuf = offsetBuf + globals.boneIdxSize;
+                    data.boneTranslations.push_back(*(PMXFloat3XYZ *)valueBuf);
+                    data.boneRotations.push_back(*(PMXFloat4XYZW *)(valueBuf + sizeof(PMXFloat3XYZ)));
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_MATERIAL:
+                data.offsetBegins[i] = data.materialOffsets.size();
+                runIndices.resize(offsetNum);
+                readIndices(offsetBuf, globals.materialIdxSize, offsetSize, offsetNum, runIndices.data());
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    PMXMaterialMorphOffset offset;
+                    size_t valueIdx = 0;
+                    offset.materialIdx = runIndices[j];
+                    valueIdx += globals.materialIdxSize;
+                    offset.operation = *(unsigned char *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.operation);
+                    offset.diffuse = *(PMXFloat4RGBA *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.diffuse);
+                    offset.specular = *(PMXFloat3RGB *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.specular);
+                    offset.specularX = *(float *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.specularX);
+                    offset.ambient = *(PMXFloat3RGB *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.ambient);
+                    offset.edgeColor = *(PMXFloat4RGBA *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.edgeColor);
+                    offset.edgeSize = *(float *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.edgeSize);
+                    offset.textureFactor = *(PMXFloat4RGBA *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.textureFactor);
+                    offset.sphereTextureFactor = *(PMXFloat4RGBA *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.sphereTextureFactor);
+                    offset.toonTextureFactor = *(PMXFloat4RGBA *)(offsetBuf + valueIdx);
+                    data.materialOffsets.push_back(offset);
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_GROUP:
+                data.offsetBegins[i] = groupMorphIndices.size();
+                appendIndices(groupMorphIndices, offsetBuf, globals.morphIdxSize, offsetSize, offsetNum);
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    groupMorphWeights.push_back(*(float *)(offsetBuf + globals.morphIdxSize));
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_FLIP:
+                data.offsetBegins[i] = data.morphIndices.size();
+                appendIndices(data.morphIndices, offsetBuf, globals.morphIdxSize, offsetSize, offsetNum);
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    data.morphWeights.push_back(*(float *)(offsetBuf + globals.morphIdxSize));
+                }
+                break;
+            case PMXMorphData::MORPH_TYPE_IMPULSE:
+                data.offsetBegins[i] = data.impulseOffsets.size();
+                runIndices.resize(offsetNum);
+                readIndices(offsetBuf, globals.rigidIdxSize, offsetSize, offsetNum, runIndices.data());
+                for (auto j = 0; j < offsetNum; j++, offsetBuf += offsetSize) {
+                    PMXImpulseMorphOffset offset;
+                    size_t valueIdx = 0;
+                    offset.rigidIdx = runIndices[j];
+                    valueIdx += globals.rigidIdxSize;
+                    offset.local = *(unsigned char *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.local);
+                    offset.velocity = *(PMXFloat3XYZ *)(offsetBuf + valueIdx);
+                    valueIdx += sizeof(offset.velocity);
+                    offset.torque = *(PMXFloat3XYZ *)(offsetBuf + valueIdx);
+                    data.impulseOffsets.push_back(offset);
+                }
+                break;
+        }
+    }
+    checkMorphIndices(groupMorphIndices);
+
+    /*
+     * Flatten group morphs into (morph, weight) lists of non-group morphs.
+     * Groups of groups are not allowed by the spec but are expanded anyway,
+     * multiplying the weights along the way.
+     */
+    std::vector<unsigned char> expanding(morphNum, 0);
+    std::vector<std::pair<int, float>> flattened;
+    std::function<void(int, float)> expand = [&](int morphIdx, float weight) {
+        if (data.types[morphIdx] != PMXMorphData::MORPH_TYPE_GROUP) {
+            for (auto &entry: flattened) {
+                if (entry.first == morphIdx) {
+                    entry.second += weight;
+                    return;
+                }
+            }
+            flattened.emplace_back(morphIdx, weight);
+            return;
+        }
+        if (expanding[morphIdx]) {
+            throw PMXFormatError("Group morph contains itself", morphSection.offset);
+        }
+        expanding[morphIdx] = 1;
+        uint32_t begin = data.offsetBegins[morphIdx];
+        for (uint32_t j = begin; j < begin + data.offsetNums[morphIdx]; j++) {
+            expand(groupMorphIndices[j], weight * groupMorphWeights[j]);
+        }
+        expanding[morphIdx] = 0;
+    };
+    std::vector<uint32_t> flattenedBegins(morphNum), flattenedNums(morphNum);
+    for (auto i = 0; i < morphNum; i++) {
+        if (data.types[i] != PMXMorphData::MORPH_TYPE_GROUP) {
+            continue;
+        }
+        flattened.clear();
+        expand(i, 1.0f);
+        flattenedBegins[i] = data.morphIndices.size();
+        flattenedNums[i] = flattened.size();
+        for (auto &entry: flattened) {
+            data.morphIndices.push_back(entry.first);
+            data.morphWeights.push_back(entry.second);
+        }
+    }
+    // nested groups read the stored offsets above, so switch over afterwards
+    for (auto i = 0; i < morphNum; i++) {
+        if (data.types[i] == PMXMorphData::MORPH_TYPE_GROUP) {
+            data.offsetBegins[i] = flattenedBegins[i];
+            data.offsetNums[i] = flattenedNums[i];
+        }
+    }
+}
+
+void PMXModel::checkMorphIndices(const std::vector<int> &groupMorphIndices) {
+    // one reduction per index stream, group morphs are only stored when flattening
+    PMXMorphData &data = morphs;
+    if (!indicesWithin(data.vertexIndices.data(), data.vertexIndices.size(), 0, vertexNum)
+        || !indicesWithin(data.UVVertexIndices.data(), data.UVVertexIndices.size(), 0, vertexNum)) {
+        throw PMXFormatError("Invalid morph vertex index", morphSection.offset);
+    }
+    if (!indicesWithin(data.boneIndices.data(), data.boneIndices.size(), -1, boneNum)) {
+        throw PMXFormatError("Invalid morph bone index", morphSection.offset);
+    }
+    int minIdx = -1, maxIdx = -1;
+    for (auto &offset: data.materialOffsets) {
+        minIdx = std::min(minIdx, offset.materialIdx);
+        maxIdx = std::max(maxIdx, offset.materialIdx);
+    }
+    if (minIdx < -1 || maxIdx >= materialNum) {
+        throw PMXFormatError("Invalid morph material index", morphSection.offset);
+    }
+    if (!indicesWithin(data.morphIndices.data(), data.morphIndices.size(), 0, morphNum)
+        || !indicesWithin(groupMorphIndices.data(), groupMorphIndices.size(), 0, morphNum)) {
+        throw PMXFormatError("Invalid morph index", morphSection.offset);
+    }
+}
+
+size_t PMXModel::scanDisplayFrames(const char *buf) {
+    size_t bufIdx = 0;
+    displayFrameNum = readCount(buf, "display frame count");
+    bufIdx += sizeof(displayFrameNum);
+    for (auto i = 0; i < displayFrameNum; i++) {
+        // names are never decoded, so they do not count as scanned text
+        bufIdx += checkTextBuf(buf + bufIdx);
+        bufIdx += checkTextBuf(buf + bufIdx);
+        // special frame flag
+        requireBytes(buf + bufIdx, sizeof(unsigned char), "display frame");
+        bufIdx += sizeof(unsigned char);
+        int elementNum = readCount(buf + bufIdx, "display frame element count");
+        bufIdx += sizeof(elementNum);
+        for (auto j = 0; j < elementNum; j++) {
+            requireBytes(buf + bufIdx, sizeof(unsigned char) + std::max(globals.boneIdxSize, globals.morphIdxSize),
+                         "display frame element");
+            unsigned char target = *(unsigned char *)(buf + bufIdx);
+            bufIdx += sizeof(target);
+            bufIdx += target == 0 ? globals.boneIdxSize : globals.morphIdxSize;
+        }
+    }
+    return bufIdx;
+}
+
+size_t PMXModel::scanRigidBodies(const char *buf) {
+    // bone, group, non-collision flags, shape, size, position, rotation,
+    // mass, damping (2), restitution, friction, physics mode
+    const size_t fixedSize = globals.boneIdxSize + sizeof(unsigned char) + sizeof(uint16_t)
+                           + sizeof(unsigned char) + 3 * sizeof(PMXFloat3XYZ)
+                           + 5 * sizeof(float) + sizeof(unsigned char);
+    size_t bufIdx = 0;
+    rigidBodyNum = readCount(buf, "rigid body count");
+    bufIdx += sizeof(rigidBodyNum);
+    for (auto i = 0; i < rigidBodyNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+        bufIdx += skipTextBuf(buf + bufIdx);
+        requireBytes(buf + bufIdx, fixedSize, "rigid body");
+        // the group byte sits at a fixed offset, the decoder shifts by it unchecked
+        if (*(unsigned char *)(buf + bufIdx + globals.boneIdxSize) >= 16) {
+            throw PMXFormatError("Invalid rigid body group", buf + bufIdx + globals.boneIdxSize - fileBlock->data());
+        }
+        bufIdx += fixedSize;
+    }
+    return bufIdx;
+}
+
+size_t PMXModel::scanJoints(const char *buf) {
+    // type, bodies A and B, position, rotation, limits (4), springs (2)
+    const size_t fixedSize = sizeof(unsigned char) + 2 * globals.rigidIdxSize + 8 * sizeof(PMXFloat3XYZ);
+    size_t bufIdx = 0;
+    jointNum = readCount(buf, "joint count");
+    bufIdx += sizeof(jointNum);
+    for (auto i = 0; i < jointNum; i++) {
+        bufIdx += skipTextBuf(buf + bufIdx);
+        bufIdx += skipTextBuf(buf + bufIdx);
+        requireBytes(buf + bufIdx, fixedSize, "joint");
+        bufIdx += fixedSize;
+    }
+    return bufIdx;
+}
+
+void PMXModel::readPhysics(const char *buf) {
+    PMXPhysicsData &data = physics;
+    size_t bufIdx = sizeof(rigidBodyNum);
+    data.bodyNames.resize(rigidBodyNum);
+    data.bodyNamesEn.resize(rigidBodyNum);
+    data.bodyBones.resize(rigidBodyNum);
+    data.bodyGroups.resize(rigidBodyNum);
+    data.groupMasks.resize(rigidBodyNum);
+    data.collisionMasks.resize(rigidBodyNum);
+    data.shapes.resize(rigidBodyNum);
+    data.shapeSizes.resize(rigidBodyNum);
+    data.bodyPositions.resize(rigidBodyNum);
+    data.bodyRotations.resize(rigidBodyNum);
+    data.masses.resize(rigidBodyNum);
+    data.linearDampings.resize(rigidBodyNum);
+    data.angularDampings.resize(rigidBodyNum);
+    data.restitutions.resize(rigidBodyNum);
+    data.frictions.resize(rigidBodyNum);
+    data.physicsModes.resize(rigidBodyNum);
+    for (auto i = 0; i < rigidBodyNum; i++) {
+        data.bodyNames[i] = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(data.bodyNames[i].originTextLen) + data.bodyNames[i].originTextLen;
+        data.bodyNamesEn[i] = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(data.bodyNamesEn[i].originTextLen) + data.bodyNamesEn[i].originTextLen;
+
+        data.bodyBones[i] = readSignedIdx(buf + bufIdx, globals.boneIdxSize);
+        bufIdx += globals.boneIdxSize;
+        unsigned char group = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(group);
+        data.bodyGroups[i] = group;
+        data.groupMasks[i] = 1 << group;
+        // the file lists the groups the body does not collide with
+        data.collisionMasks[i] = ~*(uint16_t *)(buf + bufIdx);
+        bufIdx += sizeof(uint16_t);
+
+        data.shapes[i] = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(unsigned char);
+        data.shapeSizes[i] = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat3XYZ);
+        data.bodyPositions[i] = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat3XYZ);
+        data.bodyRotations[i] = *(PMXFloat3XYZ *)(buf + bufIdx);
+        bufIdx += sizeof(PMXFloat3XYZ);
+
+        data.masses[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+        data.linearDampings[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+        data.angularDampings[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+        data.restitutions[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+        data.frictions[i] = *(float *)(buf + bufIdx);
+        bufIdx += sizeof(float);
+        data.physicsModes[i] = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(unsigned char);
+    }
+
+    bufIdx += sizeof(jointNum);
+    data.jointNames.resize(jointNum);
+    data.jointNamesEn.resize(jointNum);
+    data.jointTypes.resize(jointNum);
+    data.jointBodiesA.resize(jointNum);
+    data.jointBodiesB.resize(jointNum);
+    data.jointPositions.resize(jointNum);
+    data.jointRotations.resize(jointNum);
+    data.translationLowers.resize(jointNum);
+    data.translationUppers.resize(jointNum);
+    data.rotationLowers.resize(jointNum);
+    data.rotationUppers.resize(jointNum);
+    data.translationSprings.resize(jointNum);
+    data.rotationSprings.resize(jointNum);
+    auto readBodyIdx = [&](size_t &bufIdx) {
+        int bodyIdx = readSignedIdx(buf + bufIdx, globals.rigidIdxSize);
+        bufIdx += globals.rigidIdxSize;
+        return bodyIdx;
+    };
+    for (auto i = 0; i < jointNum; i++) {
+        data.jointNames[i] = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(data.jointNames[i].originTextLen) + data.jointNames[i].originTextLen;
+        data.jointNamesEn[i] = readTextBuf(buf + bufIdx);
+        bufIdx += sizeof(data.jointNamesEn[i].originTextLen) + data.jointNamesEn[i].originTextLen;
+
+        // PMX 2.1 joint types share the spring 6DOF layout
+        data.jointTypes[i] = *(unsigned char *)(buf + bufIdx);
+        bufIdx += sizeof(unsigned char);
+        data.jointBodiesA[i] = readBodyIdx(bufIdx);
+        data.jointBodiesB[i] = readBodyIdx(bufIdx);
+
+        PMXFloat3XYZ *vectors[] = {
+            &data.jointPositions[i], &data.jointRotations[i],
+            &data.translationLowers[i], &data.translationUppers[i],
+            &data.rotationLowers[i], &data.rotationUppers[i],
+            &data.translationSprings[i], &data.rotationSprings[i],
+        };
+        for (auto vector: vectors) {
+            *vector = *(PMXFloat3XYZ *)(buf + bufIdx);
+            bufIdx += sizeof(PMXFloat3XYZ);
+        }
+    }
+
+    checkPhysicsIndices();
+    buildPhysicsIslands();
+}
+
+void PMXModel::checkPhysicsIndices() {
+    // one reduction per index stream, the groups were checked by the scan
+    PMXPhysicsData &data = physics;
+    if (!indicesWithin(data.bodyBones.data(), data.bodyBones.size(), -1, boneNum)) {
+        throw PMXFormatError("Invalid rigid body bone index", physicsSection.offset);
+    }
+    if (!indicesWithin(data.jointBodiesA.data(), data.jointBodiesA.size(), -1, rigidBodyNum)
+        || !indicesWithin(data.jointBodiesB.data(), data.jointBodiesB.size(), -1, rigidBodyNum)) {
+        throw PMXFormatError("Invalid joint rigid body index", physicsSection.offset);
+    }
+}
+
+void PMXModel::buildPhysicsIslands() {
+    PMXPhysicsData &data = physics;
+    // union-find over the dynamic bodies, static bodies do not link islands
+    std::vector<int> roots(rigidBodyNum);
+    for (auto i = 0; i < rigidBodyNum; i++) {
+        roots[i] = i;
+    }
+    auto findRoot = [&](int i) {
+        while (roots[i] != i) {
+            roots[i] = roots[roots[i]];
+            i = roots[i];
+        }
+        return i;
+    };
+    auto isDynamic = [&](int i) {
+        return i >= 0 && data.physicsModes[i] != PMXPhysicsData::PHYSICS_MODE_STATIC;
+    };
+    for (auto i = 0; i < jointNum; i++) {
+        int a = data.jointBodiesA[i], b = data.jointBodiesB[i];
+        if (isDynamic(a) && isDynamic(b)) {
+            a = findRoot(a);
+            b = findRoot(b);
+            // the smaller index stays the root, islands come out in body order
+            roots[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // number the islands and bucket bodies and joints by island
+    std::vector<int> rootIslands(rigidBodyNum, -1);
+    int islandNum = 0;
+    data.bodyIslands.resize(rigidBodyNum);
+    for (auto i = 0; i < rigidBodyNum; i++) {
+        data.bodyIslands[i] = -1;
+        if (isDynamic(i)) {
+            int root = findRoot(i);
+            if (rootIslands[root] < 0) {
+                rootIslands[root] = islandNum++;
+            }
+            data.bodyIslands[i] = rootIslands[root];
+        }
+    }
+    data.jointIslands.resize(jointNum);
+    for (auto i = 0; i < jointNum; i++) {
+        int a = data.jointBodiesA[i], b = data.jointBodiesB[i];
+        data.jointIslands[i] = isDynamic(a) ? data.bodyIslands[a] : isDynamic(b) ? data.bodyIslands[b] : -1;
+    }
+    auto bucket = [islandNum](const std::pmr::vector<int> &islands,
+                              std::pmr::vector<uint32_t> &offsets, std::pmr::vector<int> &members) {
+        offsets.assign(islandNum + 1, 0);
+        for (auto island: islands) {
+            if (island >= 0) {
+                offsets[island + 1]++;
+            }
+        }
+        for (auto k = 0; k < islandNum; k++) {
+            offsets[k + 1] += offsets[k];
+        }
+        members.resize(offsets[islandNum]);
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < islands.size(); i++) {
+            if (islands[i] >= 0) {
+                members[next[islands[i]]++] = i;
+            }
+        }
+    };
+    bucket(data.bodyIslands, data.islandBodyOffsets, data.islandBodies);
+    bucket(data.jointIslands, data.islandJointOffsets, data.islandJoints);
 }
 
 void PMXModel::parseFile() {
+    if (fileSize >= 3 && memcmp(fileBlock->data(), "Pmd", 3) == 0) {
+        parsePMDFile();
+        return;
+    }
     size_t bufIdx = 0;
     /*
      * PMX header
@@ -252,24 +1609,41 @@ void PMXModel::parseFile() {
      * - PMX globals, including text encoding & uv & data field byte size
      */
 
+    requireBytes(fileBlock->data(), sizeof(MAGIC) + sizeof(ver) + sizeof(unsigned char), "PMX header");
     // check PMX magic
-    if (*(int *)(memBlock.get() + bufIdx) != MAGIC) {
-        throw std::runtime_error("Invalid PMX magic");
+    if (*(int *)(fileBlock->data() + bufIdx) != MAGIC) {
+        throw PMXFormatError("Invalid PMX magic", bufIdx);
     } else {
         bufIdx += sizeof(MAGIC);
     }
     // check PMX version
-    ver = *(float *)(memBlock.get() + bufIdx);
+    ver = *(float *)(fileBlock->data() + bufIdx);
     if (ver != 2.0 && ver != 2.1) {
-        throw std::runtime_error("Unsupported PMX version");
+        throw PMXFormatError("Unsupported PMX version", bufIdx);
     } else {
         bufIdx += sizeof(ver);
     }
-    // PMX globals, number should be fixed at 8
-    unsigned char globalNum = *(unsigned char *)(memBlock.get() + bufIdx);
+    // PMX globals, 8 of them in 2.0 and 2.1, later ones are skipped
+    unsigned char globalNum = *(unsigned char *)(fileBlock->data() + bufIdx);
     bufIdx += sizeof(globalNum);
-    globals = *(PMXGlobalStruct *)(memBlock.get() + bufIdx);
-    bufIdx += sizeof(globals);
+    if (globalNum < sizeof(globals)) {
+        throw PMXFormatError("Too few PMX globals", bufIdx - sizeof(globalNum));
+    }
+    requireBytes(fileBlock->data() + bufIdx, globalNum, "PMX globals");
+    globals = *(PMXGlobalStruct *)(fileBlock->data() + bufIdx);
+    if (globals.encoding != TEXT_ENCODING_UTF16 && globals.encoding != TEXT_ENCODING_UTF8) {
+        throw PMXFormatError("Invalid text encoding", bufIdx);
+    }
+    if (globals.additionalUVNum > 4) {
+        throw PMXFormatError("Invalid additional UV count", bufIdx + 1);
+    }
+    const unsigned char *idxSizes = &globals.vertexIdxSize;
+    for (auto i = 0; i < 6; i++) {
+        if (idxSizes[i] != 1 && idxSizes[i] != 2 && idxSizes[i] != 4) {
+            throw PMXFormatError("Invalid index size", bufIdx + 2 + i);
+        }
+    }
+    bufIdx += globalNum;
 
     /*
      * PMX model info
@@ -277,45 +1651,77 @@ void PMXModel::parseFile() {
      * - model comment (??, en)
      * Store text encoded as UTF8.
      */
-    PMXTextBuf modelNameBuf = readTextBuf(memBlock.get() + bufIdx);
+    checkTextBuf(fileBlock->data() + bufIdx);
+    PMXTextBuf modelNameBuf = readTextBuf(fileBlock->data() + bufIdx);
     modelName = modelNameBuf.text;
     bufIdx += sizeof(modelNameBuf.originTextLen) + modelNameBuf.originTextLen;
 
-    PMXTextBuf modelNameEnBuf = readTextBuf(memBlock.get() + bufIdx);
+    checkTextBuf(fileBlock->data() + bufIdx);
+    PMXTextBuf modelNameEnBuf = readTextBuf(fileBlock->data() + bufIdx);
     modelNameEn = modelNameEnBuf.text;
     bufIdx += sizeof(modelNameEnBuf.originTextLen) + modelNameEnBuf.originTextLen;
 
-    PMXTextBuf modelCommentBuf = readTextBuf(memBlock.get() + bufIdx);
+    checkTextBuf(fileBlock->data() + bufIdx);
+    PMXTextBuf modelCommentBuf = readTextBuf(fileBlock->data() + bufIdx);
     modelComment = modelCommentBuf.text;
     bufIdx += sizeof(modelCommentBuf.originTextLen) + modelCommentBuf.originTextLen;
 
-    PMXTextBuf modelCommentEnBuf = readTextBuf(memBlock.get() + bufIdx);
+    checkTextBuf(fileBlock->data() + bufIdx);
+    PMXTextBuf modelCommentEnBuf = readTextBuf(fileBlock->data() + bufIdx);
     modelCommentEn = modelCommentEnBuf.text;
     bufIdx += sizeof(modelCommentEnBuf.originTextLen) + modelCommentEnBuf.originTextLen;
 
     /*
-     * PMX vertices
+     * Locate the remaining sections, decoding happens in decodeSection
+     * - vertices
+     * - surfaces
+     * - textures
+     * - materials
+     * - bones
+     * - morphs
+     * - display frames (skipped)
+     * - rigid bodies and joints
      */
-    readVertices(memBlock.get() + bufIdx);
-    bufIdx += vertexRegionSize;
+    scannedTextLen = 0;
+    vertexSection.offset = bufIdx;
+    vertexSection.read = &PMXModel::readVertices;
+    vertexSection.size = scanVertices(fileBlock->data() + bufIdx);
+    bufIdx += vertexSection.size;
 
-    /*
-     * PMX surfaces
-     */
-    readSurfaces(memBlock.get() + bufIdx);
-    bufIdx += surfaceRegionSize;
+    surfaceSection.offset = bufIdx;
+    surfaceSection.read = &PMXModel::readSurfaces;
+    surfaceSection.size = scanSurfaces(fileBlock->data() + bufIdx);
+    bufIdx += surfaceSection.size;
 
-    /*
-     * PMX textures
-     */
-    readTextures(memBlock.get() + bufIdx);
-    bufIdx += textureRegionSize;
+    textureSection.offset = bufIdx;
+    textureSection.read = &PMXModel::readTextures;
+    textureSection.size = scanTextures(fileBlock->data() + bufIdx);
+    bufIdx += textureSection.size;
 
-    /*
-     * PMX materials
-     */
-    readMaterials(memBlock.get() + bufIdx);
-    bufIdx += materialRegionSize;
+    materialSection.offset = bufIdx;
+    materialSection.read = &PMXModel::readMaterials;
+    materialSection.size = scanMaterials(fileBlock->data() + bufIdx);
+    bufIdx += materialSection.size;
+
+    boneSection.offset = bufIdx;
+    boneSection.read = &PMXModel::readBones;
+    boneSection.size = scanBones(fileBlock->data() + bufIdx);
+    bufIdx += boneSection.size;
+
+    morphSection.offset = bufIdx;
+    morphSection.read = &PMXModel::readMorphs;
+    morphSection.size = scanMorphs(fileBlock->data() + bufIdx);
+    bufIdx += morphSection.size;
+
+    bufIdx += scanDisplayFrames(fileBlock->data() + bufIdx);
+
+    physicsSection.offset = bufIdx;
+    physicsSection.read = &PMXModel::readPhysics;
+    physicsSection.size = scanRigidBodies(fileBlock->data() + bufIdx);
+    physicsSection.size += scanJoints(fileBlock->data() + bufIdx + physicsSection.size);
+    bufIdx += physicsSection.size;
+
+    pendingSectionNum = 7;
 
 #ifdef MODEL_PARSER_DEBUG
         std::cout << "PMX version: " << ver << std::endl;
@@ -331,39 +1737,179 @@ void PMXModel::parseFile() {
         std::cout << "PMX modelComment:" << std::endl << modelComment << std::endl;
         std::cout << "PMX modelCommentEn:" << std::endl << modelCommentEn << std::endl;
         std::cout << "PMX vertexNum: " << vertexNum << std::endl;
-        std::cout << "PMX vertexRegionSize: " << vertexRegionSize << std::endl;
+        std::cout << "PMX vertexRegionSize: " << vertexSection.size << std::endl;
         /*std::cout << "PMX vertex #1: " << std::endl;
-        printVertex(vertices[0]);
+        printVertex(0);
         std::cout << "PMX vertex #2: " << std::endl;
-        printVertex(vertices[1]);*/
+        printVertex(1);*/
         std::cout << "PMX surfaceNum: " << surfaceNum << std::endl;
-        std::cout << "PMX surfaceRegionSize: " << surfaceRegionSize << std::endl;
+        std::cout << "PMX surfaceRegionSize: " << surfaceSection.size << std::endl;
         std::cout << "PMX textureNum: " << textureNum << std::endl;
-        std::cout << "PMX textureRegionSize: " << textureRegionSize << std::endl;
-        for (auto i = 0; i < textureNum; i++)
-            std::cout << textures[i].name.text << std::endl;
+        std::cout << "PMX textureRegionSize: " << textureSection.size << std::endl;
+        std::cout << "PMX materialNum: " << materialNum << std::endl;
+        std::cout << "PMX materialRegionSize: " << materialSection.size << std::endl;
+        std::cout << "PMX boneNum: " << boneNum << std::endl;
+        std::cout << "PMX boneRegionSize: " << boneSection.size << std::endl;
+        std::cout << "PMX morphNum: " << morphNum << std::endl;
+        std::cout << "PMX morphRegionSize: " << morphSection.size << std::endl;
+        std::cout << "PMX displayFrameNum: " << displayFrameNum << std::endl;
+        std::cout << "PMX rigidBodyNum: " << rigidBodyNum << std::endl;
+        std::cout << "PMX jointNum: " << jointNum << std::endl;
+        std::cout << "PMX physicsRegionSize: " << physicsSection.size << std::endl;
 #endif
 }
 
-PMXModel::PMXModel(std::string filePath_): filePath(filePath_) {
-    // read PMX file content into memory
+void PMXModel::decodeSection(PMXSection &section) {
+    std::call_once(section.decoded, [&]() {
+        (this->*section.read)(fileBlock->data() + section.offset);
+        // the last section to be decoded releases the file
+        if (--pendingSectionNum == 0) {
+            releaseFileBlock();
+        }
+    });
+}
+
+PMXModel::PMXModel(std::string filePath_, int loadFlags_): PMXModel(nullptr, filePath_, loadFlags_) {}
+
+PMXModel::PMXModel(std::shared_ptr<FileSource> fileSource_, std::string filePath_, int loadFlags_):
+    filePath(filePath_), fileSource(fileSource_), loadFlags(loadFlags_), strings(&arena), vertices(&arena),
+    surfaces(&arena), textures(&arena), materials(&arena), bones(&arena), morphs(&arena), physics(&arena) {
+    // map (or read) PMX file content into memory
     readFile();
-    // load PMX contents into class fields
+    // read the header and locate the sections
     parseFile();
+    // the counts are known now, size the arena so the sections share one block
+    arena.reserve(estimateDecodedSize());
+    try {
+        if (!(loadFlags & LOAD_LAZY)) {
+            // load PMX contents into class fields, the file is released after the last one
+            // start texture decodes first so they overlap with geometry parsing
+            decodeSection(textureSection);
+            getVertices();
+            getSurfaces();
+            getMaterials();
+            getBones();
+            getMorphs();
+            getPhysics();
+        }
+        // while the textures are still decoding
+        if (loadFlags & LOAD_WELD_VERTICES) {
+            weldVertices();
+        }
+        if (loadFlags & LOAD_OPTIMIZE_MESH) {
+            optimizeMesh();
+        }
+        if (!(loadFlags & LOAD_LAZY)) {
+            getTextures();
+        }
+    } catch (...) {
+        // no destructor runs for a half-constructed model, its texture jobs must not outlive it
+        waitTextureJobs();
+        throw;
+    }
+}
+
+void PMXModel::waitTextureJobs() {
+    for (auto &job: textureJobs) {
+        if (job.valid()) {
+            job.wait();
+        }
+    }
+}
+
+PMXModel::~PMXModel() {
+    // texture jobs write into this model
+    waitTextureJobs();
+}
+
+float PMXModel::getVersion() const {
+    return ver;
+}
+
+std::string_view PMXModel::getModelName() const {
+    return modelName;
+}
+
+std::string_view PMXModel::getModelNameEn() const {
+    return modelNameEn;
+}
+
+std::string_view PMXModel::getModelComment() const {
+    return modelComment;
+}
+
+std::string_view PMXModel::getModelCommentEn() const {
+    return modelCommentEn;
+}
+
+int PMXModel::getVertexNum() const {
+    return vertexNum;
 }
 
-std::vector<PMXVertex>& PMXModel::getVertices() {
+int PMXModel::getSurfaceNum() const {
+    return surfaceNum;
+}
+
+int PMXModel::getTextureNum() const {
+    return textureNum;
+}
+
+int PMXModel::getMaterialNum() const {
+    return materialNum;
+}
+
+int PMXModel::getBoneNum() const {
+    return boneNum;
+}
+
+int PMXModel::getMorphNum() const {
+    return morphNum;
+}
+
+int PMXModel::getRigidBodyNum() const {
+    return rigidBodyNum;
+}
+
+int PMXModel::getJointNum() const {
+    return jointNum;
+}
+
+PMXVertexData& PMXModel::getVertices() {
+    decodeSection(vertexSection);
     return vertices;
 }
 
-std::vector<PMXSurface>& PMXModel::getSurfaces() {
+PMXBuffer<PMXSurface>& PMXModel::getSurfaces() {
+    decodeSection(surfaceSection);
     return surfaces;
 }
 
-std::vector<PMXTexture>& PMXModel::getTextures() {
+std::pmr::vector<PMXTexture>& PMXModel::getTextures() {
+    decodeSection(textureSection);
+    joinTextures();
     return textures;
 }
 
-std::vector<PMXMaterial>& PMXModel::getMaterials() {
+std::pmr::vector<PMXMaterial>& PMXModel::getMaterials() {
+    decodeSection(materialSection);
     return materials;
 }
+
+PMXBoneData& PMXModel::getBones() {
+    decodeSection(boneSection);
+    return bones;
+}
+
+PMXMorphData& PMXModel::getMorphs() {
+    decodeSection(morphSection);
+    return morphs;
+}
+
+PMXPhysicsData& PMXModel::getPhysics() {
+    decodeSection(physicsSection);
+    return physics;
+}
+
+PMXArena& PMXModel::getArena() {
+    return arena;
+}
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <linmath.h>
+
+#include <mmd/mesh_optimizer.hpp>
+#include <mmd/model_loader.hpp>
+#include <mmd/parser.hpp>
+#include <mmd/render_data.hpp>
+
+namespace fsys = boost::filesystem;
+namespace po = boost::program_options;
+
+template <typename T>
+static void writeValue(std::ofstream &out, T value) {
+    out.write((const char *)&value, sizeof(value));
+}
+
+static void writeIdx(std::ofstream &out, unsigned value, int idxSize) {
+    switch (idxSize) {
+        case 1: writeValue<unsigned char>(out, value); break;
+        case 2: writeValue<unsigned short>(out, value); break;
+        default: writeValue<unsigned>(out, value); break;
+    }
+}
+
+static void writeText(std::ofstream &out, const std::string &text) {
+    writeValue<int>(out, text.size());
+    out.write(text.data(), text.size());
+}
+
+/*
+ * Write a texture-less PMX 2.0 file (UTF8 text) with the given vertex count,
+ * one triangle per vertex, a single material and a chain of bones, the
+ * bones listed children first. Deform methods cycle through
+ * BDEF1, BDEF2, BDEF4 and SDEF so that record sizes vary like in real models.
+ * Triangles only reference the vertices the vertex index width can address.
+ */
+static void writeSyntheticPMX(std::string path, int vertexNum, int boneIdxSize, int vertexIdxSize,
+                              int additionalUVNum = 0, int textureIdxSize = 1) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Unable to create synthetic PMX file");
+    }
+    const int boneNum = boneIdxSize == 1 ? 100 : 1000;
+    writeValue<int>(out, 0x20584d50);
+    writeValue<float>(out, 2.0f);
+    writeValue<unsigned char>(out, 8);
+    unsigned char globals[8] = {1, (unsigned char)additionalUVNum, (unsigned char)vertexIdxSize,
+                                (unsigned char)textureIdxSize, 1, (unsigned char)boneIdxSize, 1, 1};
+    out.write((const char *)globals, sizeof(globals));
+    writeText(out, "synthetic");
+    writeText(out, "synthetic");
+    writeText(out, "");
+    writeText(out, "");
+
+    writeValue<int>(out, vertexNum);
+    for (auto i = 0; i < vertexNum; i++) {
+        float attr[8] = {(float)i, (float)(i % 7), (float)(i % 13), 0.0f, 1.0f, 0.0f, 0.5f, 0.5f};
+        out.write((const char *)attr, sizeof(attr));
+        for (auto j = 0; j < additionalUVNum; j++) {
+            float UV[4] = {0.5f, 0.5f, 0.0f, 1.0f};
+            out.write((const char *)UV, sizeof(UV));
+        }
+        unsigned char deformMethod = i % 4;
+        writeValue<unsigned char>(out, deformMethod);
+        switch (deformMethod) {
+            case 0:
+                writeIdx(out, i % boneNum, boneIdxSize);
+                break;
+            case 1:
+            case 3:
+                writeIdx(out, i % boneNum, boneIdxSize);
+                writeIdx(out, (i + 1) % boneNum, boneIdxSize);
+                writeValue<float>(out, 0.25f);
+                if (deformMethod == 3) {
+                    float sdef[9] = {0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+                    out.write((const char *)sdef, sizeof(sdef));
+                }
+                break;
+            case 2:
+                for (auto j = 0; j < 4; j++) {
+                    writeIdx(out, (i + j) % boneNum, boneIdxSize);
+                }
+                for (auto j = 0; j < 4; j++) {
+                    writeValue<float>(out, 0.25f);
+                }
+                break;
+        }
+        writeValue<float>(out, 1.0f);
+    }
+
+    const int indexedNum = vertexIdxSize == 1 ? std::min(vertexNum, 255) : (vertexIdxSize == 2 ? std::min(vertexNum, 65535) : vertexNum);
+    writeValue<int>(out, vertexNum * 3);
+    for (auto i = 0; i < vertexNum; i++) {
+        writeIdx(out, i % indexedNum, vertexIdxSize);
+        writeIdx(out, (i + 1) % indexedNum, vertexIdxSize);
+        writeIdx(out, (i + 2) % indexedNum, vertexIdxSize);
+    }
+
+    writeValue<int>(out, 0);
+
+    writeValue<int>(out, 1);
+    writeText(out, "material");
+    writeText(out, "material");
+    float colors[11] = {1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.5f, 0.5f, 0.5f};
+    out.write((const char *)colors, sizeof(colors));
+    writeValue<unsigned char>(out, 0);
+    float edge[5] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f};
+    out.write((const char *)edge, sizeof(edge));
+    writeIdx(out, -1, textureIdxSize);
+    writeIdx(out, -1, textureIdxSize);
+    writeValue<unsigned char>(out, 0);
+    writeValue<unsigned char>(out, 1);
+    writeValue<unsigned char>(out, 0);
+    writeText(out, "");
+    writeValue<int>(out, vertexNum * 3);
+
+    writeValue<int>(out, boneNum);
+    for (auto i = 0; i < boneNum; i++) {
+        writeText(out, "bone");
+        writeText(out, "bone");
+        float pos[3] = {0.0f, (float)(boneNum - i), 0.0f};
+        out.write((const char *)pos, sizeof(pos));
+        writeIdx(out, i + 1 < boneNum ? i + 1 : -1, boneIdxSize);
+        writeValue<int>(out, 0);
+        writeValue<unsigned short>(out, 0x001e);
+        float tail[3] = {0.0f, 1.0f, 0.0f};
+        out.write((const char *)tail, sizeof(tail));
+    }
+
+    // no morphs, display frames, rigid bodies or joints
+    for (auto i = 0; i < 4; i++) {
+        writeValue<int>(out, 0);
+    }
+}
+
+static double timeLoad(std::string path, int loadFlags, int repeat) {
+    double totalMs = 0;
+    for (auto i = 0; i < repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        PMXModel model(path, loadFlags);
+        auto end = std::chrono::steady_clock::now();
+        totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    return totalMs / repeat;
+}
+
+static void benchLoad(std::string label, std::string path, int repeat) {
+    // warm the page cache so both paths start from the same state
+    timeLoad(path, PMXModel::LOAD_BUFFERED, 1);
+    double bufferedMs = timeLoad(path, PMXModel::LOAD_BUFFERED, repeat);
+    double mappedSerialMs = timeLoad(path, PMXModel::LOAD_SINGLE_THREADED, repeat);
+    double mappedMs = timeLoad(path, 0, repeat);
+    std::cout << label << " (" << fsys::file_size(path) << " bytes)" << std::endl;
+    std::cout << "  buffered:              " << bufferedMs << " ms" << std::endl;
+    std::cout << "  mmap, single-threaded: " << mappedSerialMs << " ms" << std::endl;
+    std::cout << "  mmap:                  " << mappedMs << " ms" << std::endl;
+}
+
+/*
+ * Specialized against generic record decoders for every bone and vertex
+ * index width, single-threaded so the decode cost is not hidden by the pool.
+ */
+static void benchIndexWidths(int vertexNum, int additionalUVNum, int repeat) {
+    const int widths[3] = {1, 2, 4};
+    std::cout << "index widths, " << vertexNum << " vertices, " << additionalUVNum << " additional UVs" << std::endl;
+    std::cout << "  bone vertex  specialized      generic  speedup" << std::endl;
+    for (auto boneIdxSize: widths) {
+        for (auto vertexIdxSize: widths) {
+            std::string path = (fsys::temp_directory_path() / fsys::unique_path("mmd-bench-%%%%%%%%.pmx")).string();
+            writeSyntheticPMX(path, vertexNum, boneIdxSize, vertexIdxSize, additionalUVNum, boneIdxSize);
+            timeLoad(path, PMXModel::LOAD_SINGLE_THREADED, 1);
+            double specializedMs = timeLoad(path, PMXModel::LOAD_SINGLE_THREADED, repeat);
+            double genericMs = timeLoad(path, PMXModel::LOAD_SINGLE_THREADED | PMXModel::LOAD_GENERIC_DECODERS, repeat);
+            fsys::remove(path);
+            printf("  %4d %6d %9.3f ms %9.3f ms %7.2fx\n", boneIdxSize, vertexIdxSize,
+                   specializedMs, genericMs, genericMs / specializedMs);
+        }
+    }
+}
+
+static float modelACMR(PMXModel &model) {
+    PMXBuffer<PMXSurface> &surfaces = model.getSurfaces();
+    return computeACMR(surfaces.empty() ? nullptr : surfaces.data()->vertexIdx, surfaces.size() * 3,
+                       model.getVertexNum());
+}
+
+// vertex cache efficiency of a model as exported and after LOAD_OPTIMIZE_MESH
+static void benchMeshOptimization(std::string path, int repeat) {
+    PMXModel original(path, PMXModel::LOAD_LAZY);
+    PMXModel optimized(path, PMXModel::LOAD_LAZY | PMXModel::LOAD_OPTIMIZE_MESH);
+    double plainMs = timeLoad(path, 0, repeat);
+    double optimizedMs = timeLoad(path, PMXModel::LOAD_OPTIMIZE_MESH, repeat);
+    std::cout << path << ", " << original.getSurfaceNum() << " triangles, "
+              << original.getMaterialNum() << " materials" << std::endl;
+    std::cout << "  ACMR (FIFO " << MESH_CACHE_SIZE << "): " << modelACMR(original)
+              << " -> " << modelACMR(optimized) << std::endl;
+    std::cout << "  load: " << plainMs << " ms -> " << optimizedMs << " ms" << std::endl;
+}
+
+// share of the full mesh drawn after meshlet culling, looking at the model from the front
+static void benchCulling(const PMXRenderData &data) {
+    const PMXFloat3XYZ &c = data.boundsCenter;
+    float r = data.boundsRadius;
+    // models face -z; the head is near the top of the bounds
+    struct View { const char *name; vec3 eye, target; } views[] = {
+        {"whole model", {c.x, c.y, c.z - 3 * r}, {c.x, c.y, c.z}},
+        {"upper body", {c.x, c.y + 0.4f * r, c.z - 1.0f * r}, {c.x, c.y + 0.4f * r, c.z}},
+        {"face close-up", {c.x, c.y + 0.75f * r, c.z - 0.3f * r}, {c.x, c.y + 0.75f * r, c.z}},
+    };
+    std::cout << "  " << data.meshlets.size() << " meshlets, level 0 drawn after culling:" << std::endl;
+    for (auto &v: views) {
+        mat4x4 view, proj, viewProj;
+        vec3 up = {0.0f, 1.0f, 0.0f};
+        mat4x4_look_at(view, v.eye, v.target, up);
+        mat4x4_perspective(proj, M_PI / 4, 16.0f / 9.0f, 0.1f, 1000.0f);
+        mat4x4_mul(viewProj, proj, view);
+        PMXCullView cullView = makeCullView(&viewProj[0][0], v.eye);
+        size_t drawnNum = 0, indexNum = 0;
+        for (size_t i = 0; i < data.getMaterialNum(); i++) {
+            const PMXDrawRange &drawRange = data.drawRanges[data.lodLevels[0].drawRangeOffset + i];
+            indexNum += drawRange.indexNum;
+            for (uint32_t j = 0; j < drawRange.meshletNum; j++) {
+                const PMXMeshlet &meshlet = data.meshlets[drawRange.meshletOffset + j];
+                drawnNum += isMeshletVisible(meshlet, cullView) ? meshlet.indexNum : 0;
+            }
+        }
+        printf("    %-14s %5.1f%%\n", v.name, 100.0 * drawnNum / std::max(indexNum, (size_t)1));
+    }
+}
+
+// triangles and error of each level of detail the render data carries
+static void benchLOD(std::string path, int repeat) {
+    PMXModel model(path, PMXModel::LOAD_LAZY | PMXModel::LOAD_OPTIMIZE_MESH);
+    std::shared_ptr<PMXRenderData> data;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < repeat; i++) {
+        data = PMXRenderData::fromModel(model);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << path << ", bounds radius " << data->boundsRadius << ", render data built in "
+              << std::chrono::duration<double, std::milli>(end - start).count() / repeat << " ms" << std::endl;
+    size_t materialNum = data->getMaterialNum();
+    for (size_t level = 0; level < data->lodLevels.size(); level++) {
+        size_t indexNum = 0;
+        for (size_t i = 0; i < materialNum; i++) {
+            indexNum += data->drawRanges[data->lodLevels[level].drawRangeOffset + i].indexNum;
+        }
+        printf("  LOD %zu: %8zu triangles, error %.5f\n", level, indexNum / 3, data->lodLevels[level].error);
+    }
+    benchCulling(*data);
+}
+
+// vertices weldVertices merges and the time it takes
+static void benchWeld(std::string path, float epsilon, int repeat) {
+    size_t removedNum = 0;
+    double weldMs = 0;
+    int vertexNum = 0;
+    for (auto i = 0; i < repeat; i++) {
+        PMXModel model(path, PMXModel::LOAD_LAZY);
+        vertexNum = model.getVertexNum();
+        model.getVertices();
+        model.getSurfaces();
+        model.getMorphs();
+        auto start = std::chrono::steady_clock::now();
+        removedNum = model.weldVertices(epsilon);
+        auto end = std::chrono::steady_clock::now();
+        weldMs += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    std::cout << path << ", weld epsilon " << epsilon << std::endl;
+    printf("  vertices: %d -> %zu (%.1f%% removed) in %.3f ms\n", vertexNum, vertexNum - removedNum,
+           100.0 * removedNum / std::max(vertexNum, 1), weldMs / repeat);
+}
+
+// validation of the packed vertex format: size and largest error against the float vertices
+static void benchPackedVertices(std::string path, int repeat) {
+    PMXModel model(path, PMXModel::LOAD_LAZY | PMXModel::LOAD_WELD_VERTICES | PMXModel::LOAD_OPTIMIZE_MESH);
+    std::shared_ptr<PMXRenderData> data = PMXRenderData::fromModel(model);
+    PMXPackedVertices packed;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < repeat; i++) {
+        packed = data->packVertices();
+    }
+    auto end = std::chrono::steady_clock::now();
+    PMXPackingError error = data->packingError(packed);
+    std::cout << path << ", " << data->vertices.size() << " vertices packed in "
+              << std::chrono::duration<double, std::milli>(end - start).count() / repeat << " ms" << std::endl;
+    std::cout << "  vertex buffer: " << data->vertices.size() * sizeof(PMXRendererVertex) << " -> "
+              << packed.vertices.size() * sizeof(PMXPackedVertex) << " bytes" << std::endl;
+    printf("  max error: position %.6f (bounds radius %.3f), normal %.4f degrees, UV %.7f\n",
+           error.pos, data->boundsRadius, error.normDegrees, error.UV);
+    PMXPackedSkin skin = PMXRenderData::packSkin(model);
+    printf("  skin stream: %zu bytes (%d-bit bone indices), max weight error %.5f\n",
+           skin.data.size(), skin.boneIdxSize * 8, PMXRenderData::skinningError(model, skin));
+}
+
+/*
+ * A batch of synthetic models of growing size loaded one after another and
+ * through a ModelLoader, next to the time of the largest model alone.
+ */
+static void benchBatch(int modelNum, int repeat) {
+    std::vector<std::string> paths;
+    for (auto i = 0; i < modelNum; i++) {
+        paths.push_back((fsys::temp_directory_path() / fsys::unique_path("mmd-bench-%%%%%%%%.pmx")).string());
+        writeSyntheticPMX(paths.back(), 20000 + 180000 * i / std::max(modelNum - 1, 1), 2, 4);
+    }
+    double largestMs = timeLoad(paths.back(), 0, repeat);
+    double serialMs = 0, loaderMs = 0;
+    for (auto i = 0; i < repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto &path: paths) {
+            PMXModel model(path);
+        }
+        auto mid = std::chrono::steady_clock::now();
+        {
+            ModelLoader loader;
+            auto models = loader.load(paths);
+            for (auto &model: models) {
+                model.get();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        serialMs += std::chrono::duration<double, std::milli>(mid - start).count();
+        loaderMs += std::chrono::duration<double, std::milli>(end - mid).count();
+    }
+    for (auto &path: paths) {
+        fsys::remove(path);
+    }
+    std::cout << "batch of " << modelNum << " models" << std::endl;
+    std::cout << "  largest model alone:   " << largestMs << " ms" << std::endl;
+    std::cout << "  one after another:     " << serialMs / repeat << " ms" << std::endl;
+    std::cout << "  ModelLoader:           " << loaderMs / repeat << " ms" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    po::options_description desc("MMD Parser Benchmark Program");
+    desc.add_options()
+        ("input-model,i", po::value<std::string>(), "input mmd model")
+        ("synthetic-vertices,s", po::value<std::vector<int>>()->multitoken(),
+            "vertex counts of synthetic models to generate")
+        ("index-widths,w", po::value<int>(),
+            "compare specialized and generic decoders on synthetic models of this many vertices")
+        ("additional-uvs,u", po::value<int>()->default_value(0), "additional UVs of the index width models")
+        ("optimize-mesh,o", "report ACMR and load time of the input model with and without mesh optimization")
+        ("weld,e", po::value<float>(), "report vertices of the input model welded within this epsilon, 0 for exact")
+        ("packed-vertices,p", "report size and largest error of the packed vertex format for the input model")
+        ("lod,l", "report the levels of detail and meshlet culling of the input model")
+        ("batch,b", po::value<int>(), "compare loading this many synthetic models serially and with ModelLoader")
+        ("repeat,r", po::value<int>()->default_value(10), "loads per measurement")
+        ("help", "show help")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    int repeat = vm["repeat"].as<int>();
+    if (vm.count("input-model")) {
+        std::string modelPath = vm["input-model"].as<std::string>();
+        if (vm.count("optimize-mesh")) {
+            benchMeshOptimization(modelPath, repeat);
+        } else if (vm.count("weld")) {
+            benchWeld(modelPath, vm["weld"].as<float>(), repeat);
+        } else if (vm.count("packed-vertices")) {
+            benchPackedVertices(modelPath, repeat);
+        } else if (vm.count("lod")) {
+            benchLOD(modelPath, repeat);
+        } else {
+            benchLoad(modelPath, modelPath, repeat);
+        }
+    }
+    if (vm.count("synthetic-vertices")) {
+        for (auto vertexNum: vm["synthetic-vertices"].as<std::vector<int>>()) {
+            std::string path = (fsys::temp_directory_path() / fsys::unique_path("mmd-bench-%%%%%%%%.pmx")).string();
+            writeSyntheticPMX(path, vertexNum, 2, 4);
+            benchLoad("synthetic " + std::to_string(vertexNum) + " vertices", path, repeat);
+            fsys::remove(path);
+        }
+    }
+    if (vm.count("index-widths")) {
+        benchIndexWidths(vm["index-widths"].as<int>(), vm["additional-uvs"].as<int>(), repeat);
+    }
+    if (vm.count("batch")) {
+        benchBatch(vm["batch"].as<int>(), repeat);
+    }
+    return 0;
+}
@@ -6,14 +6,24 @@
 
 namespace po = boost::program_options;
 
-void testParser(std::string modelPath) {
-    PMXModel testModel(modelPath);
+void testParser(std::string modelPath, std::shared_ptr<FileSource> fileSource = nullptr) {
+    PMXModel testModel(fileSource, modelPath);
+    for (auto &texture: testModel.getTextures()) {
+        if (!texture.loadError.empty()) {
+            std::cerr << texture.loadError << std::endl;
+        }
+    }
+    PMXArena &arena = testModel.getArena();
+    std::cout << "arena: " << arena.getBlockNum() << " blocks, "
+              << arena.getUsed() << " / " << arena.getCapacity() << " bytes used" << std::endl;
 }
 
 int main(int argc, char **argv) {
     po::options_description desc("MMD Parser Testing Program");
     desc.add_options()
         ("input-model,i", po::value<std::string>(), "input mmd model")
+        ("archive,a", po::value<std::string>(),
+            "zip archive to read the model from, the input model is a path inside it (default: first model)")
         ("help", "show help")
     ;
 
@@ -23,6 +33,27 @@ int main(int argc, char **argv) {
 
     if (vm.count("help")) {
         std::cout << desc << std::endl;
+    } else if (vm.count("archive")) {
+        auto archive = std::make_shared<ZipFileSource>(vm["archive"].as<std::string>());
+        std::string modelPath;
+        if (vm.count("input-model")) {
+            modelPath = vm["input-model"].as<std::string>();
+        } else {
+            for (auto &path: archive->getPaths()) {
+                std::string extension = FileSource::normalizePath(path);
+                extension = extension.substr(std::max<size_t>(extension.size(), 4) - 4);
+                if (extension == ".pmx" || extension == ".pmd") {
+                    modelPath = path;
+                    break;
+                }
+            }
+        }
+        if (modelPath.empty()) {
+            std::cout << "archive has no model." << std::endl;
+        } else {
+            std::cout << modelPath << std::endl;
+            testParser(modelPath, archive);
+        }
     } else if (vm.count("input-model")) {
         testParser(vm["input-model"].as<std::string>());
     } else {
@@ -0,0 +1,688 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include <mmd/parser.hpp>
+#include <mmd/simd.hpp>
+
+/*
+ * Legacy PMD 1.0 files. Records are fixed size and text is fixed width
+ * Shift_JIS, everything is converted to the PMX structures while decoding.
+ */
+
+static const size_t PMD_HEADER_SIZE = 3 + sizeof(float);
+static const size_t PMD_NAME_LEN = 20;
+static const size_t PMD_COMMENT_LEN = 256;
+static const size_t PMD_VERTEX_SIZE = 38;
+static const size_t PMD_MATERIAL_SIZE = 70;
+static const size_t PMD_BONE_SIZE = 39;
+static const size_t PMD_BONE_DISPLAY_NAME_LEN = 50;
+static const size_t PMD_TOON_NAME_LEN = 100;
+static const int PMD_TOON_NUM = 10;
+static const size_t PMD_RIGID_BODY_SIZE = 83;
+static const size_t PMD_JOINT_SIZE = 124;
+
+static const int PMD_VERTEX_CHUNK_NUM = 16384;
+static const uint16_t PMD_NO_BONE = 0xffff;
+static const unsigned char PMD_NO_TOON = 0xff;
+
+// PMD bone types
+static const int PMD_BONE_ROTATE = 0;
+static const int PMD_BONE_ROTATE_MOVE = 1;
+static const int PMD_BONE_IK = 2;
+static const int PMD_BONE_ROTATE_AFFECTED = 5;
+static const int PMD_BONE_IK_TARGET = 6;
+static const int PMD_BONE_INVISIBLE = 7;
+static const int PMD_BONE_TWIST = 8;
+static const int PMD_BONE_ROTATE_FOLLOW = 9;
+
+// PMD IK weights are a quarter of the PMX limit angle
+static const float PMD_IK_LIMIT_SCALE = 4.0f;
+
+PMXTextBuf PMXModel::readFixedTextBuf(const char *buf, size_t width) {
+    PMXTextBuf result;
+    size_t textLen = strnlen(buf, width);
+    result.originTextLen = textLen;
+    result.text = strings.storeShiftJIS(buf, textLen);
+    return result;
+}
+
+int PMXModel::addPMDTexture(std::string_view name) {
+    for (size_t i = 0; i < pmdTextureNames.size(); i++) {
+        if (pmdTextureNames[i].text == name) {
+            return i;
+        }
+    }
+    PMXTextBuf texture;
+    texture.text = name;
+    texture.originTextLen = name.size();
+    pmdTextureNames.push_back(texture);
+    return pmdTextureNames.size() - 1;
+}
+
+// "texture.bmp*sphere.sph" style material texture fields
+static void splitPMDTextureField(std::string_view field, std::string_view &texture,
+                                 std::string_view &sphere, unsigned char &sphereMode) {
+    texture = sphere = std::string_view();
+    sphereMode = 0;
+    while (!field.empty()) {
+        size_t separator = field.find('*');
+        std::string_view name = field.substr(0, separator);
+        field = separator == std::string_view::npos ? std::string_view() : field.substr(separator + 1);
+        if (name.empty()) {
+            continue;
+        }
+        std::string_view extension = name.size() >= 4 ? name.substr(name.size() - 4) : std::string_view();
+        if (extension == ".sph" || extension == ".SPH") {
+            sphere = name;
+            sphereMode = 1;
+        } else if (extension == ".spa" || extension == ".SPA") {
+            sphere = name;
+            sphereMode = 2;
+        } else {
+            texture = name;
+        }
+    }
+}
+
+void PMXModel::parsePMDFile() {
+    const char *data = fileBlock->data();
+    size_t bufIdx = 0;
+    auto require = [&](size_t bytes) {
+        if (bufIdx > fileSize || bytes > fileSize - bufIdx) {
+            throw PMXFormatError("Truncated PMD file", bufIdx);
+        }
+    };
+    // 32-bit counts beyond int range can only come from corrupt files
+    auto readCount32 = [&](const char *what) {
+        require(sizeof(uint32_t));
+        uint32_t count = *(uint32_t *)(data + bufIdx);
+        if (count > (uint32_t)std::numeric_limits<int>::max()) {
+            throw PMXFormatError(std::string("Invalid ") + what, bufIdx);
+        }
+        return (int)count;
+    };
+
+    // header
+    require(PMD_HEADER_SIZE + PMD_NAME_LEN + PMD_COMMENT_LEN);
+    ver = *(float *)(data + 3);
+    if (ver != 1.0f) {
+        throw PMXFormatError("Unsupported PMD version", 3);
+    }
+    bufIdx += PMD_HEADER_SIZE;
+    modelName = readFixedTextBuf(data + bufIdx, PMD_NAME_LEN).text;
+    bufIdx += PMD_NAME_LEN;
+    modelComment = readFixedTextBuf(data + bufIdx, PMD_COMMENT_LEN).text;
+    bufIdx += PMD_COMMENT_LEN;
+    modelNameEn = modelCommentEn = std::string_view();
+    scannedTextLen = 0;
+
+    // index sizes of the converted model
+    globals.encoding = TEXT_ENCODING_UTF8;
+    globals.additionalUVNum = 0;
+    globals.vertexIdxSize = 2;
+    globals.textureIdxSize = 1;
+    globals.materialIdxSize = 1;
+    globals.boneIdxSize = 2;
+    globals.morphIdxSize = 2;
+    globals.rigidIdxSize = 4;
+
+    // vertices, BDEF1 when one bone has all the weight, BDEF2 otherwise
+    vertexNum = readCount32("vertex count");
+    vertexSection.offset = bufIdx;
+    vertexSection.size = sizeof(uint32_t) + (size_t)vertexNum * PMD_VERTEX_SIZE;
+    vertexSection.read = &PMXModel::readPMDVertices;
+    require(vertexSection.size);
+    vertexChunks.clear();
+    vertexSkinNum = 0;
+    vertexSDEFNum = 0;
+    const char *weights = data + bufIdx + sizeof(uint32_t) + 36;
+    for (auto i = 0; i < vertexNum; i++) {
+        if (i % PMD_VERTEX_CHUNK_NUM == 0) {
+            vertexChunks.push_back({i, std::min(i + PMD_VERTEX_CHUNK_NUM, vertexNum),
+                                    sizeof(uint32_t) + (size_t)i * PMD_VERTEX_SIZE, vertexSkinNum, 0});
+        }
+        unsigned char weight = weights[(size_t)i * PMD_VERTEX_SIZE];
+        vertexSkinNum += (weight == 0 || weight >= 100) ? 1 : 2;
+    }
+    bufIdx += vertexSection.size;
+
+    // surfaces, 16-bit indices
+    int indexNum = readCount32("surface index count");
+    if (indexNum % 3 != 0) {
+        throw PMXFormatError("Surface index count is not a multiple of 3", bufIdx);
+    }
+    surfaceNum = indexNum / 3;
+    surfaceSection.offset = bufIdx;
+    surfaceSection.size = sizeof(uint32_t) + (size_t)indexNum * sizeof(uint16_t);
+    surfaceSection.read = &PMXModel::readSurfaces;
+    require(surfaceSection.size);
+    bufIdx += surfaceSection.size;
+
+    // materials, the texture table is collected from their texture fields
+    materialNum = readCount32("material count");
+    materialSection.offset = bufIdx;
+    materialSection.size = sizeof(uint32_t) + (size_t)materialNum * PMD_MATERIAL_SIZE;
+    materialSection.read = &PMXModel::readPMDMaterials;
+    require(materialSection.size);
+    pmdTextureNames.clear();
+    for (auto i = 0; i < materialNum; i++) {
+        const char *field = data + bufIdx + sizeof(uint32_t) + (size_t)i * PMD_MATERIAL_SIZE + 50;
+        std::string_view texture, sphere;
+        unsigned char sphereMode;
+        splitPMDTextureField(readFixedTextBuf(field, PMD_NAME_LEN).text, texture, sphere, sphereMode);
+        if (!texture.empty()) {
+            addPMDTexture(texture);
+        }
+        if (!sphere.empty()) {
+            addPMDTexture(sphere);
+        }
+    }
+    bufIdx += materialSection.size;
+
+    // bones followed by the IK list
+    require(sizeof(uint16_t));
+    boneNum = *(uint16_t *)(data + bufIdx);
+    globals.boneIdxSize = boneNum > 0x7fff ? 4 : 2;
+    boneSection.offset = bufIdx;
+    boneSection.read = &PMXModel::readPMDBones;
+    bufIdx += sizeof(uint16_t) + (size_t)boneNum * PMD_BONE_SIZE;
+    scannedTextLen += (size_t)boneNum * PMD_NAME_LEN;
+    require(sizeof(uint16_t));
+    int IKNum = *(uint16_t *)(data + bufIdx);
+    bufIdx += sizeof(uint16_t);
+    boneIKNum = 0;
+    boneIKLinkNum = 0;
+    for (auto i = 0; i < IKNum; i++) {
+        // IK bone, target, link count, loop count, limit
+        const size_t fixedSize = 2 * sizeof(uint16_t) + sizeof(unsigned char) + sizeof(uint16_t) + sizeof(float);
+        require(fixedSize);
+        unsigned char linkNum = *(unsigned char *)(data + bufIdx + 2 * sizeof(uint16_t));
+        bufIdx += fixedSize + linkNum * sizeof(uint16_t);
+        boneIKNum++;
+        boneIKLinkNum += linkNum;
+    }
+    require(0);
+    boneSection.size = bufIdx - boneSection.offset;
+
+    // skins, the first one is the base the others are relative to
+    require(sizeof(uint16_t));
+    int skinNum = *(uint16_t *)(data + bufIdx);
+    morphNum = std::max(skinNum - 1, 0);
+    morphSection.offset = bufIdx;
+    morphSection.read = &PMXModel::readPMDMorphs;
+    bufIdx += sizeof(uint16_t);
+    std::fill(std::begin(morphOffsetNums), std::end(morphOffsetNums), 0);
+    for (auto i = 0; i < skinNum; i++) {
+        require(PMD_NAME_LEN + sizeof(uint32_t) + sizeof(unsigned char));
+        uint32_t offsetNum = *(uint32_t *)(data + bufIdx + PMD_NAME_LEN);
+        bufIdx += PMD_NAME_LEN + sizeof(uint32_t) + sizeof(unsigned char);
+        bufIdx += (size_t)offsetNum * (sizeof(uint32_t) + sizeof(PMXFloat3XYZ));
+        if (i > 0) {
+            morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX] += offsetNum;
+        }
+    }
+    require(0);
+    morphSection.size = bufIdx - morphSection.offset;
+    scannedTextLen += (size_t)morphNum * PMD_NAME_LEN;
+
+    // display lists are not kept
+    require(sizeof(unsigned char));
+    bufIdx += sizeof(unsigned char) + *(unsigned char *)(data + bufIdx) * sizeof(uint16_t);
+    require(sizeof(unsigned char));
+    int boneDisplayNameNum = *(unsigned char *)(data + bufIdx);
+    bufIdx += sizeof(unsigned char) + boneDisplayNameNum * PMD_BONE_DISPLAY_NAME_LEN;
+    require(sizeof(uint32_t));
+    bufIdx += sizeof(uint32_t) + (size_t)*(uint32_t *)(data + bufIdx) * (sizeof(uint16_t) + sizeof(unsigned char));
+    require(0);
+
+    // optional trailing blocks, added by later versions of the editor
+    pmdEnglishOffset = 0;
+    if (bufIdx + sizeof(unsigned char) <= fileSize) {
+        unsigned char hasEnglish = *(unsigned char *)(data + bufIdx);
+        bufIdx += sizeof(hasEnglish);
+        if (hasEnglish) {
+            pmdEnglishOffset = bufIdx;
+            require(PMD_NAME_LEN + PMD_COMMENT_LEN);
+            modelNameEn = readFixedTextBuf(data + bufIdx, PMD_NAME_LEN).text;
+            modelCommentEn = readFixedTextBuf(data + bufIdx + PMD_NAME_LEN, PMD_COMMENT_LEN).text;
+            bufIdx += PMD_NAME_LEN + PMD_COMMENT_LEN;
+            bufIdx += ((size_t)boneNum + morphNum) * PMD_NAME_LEN + boneDisplayNameNum * PMD_BONE_DISPLAY_NAME_LEN;
+            require(0);
+            scannedTextLen += ((size_t)boneNum + morphNum) * PMD_NAME_LEN;
+        }
+    }
+
+    // toon slots still named toonXX.bmp are the shared toon textures
+    for (auto i = 0; i < PMD_TOON_NUM; i++) {
+        pmdToonTextures[i] = -1;
+    }
+    if (bufIdx + PMD_TOON_NUM * PMD_TOON_NAME_LEN <= fileSize) {
+        for (auto i = 0; i < PMD_TOON_NUM; i++) {
+            std::string_view name = readFixedTextBuf(data + bufIdx + i * PMD_TOON_NAME_LEN, PMD_TOON_NAME_LEN).text;
+            char sharedName[16];
+            snprintf(sharedName, sizeof(sharedName), "toon%02d.bmp", i + 1);
+            if (!name.empty() && name != sharedName) {
+                pmdToonTextures[i] = addPMDTexture(name);
+            }
+        }
+        bufIdx += PMD_TOON_NUM * PMD_TOON_NAME_LEN;
+    }
+    textureNum = pmdTextureNames.size();
+    textureSection.offset = materialSection.offset;
+    textureSection.size = 0;
+    textureSection.read = &PMXModel::readPMDTextures;
+
+    // rigid bodies and joints
+    rigidBodyNum = 0;
+    jointNum = 0;
+    physicsSection.offset = bufIdx;
+    physicsSection.read = &PMXModel::readPMDPhysics;
+    if (bufIdx + sizeof(uint32_t) <= fileSize) {
+        rigidBodyNum = readCount32("rigid body count");
+        bufIdx += sizeof(uint32_t);
+        require((size_t)rigidBodyNum * PMD_RIGID_BODY_SIZE);
+        // the group byte sits at a fixed offset, the decoder shifts by it unchecked
+        for (auto i = 0; i < rigidBodyNum; i++, bufIdx += PMD_RIGID_BODY_SIZE) {
+            if (*(unsigned char *)(data + bufIdx + 22) >= 16) {
+                throw PMXFormatError("Invalid rigid body group", bufIdx + 22);
+            }
+        }
+        jointNum = readCount32("joint count");
+        bufIdx += sizeof(uint32_t) + (size_t)jointNum * PMD_JOINT_SIZE;
+        require(0);
+        scannedTextLen += ((size_t)rigidBodyNum + jointNum) * PMD_NAME_LEN;
+    }
+    physicsSection.size = bufIdx - physicsSection.offset;
+    displayFrameNum = 0;
+
+    pendingSectionNum = 7;
+
+#ifdef MODEL_PARSER_DEBUG
+    std::cout << "PMD version: " << ver << std::endl;
+    std::cout << "PMD modelName:" << std::endl << modelName << std::endl;
+    std::cout << "PMD vertexNum: " << vertexNum << std::endl;
+    std::cout << "PMD surfaceNum: " << surfaceNum << std::endl;
+    std::cout << "PMD textureNum: " << textureNum << std::endl;
+    std::cout << "PMD materialNum: " << materialNum << std::endl;
+    std::cout << "PMD boneNum: " << boneNum << std::endl;
+    std::cout << "PMD morphNum: " << morphNum << std::endl;
+    std::cout << "PMD rigidBodyNum: " << rigidBodyNum << std::endl;
+    std::cout << "PMD jointNum: " << jointNum << std::endl;
+#endif
+}
+
+void PMXModel::readPMDVertices(const char *buf) {
+    allocateVertices();
+    decodeVertexChunks(buf, &PMXModel::decodePMDVertexChunk);
+    checkVertexBones();
+}
+
+void PMXModel::decodePMDVertexChunk(const char *buf, const PMXVertexChunk &chunk) {
+    const char *records = buf + chunk.bufOffset;
+    size_t count = chunk.end - chunk.begin;
+    // fixed stride, so the float attributes are split in bulk
+    splitVertexAttributes(records, PMD_VERTEX_SIZE, count,
+                          &vertices.positions[chunk.begin].x,
+                          &vertices.normals[chunk.begin].x,
+                          &vertices.UVs[chunk.begin].u);
+
+    uint32_t skinIdx = chunk.skinOffset;
+    auto storeBone = [&](uint16_t boneIdx, float weight) {
+        if (vertices.wideBoneIdx) {
+            vertices.boneIndices32[skinIdx] = boneIdx;
+        } else {
+            vertices.boneIndices16[skinIdx] = boneIdx;
+        }
+        vertices.boneWeights[skinIdx] = weight;
+        skinIdx++;
+    };
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+        const char *skin = records + (size_t)(i - chunk.begin) * PMD_VERTEX_SIZE + 32;
+        uint16_t bone0 = *(uint16_t *)skin, bone1 = *(uint16_t *)(skin + 2);
+        unsigned char weight = skin[4];
+        vertices.skinOffsets[i] = skinIdx;
+        if (weight >= 100) {
+            vertices.deformMethods[i] = PMXVertexData::DEFORM_METHOD_BDEF1;
+            storeBone(bone0, 1.0f);
+        } else if (weight == 0) {
+            vertices.deformMethods[i] = PMXVertexData::DEFORM_METHOD_BDEF1;
+            storeBone(bone1, 1.0f);
+        } else {
+            vertices.deformMethods[i] = PMXVertexData::DEFORM_METHOD_BDEF2;
+            storeBone(bone0, weight / 100.0f);
+            storeBone(bone1, 1.0f - weight / 100.0f);
+        }
+        // the flag disables the edge
+        vertices.edgeScales[i] = skin[5] ? 0.0f : 1.0f;
+    }
+}
+
+void PMXModel::readPMDTextures(const char *buf) {
+    textures.reserve(textureNum);
+    for (auto i = 0; i < textureNum; i++) {
+        textures.emplace_back(&arena);
+        textures[i].name = pmdTextureNames[i];
+    }
+    startTextureLoads();
+}
+
+void PMXModel::readPMDMaterials(const char *buf) {
+    size_t bufIdx = sizeof(uint32_t);
+    materials.resize(materialNum);
+    for (auto i = 0; i < materialNum; i++) {
+        PMXMaterial currMaterial = PMXMaterial();
+        const char *record = buf + bufIdx;
+
+        PMXFloat3RGB diffuse = *(PMXFloat3RGB *)record;
+        float alpha = *(float *)(record + 12);
+        currMaterial.diffuse = {diffuse.r, diffuse.g, diffuse.b, alpha};
+        currMaterial.specularX = *(float *)(record + 16);
+        currMaterial.specular = *(PMXFloat3RGB *)(record + 20);
+        currMaterial.ambient = *(PMXFloat3RGB *)(record + 32);
+        unsigned char toonIdx = *(unsigned char *)(record + 44);
+        unsigned char edgeFlag = *(unsigned char *)(record + 45);
+        currMaterial.surfaceNum = *(uint32_t *)(record + 46) / 3;
+
+        // what MMD does implicitly for PMD materials
+        currMaterial.renderFlag = 0x02 | 0x04 | 0x08;
+        if (alpha < 1.0f) {
+            currMaterial.renderFlag |= 0x01;
+        }
+        if (alpha == 0.98f) {
+            // MMD's convention for disabling self shadows
+            currMaterial.renderFlag &= ~(0x04 | 0x08);
+        }
+        if (edgeFlag) {
+            currMaterial.renderFlag |= 0x10;
+        }
+        currMaterial.edgeColor = {0.0f, 0.0f, 0.0f, 1.0f};
+        currMaterial.edgeSize = 1.0f;
+
+        std::string_view texture, sphere;
+        splitPMDTextureField(readFixedTextBuf(record + 50, PMD_NAME_LEN).text, texture, sphere, currMaterial.sphereMode);
+        currMaterial.textureIdx = texture.empty() ? -1 : addPMDTexture(texture);
+        currMaterial.sphereTextureIdx = sphere.empty() ? -1 : addPMDTexture(sphere);
+
+        if (toonIdx == PMD_NO_TOON || toonIdx >= PMD_TOON_NUM) {
+            currMaterial.toonFlag = TOON_NON_SHARED_FLAG;
+            currMaterial.toonTextureIdx = -1;
+        } else if (pmdToonTextures[toonIdx] < 0) {
+            currMaterial.toonFlag = TOON_SHARED_FLAG;
+            currMaterial.sharedToonTextureIdx = toonIdx;
+        } else {
+            currMaterial.toonFlag = TOON_NON_SHARED_FLAG;
+            currMaterial.toonTextureIdx = pmdToonTextures[toonIdx];
+        }
+
+        materials[i] = currMaterial;
+        bufIdx += PMD_MATERIAL_SIZE;
+    }
+    checkMaterials();
+}
+
+void PMXModel::readPMDBones(const char *buf) {
+    const char *englishNames = pmdEnglishOffset
+        ? fileBlock->data() + pmdEnglishOffset + PMD_NAME_LEN + PMD_COMMENT_LEN : nullptr;
+    auto toBoneIdx = [&](uint16_t boneIdx) {
+        return boneIdx < boneNum ? (int)boneIdx : -1;
+    };
+
+    std::vector<PMXBoneRecord> records(boneNum);
+    std::vector<uint16_t> tails(boneNum);
+    std::vector<unsigned char> types(boneNum);
+    size_t bufIdx = sizeof(uint16_t);
+    for (auto i = 0; i < boneNum; i++) {
+        PMXBoneRecord &record = records[i];
+        const char *bone = buf + bufIdx;
+        record = PMXBoneRecord();
+        record.name = readFixedTextBuf(bone, PMD_NAME_LEN);
+        if (englishNames) {
+            record.nameEn = readFixedTextBuf(englishNames + i * PMD_NAME_LEN, PMD_NAME_LEN);
+        }
+        record.parent = toBoneIdx(*(uint16_t *)(bone + 20));
+        tails[i] = *(uint16_t *)(bone + 22);
+        types[i] = *(unsigned char *)(bone + 24);
+        uint16_t IKParent = *(uint16_t *)(bone + 25);
+        record.pos = *(PMXFloat3XYZ *)(bone + 27);
+        record.tailBone = -1;
+        record.grantParent = -1;
+        record.IKTarget = -1;
+
+        record.flags = PMXBoneData::BONE_FLAG_ROTATABLE | PMXBoneData::BONE_FLAG_VISIBLE
+                     | PMXBoneData::BONE_FLAG_OPERABLE;
+        switch (types[i]) {
+            case PMD_BONE_ROTATE_MOVE:
+            case PMD_BONE_IK:
+                record.flags |= PMXBoneData::BONE_FLAG_MOVABLE;
+                break;
+            case PMD_BONE_ROTATE_AFFECTED:
+                if (toBoneIdx(IKParent) >= 0) {
+                    record.flags |= PMXBoneData::BONE_FLAG_ROTATION_GRANT;
+                    record.grantParent = IKParent;
+                    record.grantRatio = 1.0f;
+                }
+                break;
+            case PMD_BONE_IK_TARGET:
+            case PMD_BONE_INVISIBLE:
+                record.flags &= ~(PMXBoneData::BONE_FLAG_VISIBLE | PMXBoneData::BONE_FLAG_OPERABLE);
+                break;
+            case PMD_BONE_ROTATE_FOLLOW:
+                // the tail field holds the ratio in percent
+                record.flags &= ~PMXBoneData::BONE_FLAG_VISIBLE;
+                if (toBoneIdx(IKParent) >= 0) {
+                    record.flags |= PMXBoneData::BONE_FLAG_ROTATION_GRANT;
+                    record.grantParent = IKParent;
+                    record.grantRatio = tails[i] * 0.01f;
+                }
+                break;
+        }
+        bufIdx += PMD_BONE_SIZE;
+    }
+
+    // tails, twist bones rotate around the axis towards theirs
+    for (auto i = 0; i < boneNum; i++) {
+        PMXBoneRecord &record = records[i];
+        int tail = types[i] == PMD_BONE_ROTATE_FOLLOW ? -1 : toBoneIdx(tails[i]);
+        // 0 is the root and marks a missing tail
+        if (tail > 0) {
+            record.flags |= PMXBoneData::BONE_FLAG_TAIL_BONE;
+            record.tailBone = tail;
+        }
+        if (types[i] == PMD_BONE_TWIST && tail > 0) {
+            const PMXFloat3XYZ &tailPos = records[tail].pos;
+            PMXFloat3XYZ axis = {tailPos.x - record.pos.x, tailPos.y - record.pos.y, tailPos.z - record.pos.z};
+            float len = std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+            if (len > 0.0f) {
+                record.flags |= PMXBoneData::BONE_FLAG_FIXED_AXIS;
+                record.fixedAxis = {axis.x / len, axis.y / len, axis.z / len};
+            }
+        }
+    }
+
+    // IK list, limits scaled to PMX radians, knees only bend one way
+    static const float PI = 3.14159265f;
+    std::vector<PMXBoneIKLink> links;
+    links.reserve(boneIKLinkNum);
+    int IKNum = *(uint16_t *)(buf + bufIdx);
+    bufIdx += sizeof(uint16_t);
+    for (auto i = 0; i < IKNum; i++) {
+        const char *IK = buf + bufIdx;
+        int IKBone = toBoneIdx(*(uint16_t *)IK);
+        int target = toBoneIdx(*(uint16_t *)(IK + 2));
+        unsigned char linkNum = *(unsigned char *)(IK + 4);
+        bufIdx += 2 * sizeof(uint16_t) + sizeof(unsigned char) + sizeof(uint16_t) + sizeof(float);
+        if (IKBone < 0 || target < 0) {
+            throw PMXFormatError("Invalid IK bone index", IK - fileBlock->data());
+        }
+        PMXBoneRecord &record = records[IKBone];
+        record.flags |= PMXBoneData::BONE_FLAG_IK | PMXBoneData::BONE_FLAG_MOVABLE;
+        record.IKTarget = target;
+        record.IKLoopNum = *(uint16_t *)(IK + 5);
+        record.IKLimitAngle = *(float *)(IK + 7) * PMD_IK_LIMIT_SCALE;
+        record.IKLinkBegin = links.size();
+        for (auto j = 0; j < linkNum; j++) {
+            PMXBoneIKLink link = PMXBoneIKLink();
+            link.bone = toBoneIdx(*(uint16_t *)(buf + bufIdx));
+            if (link.bone < 0) {
+                throw PMXFormatError("Invalid IK link bone index", buf + bufIdx - fileBlock->data());
+            }
+            bufIdx += sizeof(uint16_t);
+            if (records[link.bone].name.text.find("ひざ") != std::string_view::npos) {
+                link.limited = 1;
+                link.lower = {-PI, 0.0f, 0.0f};
+                link.upper = {-0.5f * PI / 180.0f, 0.0f, 0.0f};
+            }
+            links.push_back(link);
+        }
+        record.IKLinkEnd = links.size();
+    }
+    storeBones(records, links);
+}
+
+void PMXModel::readPMDMorphs(const char *buf) {
+    const char *englishNames = pmdEnglishOffset
+        ? fileBlock->data() + pmdEnglishOffset + PMD_NAME_LEN + PMD_COMMENT_LEN + (size_t)boneNum * PMD_NAME_LEN
+        : nullptr;
+    PMXMorphData &data = morphs;
+    data.names.resize(morphNum);
+    data.namesEn.resize(morphNum);
+    data.panels.resize(morphNum);
+    data.types.resize(morphNum);
+    data.offsetBegins.resize(morphNum);
+    data.offsetNums.resize(morphNum);
+    data.vertexIndices.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX]);
+    data.positionDeltas.reserve(morphOffsetNums[PMXMorphData::MORPH_TYPE_VERTEX]);
+    if (morphNum == 0) {
+        return;
+    }
+
+    const size_t offsetSize = sizeof(uint32_t) + sizeof(PMXFloat3XYZ);
+    size_t bufIdx = sizeof(uint16_t);
+    // skins other than the base index into the base skin's vertex list
+    uint32_t baseNum = *(uint32_t *)(buf + bufIdx + PMD_NAME_LEN);
+    if (*(unsigned char *)(buf + bufIdx + PMD_NAME_LEN + sizeof(uint32_t)) != 0) {
+        throw PMXFormatError("Missing PMD base skin", buf + bufIdx - fileBlock->data());
+    }
+    const char *base = buf + bufIdx + PMD_NAME_LEN + sizeof(uint32_t) + sizeof(unsigned char);
+    bufIdx += PMD_NAME_LEN + sizeof(uint32_t) + sizeof(unsigned char) + baseNum * offsetSize;
+
+    for (auto i = 0; i < morphNum; i++) {
+        data.names[i] = readFixedTextBuf(buf + bufIdx, PMD_NAME_LEN);
+        if (englishNames) {
+            data.namesEn[i] = readFixedTextBuf(englishNames + i * PMD_NAME_LEN, PMD_NAME_LEN);
+        }
+        uint32_t offsetNum = *(uint32_t *)(buf + bufIdx + PMD_NAME_LEN);
+        // skin category 1-4 matches the PMX panel
+        data.panels[i] = *(unsigned char *)(buf + bufIdx + PMD_NAME_LEN + sizeof(uint32_t));
+        data.types[i] = PMXMorphData::MORPH_TYPE_VERTEX;
+        data.offsetBegins[i] = data.vertexIndices.size();
+        data.offsetNums[i] = offsetNum;
+        bufIdx += PMD_NAME_LEN + sizeof(uint32_t) + sizeof(unsigned char);
+        for (uint32_t j = 0; j < offsetNum; j++, bufIdx += offsetSize) {
+            // the base skin is looked up right away, so this index is checked before it is used
+            uint32_t baseIdx = *(uint32_t *)(buf + bufIdx);
+            if (baseIdx >= baseNum) {
+                throw PMXFormatError("Invalid PMD skin index", buf + bufIdx - fileBlock->data());
+            }
+            data.vertexIndices.push_back(*(uint32_t *)(base + baseIdx * offsetSize));
+            data.positionDeltas.push_back(*(PMXFloat3XYZ *)(buf + bufIdx + sizeof(uint32_t)));
+        }
+    }
+    checkMorphIndices({});
+}
+
+void PMXModel::readPMDPhysics(const char *buf) {
+    PMXPhysicsData &data = physics;
+    // body positions are relative to their bone, or to the first bone
+    const char *boneBuf = fileBlock->data() + boneSection.offset + sizeof(uint16_t);
+    auto bonePos = [&](int boneIdx) {
+        return *(PMXFloat3XYZ *)(boneBuf + (size_t)boneIdx * PMD_BONE_SIZE + 27);
+    };
+
+    size_t bufIdx = physicsSection.size > 0 ? sizeof(uint32_t) : 0;
+    data.bodyNames.resize(rigidBodyNum);
+    data.bodyNamesEn.resize(rigidBodyNum);
+    data.bodyBones.resize(rigidBodyNum);
+    data.bodyGroups.resize(rigidBodyNum);
+    data.groupMasks.resize(rigidBodyNum);
+    data.collisionMasks.resize(rigidBodyNum);
+    data.shapes.resize(rigidBodyNum);
+    data.shapeSizes.resize(rigidBodyNum);
+    data.bodyPositions.resize(rigidBodyNum);
+    data.bodyRotations.resize(rigidBodyNum);
+    data.masses.resize(rigidBodyNum);
+    data.linearDampings.resize(rigidBodyNum);
+    data.angularDampings.resize(rigidBodyNum);
+    data.restitutions.resize(rigidBodyNum);
+    data.frictions.resize(rigidBodyNum);
+    data.physicsModes.resize(rigidBodyNum);
+    for (auto i = 0; i < rigidBodyNum; i++, bufIdx += PMD_RIGID_BODY_SIZE) {
+        const char *body = buf + bufIdx;
+        data.bodyNames[i] = readFixedTextBuf(body, PMD_NAME_LEN);
+        uint16_t boneIdx = *(uint16_t *)(body + 20);
+        data.bodyBones[i] = boneIdx == PMD_NO_BONE ? -1 : boneIdx;
+        unsigned char group = *(unsigned char *)(body + 22);
+        data.bodyGroups[i] = group;
+        data.groupMasks[i] = 1 << group;
+        data.collisionMasks[i] = ~*(uint16_t *)(body + 23);
+        data.shapes[i] = *(unsigned char *)(body + 25);
+        data.shapeSizes[i] = *(PMXFloat3XYZ *)(body + 26);
+        PMXFloat3XYZ pos = *(PMXFloat3XYZ *)(body + 38);
+        int anchor = boneIdx == PMD_NO_BONE ? 0 : boneIdx;
+        if (anchor < boneNum) {
+            PMXFloat3XYZ origin = bonePos(anchor);
+            pos = {pos.x + origin.x, pos.y + origin.y, pos.z + origin.z};
+        }
+        data.bodyPositions[i] = pos;
+        data.bodyRotations[i] = *(PMXFloat3XYZ *)(body + 50);
+        data.masses[i] = *(float *)(body + 62);
+        data.linearDampings[i] = *(float *)(body + 66);
+        data.angularDampings[i] = *(float *)(body + 70);
+        data.restitutions[i] = *(float *)(body + 74);
+        data.frictions[i] = *(float *)(body + 78);
+        data.physicsModes[i] = *(unsigned char *)(body + 82);
+    }
+
+    bufIdx += physicsSection.size > 0 ? sizeof(uint32_t) : 0;
+    data.jointNames.resize(jointNum);
+    data.jointNamesEn.resize(jointNum);
+    data.jointTypes.resize(jointNum);
+    data.jointBodiesA.resize(jointNum);
+    data.jointBodiesB.resize(jointNum);
+    data.jointPositions.resize(jointNum);
+    data.jointRotations.resize(jointNum);
+    data.translationLowers.resize(jointNum);
+    data.translationUppers.resize(jointNum);
+    data.rotationLowers.resize(jointNum);
+    data.rotationUppers.resize(jointNum);
+    data.translationSprings.resize(jointNum);
+    data.rotationSprings.resize(jointNum);
+    // 0xffffffff becomes -1, the same as PMX
+    auto toBodyIdx = [&](const char *idxBuf) {
+        return *(const int32_t *)idxBuf;
+    };
+    for (auto i = 0; i < jointNum; i++, bufIdx += PMD_JOINT_SIZE) {
+        const char *joint = buf + bufIdx;
+        data.jointNames[i] = readFixedTextBuf(joint, PMD_NAME_LEN);
+        data.jointTypes[i] = 0;
+        data.jointBodiesA[i] = toBodyIdx(joint + 20);
+        data.jointBodiesB[i] = toBodyIdx(joint + 24);
+        PMXFloat3XYZ *vectors[] = {
+            &data.jointPositions[i], &data.jointRotations[i],
+            &data.translationLowers[i], &data.translationUppers[i],
+            &data.rotationLowers[i], &data.rotationUppers[i],
+            &data.translationSprings[i], &data.rotationSprings[i],
+        };
+        const char *vectorBuf = joint + 28;
+        for (auto vector: vectors) {
+            *vector = *(PMXFloat3XYZ *)vectorBuf;
+            vectorBuf += sizeof(PMXFloat3XYZ);
+        }
+    }
+    checkPhysicsIndices();
+    buildPhysicsIslands();
+}
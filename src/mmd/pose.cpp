@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <mmd/mapped_file.hpp>
+#include <mmd/pose.hpp>
+#include <mmd/thread_pool.hpp>
+
+static const char VPD_SIGNATURE[] = "Vocaloid Pose Data file";
+static const VPDBoneTransform VPD_IDENTITY = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f}};
+
+namespace {
+
+/*
+ * Cursor over the text of a VPD file. Files are Shift_JIS, whose trail
+ * bytes are 0x40 and up, so the ASCII punctuation and line breaks the
+ * format is built from can be matched byte by byte.
+ */
+class VPDReader {
+    const char *cur, *end;
+
+    void fail() {
+        throw std::runtime_error("Invalid VPD file");
+    }
+
+public:
+    VPDReader(const char *data, size_t size): cur(data), end(data + size) {}
+
+    // whitespace and // comments
+    void skipBlank() {
+        while (cur < end) {
+            if (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n') {
+                cur++;
+            } else if (*cur == '/' && cur + 1 < end && cur[1] == '/') {
+                cur = std::find(cur, end, '\n');
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool atEnd() {
+        skipBlank();
+        return cur == end;
+    }
+
+    void expect(char c) {
+        skipBlank();
+        if (cur == end || *cur != c) {
+            fail();
+        }
+        cur++;
+    }
+
+    void skipPast(char c) {
+        cur = std::find(cur, end, c);
+        if (cur == end) {
+            fail();
+        }
+        cur++;
+    }
+
+    float readFloat() {
+        skipBlank();
+        float value;
+        auto result = std::from_chars(cur, end, value);
+        if (result.ec != std::errc()) {
+            fail();
+        }
+        cur = result.ptr;
+        return value;
+    }
+
+    // block keyword followed by its index, e.g. "Bone12"
+    std::string_view readKeyword() {
+        skipBlank();
+        const char *begin = cur;
+        while (cur < end && ((*cur >= 'A' && *cur <= 'Z') || (*cur >= 'a' && *cur <= 'z'))) {
+            cur++;
+        }
+        std::string_view keyword(begin, cur - begin);
+        while (cur < end && *cur >= '0' && *cur <= '9') {
+            cur++;
+        }
+        return keyword;
+    }
+
+    // rest of the line without trailing blanks
+    std::string_view readLine() {
+        const char *begin = cur;
+        cur = std::find_if(cur, end, [](char c) { return c == '\r' || c == '\n'; });
+        const char *last = cur;
+        while (last > begin && (last[-1] == ' ' || last[-1] == '\t')) {
+            last--;
+        }
+        return std::string_view(begin, last - begin);
+    }
+};
+
+}
+
+VPDNameMap::VPDNameMap(PMXModel &model) {
+    PMXBoneData &boneData = model.getBones();
+    PMXMorphData &morphData = model.getMorphs();
+    boneNum = boneData.size();
+    morphNum = morphData.size();
+
+    auto encode = [](std::string_view name) {
+        std::string encoded(name.size(), '\0');
+        encoded.resize(utf8ToShiftJIS(name.data(), name.size(), &encoded[0]));
+        return encoded;
+    };
+    encodedNames.reserve(boneNum + morphNum);
+    for (size_t i = 0; i < boneNum; i++) {
+        encodedNames.push_back(encode(boneData.getName(i).text));
+    }
+    for (size_t i = 0; i < morphNum; i++) {
+        encodedNames.push_back(encode(morphData.getName(i).text));
+    }
+
+    // the names are in place now, so the views stay valid; the first of equal names wins
+    bones.reserve(boneNum);
+    for (size_t i = 0; i < boneNum; i++) {
+        bones.emplace(encodedNames[i], i);
+    }
+    morphs.reserve(morphNum);
+    for (size_t i = 0; i < morphNum; i++) {
+        morphs.emplace(encodedNames[boneNum + i], i);
+    }
+}
+
+int VPDNameMap::findBone(std::string_view name) const {
+    auto found = bones.find(name);
+    return found == bones.end() ? -1 : found->second;
+}
+
+int VPDNameMap::findMorph(std::string_view name) const {
+    auto found = morphs.find(name);
+    return found == morphs.end() ? -1 : found->second;
+}
+
+VPDPoseSet::VPDPoseSet(const std::vector<std::string> &filePaths_, const VPDNameMap &names):
+    boneNum(names.getBoneNum()), morphNum(names.getMorphNum()), filePaths(filePaths_) {
+    size_t poseNum = filePaths.size();
+    transforms.assign(poseNum * boneNum, VPD_IDENTITY);
+    morphWeights.assign(poseNum * morphNum, 0.0f);
+    errors.resize(poseNum);
+    unmatchedNums.assign(poseNum, 0);
+
+    // every pose writes only its own slots
+    ThreadPool::shared().parallelFor(poseNum, [&](size_t i) {
+        try {
+            std::unique_ptr<MappedFile> file;
+            try {
+                // pose files are a few KB, reading them beats mapping them
+                file = std::make_unique<MappedFile>(filePaths[i], false);
+            } catch (std::runtime_error &e) {
+                throw std::runtime_error("Unable to open VPD file");
+            }
+            parsePose(i, file->data(), file->size(), names);
+        } catch (std::runtime_error &e) {
+            std::fill_n(transforms.begin() + i * boneNum, boneNum, VPD_IDENTITY);
+            std::fill_n(morphWeights.begin() + i * morphNum, morphNum, 0.0f);
+            unmatchedNums[i] = 0;
+            errors[i] = e.what();
+        }
+    });
+}
+
+void VPDPoseSet::parsePose(size_t i, const char *data, size_t size, const VPDNameMap &names) {
+    const size_t signatureLen = sizeof(VPD_SIGNATURE) - 1;
+    if (size < signatureLen || memcmp(data, VPD_SIGNATURE, signatureLen) != 0) {
+        throw std::runtime_error("Invalid VPD file");
+    }
+    VPDReader reader(data + signatureLen, size - signatureLen);
+    VPDBoneTransform *poseBones = transforms.data() + i * boneNum;
+    float *poseMorphs = morphWeights.data() + i * morphNum;
+
+    // parent model file and bone count, the blocks themselves are the truth
+    reader.skipPast(';');
+    reader.skipPast(';');
+
+    while (!reader.atEnd()) {
+        std::string_view keyword = reader.readKeyword();
+        reader.expect('{');
+        std::string_view name = reader.readLine();
+        if (keyword == "Bone") {
+            VPDBoneTransform transform;
+            transform.translation.x = reader.readFloat();
+            reader.expect(',');
+            transform.translation.y = reader.readFloat();
+            reader.expect(',');
+            transform.translation.z = reader.readFloat();
+            reader.expect(';');
+            transform.rotation.x = reader.readFloat();
+            reader.expect(',');
+            transform.rotation.y = reader.readFloat();
+            reader.expect(',');
+            transform.rotation.z = reader.readFloat();
+            reader.expect(',');
+            transform.rotation.w = reader.readFloat();
+            reader.expect(';');
+            int bone = names.findBone(name);
+            if (bone >= 0) {
+                poseBones[bone] = transform;
+            } else {
+                unmatchedNums[i]++;
+            }
+        } else if (keyword == "Morph") {
+            float weight = reader.readFloat();
+            reader.expect(';');
+            int morph = names.findMorph(name);
+            if (morph >= 0) {
+                poseMorphs[morph] = weight;
+            } else {
+                unmatchedNums[i]++;
+            }
+        } else {
+            throw std::runtime_error("Invalid VPD file");
+        }
+        reader.expect('}');
+    }
+}
@@ -0,0 +1,331 @@
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+
+#include <mmd/mapped_file.hpp>
+#include <mmd/render_cache.hpp>
+
+namespace fsys = boost::filesystem;
+
+static const char CACHE_MAGIC[8] = {'M', 'M', 'D', 'L', 'C', 'A', 'C', 'H'};
+static const size_t CACHE_ALIGN = 8;
+
+/*
+ * File layout, all offsets from the start of the file:
+ * - CacheHeader
+ * - CacheSource per source file, the model first and then its textures
+ * - texture path strings, each padded to CACHE_ALIGN
+ * - vertices, surfaces, draw ranges, LOD levels and meshlets
+ * - CacheTexture per texture, followed by the level tables and pixels
+ */
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sourceNum;
+    uint64_t payloadSize;
+    uint64_t checksum;
+    uint64_t sourceOffset;
+    uint64_t vertexOffset, vertexNum;
+    uint64_t surfaceOffset, surfaceNum;
+    uint64_t drawRangeOffset, drawRangeNum;
+    uint64_t lodLevelOffset, lodLevelNum;
+    uint64_t meshletOffset, meshletNum;
+    uint64_t textureOffset, textureNum;
+    float boundsCenter[3], boundsRadius;
+};
+
+struct CacheSource {
+    uint64_t size; // UINT64_MAX if the file did not exist
+    int64_t mtime;
+    uint64_t pathOffset, pathLen; // pathLen is 0 for the model itself
+};
+
+struct CacheTexture {
+    int32_t width, height;
+    uint64_t levelOffset, levelNum;
+    uint64_t pixelOffset, pixelSize;
+};
+
+static uint64_t hashBlock(uint64_t hash, const char *data, size_t size) {
+    // size is a multiple of CACHE_ALIGN
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static void statSource(const std::string &path, CacheSource &source) {
+    boost::system::error_code error;
+    uint64_t size = fsys::file_size(path, error);
+    if (error) {
+        source.size = UINT64_MAX;
+        source.mtime = 0;
+        return;
+    }
+    source.size = size;
+    source.mtime = fsys::last_write_time(path, error);
+}
+
+// appends aligned blocks to the cache file and checksums them
+class CacheWriter {
+    std::ofstream &out;
+    uint64_t offset;
+    uint64_t hash;
+
+public:
+    CacheWriter(std::ofstream &out_, uint64_t offset_): out(out_), offset(offset_), hash(0) {}
+
+    uint64_t append(const void *data, size_t size) {
+        static const char padding[CACHE_ALIGN] = {0};
+        uint64_t blockOffset = offset;
+        size_t paddedSize = (size + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+        out.write((const char *)data, size);
+        out.write(padding, paddedSize - size);
+        // hash what was written, including the padding
+        size_t wholeSize = size / CACHE_ALIGN * CACHE_ALIGN;
+        hash = hashBlock(hash, (const char *)data, wholeSize);
+        if (paddedSize > wholeSize) {
+            char tail[CACHE_ALIGN] = {0};
+            memcpy(tail, (const char *)data + wholeSize, size - wholeSize);
+            hash = hashBlock(hash, tail, CACHE_ALIGN);
+        }
+        offset += paddedSize;
+        return blockOffset;
+    }
+
+    uint64_t getOffset() const { return offset; }
+    uint64_t getHash() const { return hash; }
+};
+
+PMXRenderCache::PMXRenderCache(std::string cacheDir_): cacheDir(cacheDir_) {}
+
+std::string PMXRenderCache::cachePath(const std::string &modelPath) const {
+    if (cacheDir.empty()) {
+        return modelPath + ".mmdcache";
+    }
+    // models in different directories often share file names
+    std::string absolutePath = fsys::absolute(modelPath).string();
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>()(absolutePath) << "_"
+         << fsys::path(modelPath).filename().string() << ".mmdcache";
+    return (fsys::path(cacheDir) / name.str()).string();
+}
+
+std::shared_ptr<PMXRenderData> PMXRenderCache::load(const std::string &modelPath) const {
+    std::shared_ptr<MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(cachePath(modelPath));
+    } catch (std::runtime_error &e) {
+        return nullptr;
+    }
+    const char *base = file->data();
+    size_t fileSize = file->size();
+
+    if (fileSize < sizeof(CacheHeader)) {
+        return nullptr;
+    }
+    CacheHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION
+        || header.payloadSize != fileSize - sizeof(CacheHeader)) {
+        return nullptr;
+    }
+    auto inBounds = [&](uint64_t offset, uint64_t num, size_t elementSize) {
+        return offset % CACHE_ALIGN == 0 && offset <= fileSize
+            && num <= (fileSize - offset) / elementSize;
+    };
+    if (!inBounds(header.sourceOffset, header.sourceNum, sizeof(CacheSource))
+        || !inBounds(header.vertexOffset, header.vertexNum, sizeof(PMXRendererVertex))
+        || !inBounds(header.surfaceOffset, header.surfaceNum, sizeof(PMXSurface))
+        || !inBounds(header.drawRangeOffset, header.drawRangeNum, sizeof(PMXDrawRange))
+        || !inBounds(header.lodLevelOffset, header.lodLevelNum, sizeof(PMXLODLevel))
+        || !inBounds(header.meshletOffset, header.meshletNum, sizeof(PMXMeshlet))
+        || header.lodLevelNum == 0 || header.drawRangeNum % header.lodLevelNum != 0
+        || !inBounds(header.textureOffset, header.textureNum, sizeof(CacheTexture))
+        || header.sourceNum != header.textureNum + 1) {
+        return nullptr;
+    }
+    if (hashBlock(0, base + sizeof(CacheHeader), header.payloadSize) != header.checksum) {
+        return nullptr;
+    }
+    // the renderer draws these without further checks
+    const PMXDrawRange *drawRanges = (const PMXDrawRange *)(base + header.drawRangeOffset);
+    for (uint64_t i = 0; i < header.drawRangeNum; i++) {
+        if (drawRanges[i].indexOffset > 3 * header.surfaceNum
+            || drawRanges[i].indexNum > 3 * header.surfaceNum - drawRanges[i].indexOffset
+            || drawRanges[i].textureIdx >= (int64_t)header.textureNum
+            || drawRanges[i].meshletOffset > header.meshletNum
+            || drawRanges[i].meshletNum > header.meshletNum - drawRanges[i].meshletOffset) {
+            return nullptr;
+        }
+    }
+    const PMXMeshlet *meshlets = (const PMXMeshlet *)(base + header.meshletOffset);
+    for (uint64_t i = 0; i < header.meshletNum; i++) {
+        if (meshlets[i].indexOffset > 3 * header.surfaceNum
+            || meshlets[i].indexNum > 3 * header.surfaceNum - meshlets[i].indexOffset) {
+            return nullptr;
+        }
+    }
+    const PMXLODLevel *lodLevels = (const PMXLODLevel *)(base + header.lodLevelOffset);
+    uint64_t materialNum = header.drawRangeNum / header.lodLevelNum;
+    for (uint64_t i = 0; i < header.lodLevelNum; i++) {
+        if (lodLevels[i].drawRangeOffset > header.drawRangeNum - materialNum) {
+            return nullptr;
+        }
+    }
+
+    // sources must be unchanged since the cache was written
+    auto data = std::make_shared<PMXRenderData>();
+    const CacheSource *sources = (const CacheSource *)(base + header.sourceOffset);
+    fsys::path modelDir = fsys::path(modelPath).remove_filename();
+    for (uint32_t i = 0; i < header.sourceNum; i++) {
+        std::string path = modelPath;
+        if (i > 0) {
+            if (!inBounds(sources[i].pathOffset, sources[i].pathLen, 1)) {
+                return nullptr;
+            }
+            std::string texturePath(base + sources[i].pathOffset, sources[i].pathLen);
+            path = (modelDir / texturePath).string();
+            data->texturePaths.push_back(texturePath);
+        }
+        CacheSource current;
+        statSource(path, current);
+        if (current.size != sources[i].size || current.mtime != sources[i].mtime) {
+            return nullptr;
+        }
+    }
+
+    // everything below views the mapped file
+    data->vertices.view((const PMXRendererVertex *)(base + header.vertexOffset), header.vertexNum, file);
+    data->surfaces.view((const PMXSurface *)(base + header.surfaceOffset), header.surfaceNum, file);
+    data->drawRanges.view(drawRanges, header.drawRangeNum, file);
+    data->lodLevels.view(lodLevels, header.lodLevelNum, file);
+    data->meshlets.view(meshlets, header.meshletNum, file);
+    data->boundsCenter = {header.boundsCenter[0], header.boundsCenter[1], header.boundsCenter[2]};
+    data->boundsRadius = header.boundsRadius;
+    const CacheTexture *textures = (const CacheTexture *)(base + header.textureOffset);
+    data->textures.resize(header.textureNum);
+    for (uint64_t i = 0; i < header.textureNum; i++) {
+        if (!inBounds(textures[i].levelOffset, textures[i].levelNum, sizeof(PMXTextureLevel))
+            || !inBounds(textures[i].pixelOffset, textures[i].pixelSize, 1)) {
+            return nullptr;
+        }
+        data->textures[i].width = textures[i].width;
+        data->textures[i].height = textures[i].height;
+        data->textures[i].levels.view((const PMXTextureLevel *)(base + textures[i].levelOffset),
+                                      textures[i].levelNum, file);
+        data->textures[i].pixels.view((const unsigned char *)(base + textures[i].pixelOffset),
+                                      textures[i].pixelSize, file);
+    }
+    return data;
+}
+
+void PMXRenderCache::store(const std::string &modelPath, const PMXRenderData &data) const {
+    std::string path = cachePath(modelPath);
+    if (!cacheDir.empty()) {
+        fsys::create_directories(cacheDir);
+    }
+    // concurrent writers each finish their own file, the last rename wins
+    std::string tmpPath = path + fsys::unique_path(".%%%%%%%%.tmp").string();
+    std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Unable to create render cache file");
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write((const char *)&header, sizeof(header));
+    CacheWriter writer(out, sizeof(header));
+
+    std::vector<CacheSource> sources(data.texturePaths.size() + 1);
+    statSource(modelPath, sources[0]);
+    sources[0].pathOffset = sources[0].pathLen = 0;
+    fsys::path modelDir = fsys::path(modelPath).remove_filename();
+    for (size_t i = 0; i < data.texturePaths.size(); i++) {
+        statSource((modelDir / data.texturePaths[i]).string(), sources[i + 1]);
+    }
+    // sources point at their paths, so the paths are written first
+    uint64_t pathOffset = writer.getOffset() + sources.size() * sizeof(CacheSource);
+    for (size_t i = 0; i < data.texturePaths.size(); i++) {
+        sources[i + 1].pathOffset = pathOffset;
+        sources[i + 1].pathLen = data.texturePaths[i].size();
+        pathOffset += (data.texturePaths[i].size() + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+    }
+    header.sourceNum = sources.size();
+    header.sourceOffset = writer.append(sources.data(), sources.size() * sizeof(CacheSource));
+    for (auto &texturePath: data.texturePaths) {
+        writer.append(texturePath.data(), texturePath.size());
+    }
+
+    header.vertexNum = data.vertices.size();
+    header.vertexOffset = writer.append(data.vertices.data(), data.vertices.size() * sizeof(PMXRendererVertex));
+    header.surfaceNum = data.surfaces.size();
+    header.surfaceOffset = writer.append(data.surfaces.data(), data.surfaces.size() * sizeof(PMXSurface));
+    header.drawRangeNum = data.drawRanges.size();
+    header.drawRangeOffset = writer.append(data.drawRanges.data(), data.drawRanges.size() * sizeof(PMXDrawRange));
+    header.lodLevelNum = data.lodLevels.size();
+    header.lodLevelOffset = writer.append(data.lodLevels.data(), data.lodLevels.size() * sizeof(PMXLODLevel));
+    header.meshletNum = data.meshlets.size();
+    header.meshletOffset = writer.append(data.meshlets.data(), data.meshlets.size() * sizeof(PMXMeshlet));
+    header.boundsCenter[0] = data.boundsCenter.x;
+    header.boundsCenter[1] = data.boundsCenter.y;
+    header.boundsCenter[2] = data.boundsCenter.z;
+    header.boundsRadius = data.boundsRadius;
+
+    // texture table first, its entries point past it
+    std::vector<CacheTexture> textures(data.textures.size());
+    uint64_t blockOffset = writer.getOffset() + textures.size() * sizeof(CacheTexture);
+    for (size_t i = 0; i < textures.size(); i++) {
+        const PMXRenderTexture &texture = data.textures[i];
+        textures[i].width = texture.width;
+        textures[i].height = texture.height;
+        textures[i].levelNum = texture.levels.size();
+        textures[i].levelOffset = blockOffset;
+        blockOffset += (texture.levels.size() * sizeof(PMXTextureLevel) + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+        textures[i].pixelSize = texture.pixels.size();
+        textures[i].pixelOffset = blockOffset;
+        blockOffset += (texture.pixels.size() + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+    }
+    header.textureNum = textures.size();
+    header.textureOffset = writer.append(textures.data(), textures.size() * sizeof(CacheTexture));
+    for (auto &texture: data.textures) {
+        writer.append(texture.levels.data(), texture.levels.size() * sizeof(PMXTextureLevel));
+        writer.append(texture.pixels.data(), texture.pixels.size());
+    }
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = VERSION;
+    header.payloadSize = writer.getOffset() - sizeof(header);
+    header.checksum = writer.getHash();
+    out.seekp(0);
+    out.write((const char *)&header, sizeof(header));
+    out.close();
+    if (!out) {
+        fsys::remove(tmpPath);
+        throw std::runtime_error("Unable to write render cache file");
+    }
+    fsys::rename(tmpPath, path);
+}
+
+std::shared_ptr<PMXRenderData> PMXRenderCache::loadOrBuild(const std::string &modelPath, int loadFlags) const {
+    std::shared_ptr<PMXRenderData> data = load(modelPath);
+    if (data) {
+        return data;
+    }
+    // the cache pays for welding and mesh optimization once per model
+    PMXModel model(modelPath, loadFlags | PMXModel::LOAD_WELD_VERTICES | PMXModel::LOAD_OPTIMIZE_MESH);
+    data = PMXRenderData::fromModel(model);
+    try {
+        store(modelPath, *data);
+    } catch (std::exception &e) {
+        // an unwritable cache only costs the next start
+        std::cerr << e.what() << std::endl;
+    }
+    return data;
+}
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <mmd/render_data.hpp>
+
+// vertices deformed alike, bone weights rounded to quarters, share a group;
+// simplification only merges vertices within a group so joints keep their shape
+static std::vector<uint32_t> skinningGroups(const PMXVertexData &vertices) {
+    std::map<std::vector<int>, uint32_t> groupIndices;
+    std::vector<uint32_t> groups(vertices.size());
+    std::vector<int> key;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        key.clear();
+        for (auto j = 0; j < vertices.getBoneNum(i); j++) {
+            int quarters = std::lround(vertices.getBoneWeight(i, j) * 4);
+            if (quarters > 0 && vertices.getBoneIdx(i, j) >= 0) {
+                key.push_back(vertices.getBoneIdx(i, j) * 8 + quarters);
+            }
+        }
+        std::sort(key.begin(), key.end());
+        groups[i] = groupIndices.emplace(key, groupIndices.size()).first->second;
+    }
+    return groups;
+}
+
+std::shared_ptr<PMXRenderData> PMXRenderData::fromModel(PMXModel &model) {
+    auto data = std::make_shared<PMXRenderData>();
+    PMXVertexData& modelVertices = model.getVertices();
+    PMXBuffer<PMXSurface>& modelSurfaces = model.getSurfaces();
+    std::pmr::vector<PMXMaterial>& modelMaterials = model.getMaterials();
+    std::pmr::vector<PMXTexture>& modelTextures = model.getTextures();
+
+    // vertices stay indexed, the surfaces are the element buffer
+    std::pmr::vector<PMXRendererVertex> vertices(modelVertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].pos = modelVertices.getPos(i);
+        vertices[i].norm = modelVertices.getNorm(i);
+        vertices[i].UV = modelVertices.getUV(i);
+    }
+    data->vertices.assign(std::move(vertices));
+
+    PMXFloat3XYZ lower = {0.0f, 0.0f, 0.0f}, upper = {0.0f, 0.0f, 0.0f};
+    if (modelVertices.size() > 0) {
+        lower = upper = modelVertices.getPos(0);
+    }
+    for (size_t i = 0; i < modelVertices.size(); i++) {
+        const PMXFloat3XYZ &pos = modelVertices.getPos(i);
+        lower = {std::min(lower.x, pos.x), std::min(lower.y, pos.y), std::min(lower.z, pos.z)};
+        upper = {std::max(upper.x, pos.x), std::max(upper.y, pos.y), std::max(upper.z, pos.z)};
+    }
+    data->boundsCenter = {(lower.x + upper.x) / 2, (lower.y + upper.y) / 2, (lower.z + upper.z) / 2};
+    data->boundsRadius = std::sqrt((upper.x - lower.x) * (upper.x - lower.x) + (upper.y - lower.y) * (upper.y - lower.y)
+                                   + (upper.z - lower.z) * (upper.z - lower.z)) / 2;
+
+    // materials own consecutive runs of surfaces, each further level simplifies them on their own
+    const size_t materialNum = modelMaterials.size();
+    std::vector<size_t> surfaceOffsets(materialNum + 1, 0);
+    for (size_t i = 0; i < materialNum; i++) {
+        surfaceOffsets[i + 1] = surfaceOffsets[i] + modelMaterials[i].surfaceNum;
+    }
+    const uint32_t *modelIndices = modelSurfaces.empty() ? nullptr : modelSurfaces.data()->vertexIdx;
+    const float *positions = (const float *)modelVertices.getPositions().data();
+    std::vector<uint32_t> skinGroups = skinningGroups(modelVertices);
+    std::vector<std::vector<uint32_t>> lodIndices(materialNum * (LOD_LEVEL_NUM - 1));
+    std::vector<float> lodErrors(materialNum * (LOD_LEVEL_NUM - 1), 0.0f);
+    ThreadPool::shared().parallelFor(materialNum, [&](size_t i) {
+        const uint32_t *indices = modelIndices + 3 * surfaceOffsets[i];
+        size_t indexNum = 3 * (surfaceOffsets[i + 1] - surfaceOffsets[i]);
+        for (auto level = 1; level < LOD_LEVEL_NUM; level++) {
+            // always from the full mesh, so the error is measured against it
+            size_t targetIndexNum = (indexNum / 3 >> level) * 3;
+            float targetError = data->boundsRadius * LOD_ERROR_FRACTION * (1 << 2 * (level - 1));
+            size_t slot = (level - 1) * materialNum + i;
+            lodIndices[slot] = simplifyMesh(indices, indexNum, positions, skinGroups.data(), modelVertices.size(),
+                                            targetIndexNum, targetError, lodErrors[slot]);
+            optimizeVertexCache(lodIndices[slot].data(), lodIndices[slot].size(), modelVertices.size());
+        }
+    });
+
+    std::pmr::vector<PMXSurface> surfaces(modelSurfaces.begin(), modelSurfaces.end());
+    std::pmr::vector<PMXDrawRange> drawRanges(materialNum * LOD_LEVEL_NUM);
+    std::pmr::vector<PMXLODLevel> lodLevels(LOD_LEVEL_NUM);
+    for (auto level = 0; level < LOD_LEVEL_NUM; level++) {
+        lodLevels[level].drawRangeOffset = level * materialNum;
+        lodLevels[level].error = level > 0 ? lodLevels[level - 1].error : 0.0f;
+        for (size_t i = 0; i < materialNum; i++) {
+            PMXDrawRange &drawRange = drawRanges[level * materialNum + i];
+            drawRange.textureIdx = modelMaterials[i].textureIdx;
+            if (level == 0) {
+                drawRange.indexOffset = 3 * surfaceOffsets[i];
+                drawRange.indexNum = 3 * (surfaceOffsets[i + 1] - surfaceOffsets[i]);
+                continue;
+            }
+            size_t slot = (level - 1) * materialNum + i;
+            const std::vector<uint32_t> &indices = lodIndices[slot];
+            drawRange.indexOffset = 3 * surfaces.size();
+            drawRange.indexNum = indices.size();
+            for (size_t j = 0; j < indices.size(); j += 3) {
+                surfaces.push_back(PMXSurface{{indices[j], indices[j + 1], indices[j + 2]}});
+            }
+            lodLevels[level].error = std::max(lodLevels[level].error, lodErrors[slot]);
+        }
+    }
+
+    // meshlets follow the vertex cache order of each range, so they need no reordering
+    const float *normals = (const float *)modelVertices.getNormals().data();
+    const uint32_t *allIndices = surfaces.empty() ? nullptr : surfaces.data()->vertexIdx;
+    std::pmr::vector<PMXMeshlet> meshlets;
+    for (size_t i = 0; i < drawRanges.size(); i++) {
+        PMXDrawRange &drawRange = drawRanges[i];
+        bool backFaceCulling = !(modelMaterials[i % materialNum].renderFlag & PMXMaterial::RENDER_FLAG_DOUBLE_SIDED);
+        std::vector<PMXMeshlet> rangeMeshlets = buildMeshlets(allIndices + drawRange.indexOffset,
+                                                              drawRange.indexNum, positions, normals,
+                                                              modelVertices.size(), backFaceCulling);
+        drawRange.meshletOffset = meshlets.size();
+        drawRange.meshletNum = rangeMeshlets.size();
+        for (auto &meshlet: rangeMeshlets) {
+            meshlet.indexOffset += drawRange.indexOffset;
+            meshlets.push_back(meshlet);
+        }
+    }
+    data->surfaces.assign(std::move(surfaces));
+    data->drawRanges.assign(std::move(drawRanges));
+    data->meshlets.assign(std::move(meshlets));
+    data->lodLevels.assign(std::move(lodLevels));
+
+    data->textures.resize(modelTextures.size());
+    for (size_t i = 0; i < modelTextures.size(); i++) {
+        const PMXTexture &texture = modelTextures[i];
+        data->textures[i].width = texture.width;
+        data->textures[i].height = texture.height;
+        data->textures[i].levels.assign(std::pmr::vector<PMXTextureLevel>(texture.levels.begin(), texture.levels.end()));
+        data->textures[i].pixels.assign(std::pmr::vector<unsigned char>(texture.pixels.begin(), texture.pixels.end()));
+        data->texturePaths.push_back(std::string(texture.name.text));
+    }
+    return data;
+}
+
+static uint16_t toUnorm16(float value, float offset, float scale) {
+    float fraction = scale > 0.0f ? (value - offset) / scale : 0.0f;
+    return (uint16_t)std::lround(std::min(std::max(fraction, 0.0f), 1.0f) * 65535.0f);
+}
+
+static int16_t toSnorm16(float value) {
+    return (int16_t)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+// the lower half of the octahedron folds over the upper one
+static void encodeOctahedral(const PMXFloat3XYZ &n, int16_t *encoded) {
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (length == 0.0f) {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+    float x = n.x / length, y = n.y / length;
+    if (n.z < 0.0f) {
+        float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = toSnorm16(x);
+    encoded[1] = toSnorm16(y);
+}
+
+// same steps as vs_packed.glsl
+static PMXFloat3XYZ decodeOctahedral(const int16_t *encoded) {
+    float x = std::max(encoded[0] / 32767.0f, -1.0f), y = std::max(encoded[1] / 32767.0f, -1.0f);
+    float z = 1.0f - std::abs(x) - std::abs(y);
+    float t = std::max(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    float length = std::sqrt(x * x + y * y + z * z);
+    return {x / length, y / length, z / length};
+}
+
+PMXPackedVertices PMXRenderData::packVertices() const {
+    PMXPackedVertices packed;
+    PMXFloat3XYZ lower = {0.0f, 0.0f, 0.0f}, upper = {0.0f, 0.0f, 0.0f};
+    PMXFloat2UV lowerUV = {0.0f, 0.0f}, upperUV = {0.0f, 0.0f};
+    if (!vertices.empty()) {
+        lower = upper = vertices[0].pos;
+        lowerUV = upperUV = vertices[0].UV;
+    }
+    // one range for the whole model, vertices are shared across materials and levels of detail
+    for (auto &vertex: vertices) {
+        lower = {std::min(lower.x, vertex.pos.x), std::min(lower.y, vertex.pos.y), std::min(lower.z, vertex.pos.z)};
+        upper = {std::max(upper.x, vertex.pos.x), std::max(upper.y, vertex.pos.y), std::max(upper.z, vertex.pos.z)};
+        lowerUV = {std::min(lowerUV.u, vertex.UV.u), std::min(lowerUV.v, vertex.UV.v)};
+        upperUV = {std::max(upperUV.u, vertex.UV.u), std::max(upperUV.v, vertex.UV.v)};
+    }
+    packed.posOffset = lower;
+    packed.posScale = {upper.x - lower.x, upper.y - lower.y, upper.z - lower.z};
+    packed.UVOffset = lowerUV;
+    packed.UVScale = {upperUV.u - lowerUV.u, upperUV.v - lowerUV.v};
+
+    packed.vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const PMXRendererVertex &vertex = vertices[i];
+        PMXPackedVertex &out = packed.vertices[i];
+        out.pos[0] = toUnorm16(vertex.pos.x, packed.posOffset.x, packed.posScale.x);
+        out.pos[1] = toUnorm16(vertex.pos.y, packed.posOffset.y, packed.posScale.y);
+        out.pos[2] = toUnorm16(vertex.pos.z, packed.posOffset.z, packed.posScale.z);
+        out.padding = 0;
+        encodeOctahedral(vertex.norm, out.norm);
+        out.UV[0] = toUnorm16(vertex.UV.u, packed.UVOffset.u, packed.UVScale.u);
+        out.UV[1] = toUnorm16(vertex.UV.v, packed.UVOffset.v, packed.UVScale.v);
+    }
+    return packed;
+}
+
+PMXPackingError PMXRenderData::packingError(const PMXPackedVertices &packed) const {
+    PMXPackingError error = {0.0f, 0.0f, 0.0f};
+    float minCos = 1.0f;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const PMXRendererVertex &vertex = vertices[i];
+        const PMXPackedVertex &in = packed.vertices[i];
+        float dx = packed.posOffset.x + in.pos[0] / 65535.0f * packed.posScale.x - vertex.pos.x;
+        float dy = packed.posOffset.y + in.pos[1] / 65535.0f * packed.posScale.y - vertex.pos.y;
+        float dz = packed.posOffset.z + in.pos[2] / 65535.0f * packed.posScale.z - vertex.pos.z;
+        error.pos = std::max(error.pos, std::sqrt(dx * dx + dy * dy + dz * dz));
+
+        float length = std::sqrt(vertex.norm.x * vertex.norm.x + vertex.norm.y * vertex.norm.y
+                                 + vertex.norm.z * vertex.norm.z);
+        if (length > 0.0f) {
+            PMXFloat3XYZ norm = decodeOctahedral(in.norm);
+            float cos = (norm.x * vertex.norm.x + norm.y * vertex.norm.y + norm.z * vertex.norm.z) / length;
+            minCos = std::min(minCos, cos);
+        }
+
+        float du = packed.UVOffset.u + in.UV[0] / 65535.0f * packed.UVScale.u - vertex.UV.u;
+        float dv = packed.UVOffset.v + in.UV[1] / 65535.0f * packed.UVScale.v - vertex.UV.v;
+        error.UV = std::max(error.UV, std::max(std::abs(du), std::abs(dv)));
+    }
+    error.normDegrees = std::acos(std::min(std::max(minCos, -1.0f), 1.0f)) * 180.0f / (float)M_PI;
+    return error;
+}
+
+// the bones of vertex i with positive weight, repeated bones merged, weights normalized to sum to 1
+static int normalizedSkin(const PMXVertexData &vertices, size_t i, int *boneIdx, float *weights) {
+    int num = 0;
+    float total = 0.0f;
+    for (auto j = 0; j < vertices.getBoneNum(i); j++) {
+        int idx = vertices.getBoneIdx(i, j);
+        float weight = vertices.getBoneWeight(i, j);
+        if (idx < 0 || !(weight > 0.0f)) {
+            continue;
+        }
+        int k = std::find(boneIdx, boneIdx + num, idx) - boneIdx;
+        if (k == num) {
+            boneIdx[num] = idx;
+            weights[num++] = 0.0f;
+        }
+        weights[k] += weight;
+        total += weight;
+    }
+    for (auto k = 0; k < num; k++) {
+        weights[k] /= total;
+    }
+    return num;
+}
+
+PMXPackedSkin PMXRenderData::packSkin(PMXModel &model) {
+    PMXVertexData &vertices = model.getVertices();
+    int boneNum = model.getBoneNum();
+    if (boneNum > 65536) {
+        throw std::runtime_error("Too many bones for 16-bit bone indices");
+    }
+    PMXPackedSkin packed;
+    packed.boneIdxSize = boneNum <= 256 ? 1 : 2;
+    const size_t stride = packed.getStride();
+    packed.data.assign(vertices.size() * stride, 0);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        int boneIdx[PMXPackedSkin::WEIGHT_NUM] = {0};
+        float weights[PMXPackedSkin::WEIGHT_NUM];
+        int num = normalizedSkin(vertices, i, boneIdx, weights);
+        int quantized[PMXPackedSkin::WEIGHT_NUM] = {0};
+        if (num == 0) {
+            // bound to nothing, follow the first bone rigidly
+            quantized[0] = 255;
+        } else {
+            // round down, then hand the rest to the largest remainders so the weights sum to 255
+            int rest = 255;
+            float remainders[PMXPackedSkin::WEIGHT_NUM];
+            for (auto k = 0; k < num; k++) {
+                quantized[k] = (int)(weights[k] * 255.0f);
+                remainders[k] = weights[k] * 255.0f - quantized[k];
+                rest -= quantized[k];
+            }
+            for (; rest > 0; rest--) {
+                int k = std::max_element(remainders, remainders + num) - remainders;
+                quantized[k]++;
+                remainders[k] = -1.0f;
+            }
+        }
+        unsigned char *out = packed.data.data() + i * stride;
+        for (auto k = 0; k < PMXPackedSkin::WEIGHT_NUM; k++) {
+            if (packed.boneIdxSize == 1) {
+                out[k] = (unsigned char)boneIdx[k];
+            } else {
+                ((uint16_t *)out)[k] = (uint16_t)boneIdx[k];
+            }
+            out[PMXPackedSkin::WEIGHT_NUM * packed.boneIdxSize + k] = (unsigned char)quantized[k];
+        }
+    }
+    return packed;
+}
+
+float PMXRenderData::skinningError(PMXModel &model, const PMXPackedSkin &packed) {
+    PMXVertexData &vertices = model.getVertices();
+    const size_t stride = packed.getStride();
+    float error = 0.0f;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        int boneIdx[PMXPackedSkin::WEIGHT_NUM];
+        float weights[PMXPackedSkin::WEIGHT_NUM];
+        int num = normalizedSkin(vertices, i, boneIdx, weights);
+        const unsigned char *in = packed.data.data() + i * stride;
+        for (auto k = 0; k < num; k++) {
+            int decoded = 0;
+            for (auto slot = 0; slot < PMXPackedSkin::WEIGHT_NUM; slot++) {
+                int idx = packed.boneIdxSize == 1 ? in[slot] : ((const uint16_t *)in)[slot];
+                if (idx == boneIdx[k]) {
+                    decoded += in[PMXPackedSkin::WEIGHT_NUM * packed.boneIdxSize + slot];
+                }
+            }
+            error = std::max(error, std::abs(decoded / 255.0f - weights[k]));
+        }
+    }
+    return error;
+}
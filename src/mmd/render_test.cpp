@@ -5,6 +5,7 @@
 #include <boost/program_options.hpp>
 
 #include <mmd/parser.hpp>
+#include <mmd/render_cache.hpp>
 #include <mmd/renderer.hpp>
 #include <mmd/controller.hpp>
 
@@ -14,9 +15,10 @@ static void error_callback(int error, const char* description) {
     std::cerr << "Error: " << description << std::endl;
 }
 
-int show(std::string modelPath, char *progPath)
+int show(std::string modelPath, std::string cacheDir, bool packedVertices, char *progPath)
 {
-    PMXModel testModel = PMXModel(modelPath);
+    PMXRenderCache cache(cacheDir);
+    std::shared_ptr<PMXRenderData> renderData = cache.loadOrBuild(modelPath);
 
     GLFWwindow* window;
     glfwSetErrorCallback(error_callback);
@@ -45,7 +47,7 @@ int show(std::string modelPath, char *progPath)
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     glfwSwapInterval(1);
 
-    PMXRenderer renderer(testModel, progPath);
+    PMXRenderer renderer(renderData, progPath, packedVertices);
 
     while (!glfwWindowShouldClose(window))
     {
@@ -64,6 +66,8 @@ int main(int argc, char **argv) {
     po::options_description desc("MMD Parser Testing Program");
     desc.add_options()
         ("input-model,i", po::value<std::string>(), "input mmd model")
+        ("cache-dir,c", po::value<std::string>()->default_value(""), "render cache directory, default next to the model")
+        ("packed-vertices,p", "upload quantized 16-byte vertices instead of 32-byte float ones")
         ("help", "show help")
     ;
 
@@ -75,7 +79,7 @@ int main(int argc, char **argv) {
         std::cout << desc << std::endl;
     } else if (vm.count("input-model")) {
         std::string modelPath = vm["input-model"].as<std::string>();
-        show(modelPath, argv[0]);
+        show(modelPath, vm["cache-dir"].as<std::string>(), vm.count("packed-vertices") > 0, argv[0]);
     } else {
         std::cout << "model path was not set." << std::endl;
     }
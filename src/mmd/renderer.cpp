@@ -41,32 +41,21 @@ void PMXRenderer::loadShaders() {
     glLinkProgram(program);
 }
 
-PMXRenderer::PMXRenderer(PMXModel &model_, char *progPath_): model(model_), progPath(progPath_) {
-    // process model data
-    std::vector<PMXVertex>& modelVertices = model.getVertices();
-    std::vector<PMXSurface>& modelSurfaces = model.getSurfaces();
-    std::vector<PMXTexture>& modelTextures = model.getTextures();
-
-    // prepare vertices for rendering
-    renderVertexNum = modelSurfaces.size() * 3;
-    renderVertices = std::unique_ptr<PMXRendererVertex>(new PMXRendererVertex[renderVertexNum]);
-    for (auto i = 0; i < modelSurfaces.size(); i++) {
-        for (auto j = 0; j < 3; j++) {
-            renderVertices.get()[3 * i + j].pos = modelVertices[modelSurfaces[i].vertexIdx[j]].pos;
-            renderVertices.get()[3 * i + j].norm = modelVertices[modelSurfaces[i].vertexIdx[j]].norm;
-            renderVertices.get()[3 * i + j].UV = modelVertices[modelSurfaces[i].vertexIdx[j]].UV;
-        }
-    }
+PMXRenderer::PMXRenderer(PMXModel &model, char *progPath_, bool packedVertices):
+    PMXRenderer(PMXRenderData::fromModel(model), progPath_, packedVertices) {}
+
+PMXRenderer::PMXRenderer(std::shared_ptr<PMXRenderData> data_, char *progPath_, bool packedVertices):
+    progPath(progPath_), data(data_) {
     // process OpenGL data structure
     // prepare vertex array object
     glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
-    // prepare vertex buffer
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(PMXRendererVertex) * renderVertexNum, renderVertices.get(), GL_STATIC_DRAW);
+    // prepare element buffer
+    glGenBuffers(1, &elementBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(PMXSurface) * data->surfaces.size(), data->surfaces.data(), GL_STATIC_DRAW);
     // load shaders
-    vsPath = fsys::path(progPath).remove_filename().append(vsName).string();
+    vsPath = fsys::path(progPath).remove_filename().append(packedVertices ? packedVSName : vsName).string();
     fsPath = fsys::path(progPath).remove_filename().append(fsName).string();
     loadShaders();
 
@@ -75,35 +64,100 @@ PMXRenderer::PMXRenderer(PMXModel &model_, char *progPath_): model(model_), prog
     mvLocation = glGetUniformLocation(program, "mv_matrix");
     projLocation = glGetUniformLocation(program, "proj_matrix");
 
-    // prepare vertex attributes
+    // prepare vertex buffer and attributes
     posLocation = glGetAttribLocation(program, "pos");
-    glEnableVertexAttribArray(posLocation);
-    glVertexAttribPointer(posLocation, 3, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 0);
     normLocation = glGetAttribLocation(program, "norm");
-    glEnableVertexAttribArray(normLocation);
-    glVertexAttribPointer(normLocation, 3, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 12);
     UVLocation = glGetAttribLocation(program, "UV");
-    glEnableVertexAttribArray(UVLocation);
-    glVertexAttribPointer(UVLocation, 2, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 24);
+    glGenBuffers(1, &vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    if (packedVertices) {
+        uploadPackedVertices();
+    } else {
+        uploadVertices();
+    }
 
     // prepare vertex texture
+    std::vector<PMXRenderTexture>& modelTextures = data->textures;
     textures = std::unique_ptr<GLuint>(new GLuint[modelTextures.size()]);
     glGenTextures(modelTextures.size(), textures.get());
     glActiveTexture(GL_TEXTURE0); // tex_color
     for (auto i = 0; i < modelTextures.size(); i++) {
+        const PMXRenderTexture &texture = modelTextures[i];
+        if (texture.levels.empty()) {
+            std::cerr << "Texture " << data->texturePaths[i] << " was not loaded" << std::endl;
+            continue;
+        }
         glBindTexture(GL_TEXTURE_2D, textures.get()[i]);
         glTexStorage2D(GL_TEXTURE_2D,  // 2D texture
-            1,                         // 8 mipmap levels
-            GL_RGBA32F,                // 32-bit floating-point RGBA data
-            modelTextures[i].image.getWidth(), modelTextures[i].image.getHeight());  // 256 x 256 texels
-        glTexSubImage2D(GL_TEXTURE_2D, // 2D texture
-            0,                         // Level 0
-            0, 0,                      // Offset 0, 0
-            modelTextures[i].image.getWidth(), modelTextures[i].image.getHeight(),   // 256 x 256 texels, replace entire image
-            GL_RGBA,                   // Four channel data
-            GL_FLOAT,                  // Floating point data%
-            modelTextures[i].image.accessPixels());                                  // Pointer to data
+            texture.levels.size(),     // full mip chain built by the parser
+            GL_RGBA8,                  // 8-bit RGBA data
+            texture.width, texture.height);
+        for (auto level = 0; level < texture.levels.size(); level++) {
+            glTexSubImage2D(GL_TEXTURE_2D, // 2D texture
+                level,                     // mip level
+                0, 0,                      // Offset 0, 0
+                texture.levels[level].width, texture.levels[level].height, // replace entire level
+                GL_RGBA,                   // Four channel data
+                GL_UNSIGNED_BYTE,          // 8-bit unsigned data
+                texture.pixels.data() + texture.levels[level].offset);      // Pointer to data
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+}
+
+void PMXRenderer::uploadVertices() {
+    // data may be mapped straight from a render cache
+    glBufferData(GL_ARRAY_BUFFER, sizeof(PMXRendererVertex) * data->vertices.size(), data->vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(posLocation);
+    glVertexAttribPointer(posLocation, 3, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 0);
+    glEnableVertexAttribArray(normLocation);
+    glVertexAttribPointer(normLocation, 3, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 12);
+    glEnableVertexAttribArray(UVLocation);
+    glVertexAttribPointer(UVLocation, 2, GL_FLOAT, GL_FALSE, sizeof(PMXRendererVertex), (void*) 24);
+}
+
+void PMXRenderer::uploadPackedVertices() {
+    PMXPackedVertices packed = data->packVertices();
+#ifdef MODEL_PARSER_DEBUG
+    PMXPackingError error = data->packingError(packed);
+    std::cout << "Packed vertex error: position " << error.pos << ", normal " << error.normDegrees
+              << " degrees, UV " << error.UV << std::endl;
+#endif
+    glBufferData(GL_ARRAY_BUFFER, sizeof(PMXPackedVertex) * packed.vertices.size(), packed.vertices.data(), GL_STATIC_DRAW);
+    // normalized: unsigned fractions in [0, 1], signed ones in [-1, 1]
+    glEnableVertexAttribArray(posLocation);
+    glVertexAttribPointer(posLocation, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PMXPackedVertex), (void*) 0);
+    glEnableVertexAttribArray(normLocation);
+    glVertexAttribPointer(normLocation, 2, GL_SHORT, GL_TRUE, sizeof(PMXPackedVertex), (void*) 8);
+    glEnableVertexAttribArray(UVLocation);
+    glVertexAttribPointer(UVLocation, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PMXPackedVertex), (void*) 12);
+
+    // the ranges the fractions expand to do not change
+    glUseProgram(program);
+    glUniform3f(glGetUniformLocation(program, "pos_offset"), packed.posOffset.x, packed.posOffset.y, packed.posOffset.z);
+    glUniform3f(glGetUniformLocation(program, "pos_scale"), packed.posScale.x, packed.posScale.y, packed.posScale.z);
+    glUniform2f(glGetUniformLocation(program, "uv_offset"), packed.UVOffset.u, packed.UVOffset.v);
+    glUniform2f(glGetUniformLocation(program, "uv_scale"), packed.UVScale.u, packed.UVScale.v);
+}
+
+int PMXRenderer::selectLOD(int height) const {
+    // depth of the bounds center in view space, the matrices are applied as proj * mv * trans
+    vec4 center = {data->boundsCenter.x, data->boundsCenter.y, data->boundsCenter.z, 1.0f}, moved, viewed;
+    mat4x4_mul_vec4(moved, (vec4 *)transMatrix, center);
+    mat4x4_mul_vec4(viewed, (vec4 *)mvMatrix, moved);
+    float depth = -viewed[2];
+    if (depth <= data->boundsRadius) {
+        return 0;
+    }
+    // projMatrix[1][1] is cot(fovy / 2): model units at depth to pixels
+    float pixelsPerUnit = projMatrix[1][1] * height / 2 / depth;
+    int level = 0;
+    while (level + 1 < (int)data->lodLevels.size()
+           && data->lodLevels[level + 1].error * pixelsPerUnit <= LOD_PIXEL_ERROR) {
+        level++;
     }
+    return level;
 }
 
 void PMXRenderer::render(GLFWwindow *window) {
@@ -136,12 +190,41 @@ void PMXRenderer::render(GLFWwindow *window) {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    std::vector<PMXMaterial>& modelMaterials = model.getMaterials();
-    int vertexOffset = 0;
-    for (auto i = 0; i < modelMaterials.size(); i++) {
-        glBindTexture(GL_TEXTURE_2D, textures.get()[modelMaterials[i].textureIdx]);
-        glDrawArrays(GL_TRIANGLES, vertexOffset, modelMaterials[i].surfaceNum * 3);
-        vertexOffset += modelMaterials[i].surfaceNum * 3;
+    glBindVertexArray(vao);
+    // frustum and camera in model space, meshlets are culled there
+    mat4x4 modelView, modelViewProj, viewToModel;
+    mat4x4_mul(modelView, mvMatrix, transMatrix);
+    mat4x4_mul(modelViewProj, projMatrix, modelView);
+    mat4x4_invert(viewToModel, modelView);
+    PMXCullView view = makeCullView(&modelViewProj[0][0], viewToModel[3]);
+
+    size_t materialNum = data->getMaterialNum();
+    const PMXDrawRange *drawRanges = data->drawRanges.data() + data->lodLevels[selectLOD(height)].drawRangeOffset;
+    for (size_t i = 0; i < materialNum; i++) {
+        const PMXDrawRange &drawRange = drawRanges[i];
+        // meshlets are consecutive in the element buffer, visible neighbors draw as one run
+        drawCounts.clear();
+        drawOffsets.clear();
+        for (uint32_t j = 0; j < drawRange.meshletNum; j++) {
+            const PMXMeshlet &meshlet = data->meshlets[drawRange.meshletOffset + j];
+            if (!isMeshletVisible(meshlet, view)) {
+                continue;
+            }
+            const char *offset = (const char *)(meshlet.indexOffset * sizeof(uint32_t));
+            if (!drawCounts.empty()
+                && (const char *)drawOffsets.back() + drawCounts.back() * sizeof(uint32_t) == offset) {
+                drawCounts.back() += meshlet.indexNum;
+            } else {
+                drawCounts.push_back(meshlet.indexNum);
+                drawOffsets.push_back(offset);
+            }
+        }
+        if (drawCounts.empty()) {
+            continue;
+        }
+        int textureIdx = drawRange.textureIdx;
+        glBindTexture(GL_TEXTURE_2D, textureIdx < 0 ? 0 : textures.get()[textureIdx]);
+        glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), drawCounts.size());
     }
 
     glfwSwapBuffers(window);
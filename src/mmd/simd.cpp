@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#include <mmd/simd.hpp>
+
+static void widenIndicesScalar(const unsigned char *src, size_t idxSize, size_t count, uint32_t *dst) {
+    if (idxSize == 1) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = src[i];
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t idx;
+            memcpy(&idx, src + 2 * i, sizeof(idx));
+            dst[i] = idx;
+        }
+    }
+}
+
+#ifdef SIMD_X86
+static void widenIndicesSSE2(const unsigned char *src, size_t idxSize, size_t count, uint32_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    if (idxSize == 1) {
+        for (; i + 16 <= count; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+            __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 12), _mm_unpackhi_epi16(hi, zero));
+        }
+    } else {
+        for (; i + 8 <= count; i += 8) {
+            __m128i shorts = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(shorts, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(shorts, zero));
+        }
+    }
+    widenIndicesScalar(src + i * idxSize, idxSize, count - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void widenIndicesAVX2(const unsigned char *src, size_t idxSize, size_t count, uint32_t *dst) {
+    size_t i = 0;
+    if (idxSize == 1) {
+        for (; i + 32 <= count; i += 32) {
+            for (size_t j = 0; j < 32; j += 8) {
+                __m128i bytes = _mm_loadl_epi64((const __m128i *)(src + i + j));
+                _mm256_storeu_si256((__m256i *)(dst + i + j), _mm256_cvtepu8_epi32(bytes));
+            }
+        }
+    } else {
+        for (; i + 16 <= count; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtepu16_epi32(lo));
+            _mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_cvtepu16_epi32(hi));
+        }
+    }
+    widenIndicesSSE2(src + i * idxSize, idxSize, count - i, dst + i);
+}
+#endif
+
+// average of the 2x2 block at (x0, y0) with clamped second row and column
+static inline void boxPixel(const uint8_t *src, int width, int x0, int x1, int y0, int y1, uint8_t *dst) {
+    const uint8_t *p00 = src + ((size_t)y0 * width + x0) * 4, *p01 = src + ((size_t)y0 * width + x1) * 4;
+    const uint8_t *p10 = src + ((size_t)y1 * width + x0) * 4, *p11 = src + ((size_t)y1 * width + x1) * 4;
+    for (auto c = 0; c < 4; c++) {
+        dst[c] = (p00[c] + p01[c] + p10[c] + p11[c] + 2) >> 2;
+    }
+}
+
+void downsampleRGBA8(const uint8_t *src, int width, int height, uint8_t *dst) {
+    int dstWidth = std::max(width / 2, 1), dstHeight = std::max(height / 2, 1);
+    for (auto y = 0; y < dstHeight; y++) {
+        int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+        int x = 0;
+#ifdef SIMD_X86
+        // four destination pixels from two rows of eight source pixels
+        const uint8_t *row0 = src + (size_t)y0 * width * 4, *row1 = src + (size_t)y1 * width * 4;
+        uint8_t *dstRow = dst + (size_t)y * dstWidth * 4;
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(2);
+        for (; 2 * x + 8 <= width; x += 4) {
+            __m128i out[2];
+            for (auto k = 0; k < 2; k++) {
+                __m128i a = _mm_loadu_si128((const __m128i *)(row0 + (2 * x + 4 * k) * 4));
+                __m128i b = _mm_loadu_si128((const __m128i *)(row1 + (2 * x + 4 * k) * 4));
+                // vertical sums of pixel pairs (0, 1) and (2, 3) as 16-bit lanes
+                __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                // horizontal sums, one destination pixel in the low 64 bits of each
+                lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                out[k] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+            }
+            _mm_storeu_si128((__m128i *)(dstRow + x * 4), _mm_packus_epi16(out[0], out[1]));
+        }
+#endif
+        for (; x < dstWidth; x++) {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            boxPixel(src, width, x0, x1, y0, y1, dst + ((size_t)y * dstWidth + x) * 4);
+        }
+    }
+}
+
+void widenIndices(const void *src, size_t idxSize, size_t count, uint32_t *dst) {
+    switch (idxSize) {
+        case 1:
+        case 2:
+            break;
+        case 4:
+            memcpy(dst, src, count * sizeof(uint32_t));
+            return;
+        default:
+            throw std::runtime_error("Invalid index size");
+    }
+#ifdef SIMD_X86
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if (hasAVX2) {
+        widenIndicesAVX2((const unsigned char *)src, idxSize, count, dst);
+    } else {
+        widenIndicesSSE2((const unsigned char *)src, idxSize, count, dst);
+    }
+#else
+    widenIndicesScalar((const unsigned char *)src, idxSize, count, dst);
+#endif
+}
+
+void splitVertexAttributes(const void *src, size_t stride, size_t count,
+                           float *positions, float *normals, float *UVs) {
+    const unsigned char *record = (const unsigned char *)src;
+    size_t i = 0;
+#ifdef SIMD_X86
+    /*
+     * 16-byte moves for the 12-byte vectors, each store spills one float
+     * into the next element which the next iteration overwrites. The last
+     * record is left to the scalar loop so nothing is written past the end.
+     */
+    for (; i + 1 < count; i++, record += stride) {
+        __m128i pos = _mm_loadu_si128((const __m128i *)record);
+        __m128i norm = _mm_loadu_si128((const __m128i *)(record + 12));
+        __m128i UV = _mm_loadl_epi64((const __m128i *)(record + 24));
+        _mm_storeu_si128((__m128i *)(positions + 3 * i), pos);
+        _mm_storeu_si128((__m128i *)(normals + 3 * i), norm);
+        _mm_storel_epi64((__m128i *)(UVs + 2 * i), UV);
+    }
+#endif
+    for (; i < count; i++, record += stride) {
+        memcpy(positions + 3 * i, record, 3 * sizeof(float));
+        memcpy(normals + 3 * i, record + 12, 3 * sizeof(float));
+        memcpy(UVs + 2 * i, record + 24, 2 * sizeof(float));
+    }
+}
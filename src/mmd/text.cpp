@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <iconv.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_X86
+#include <emmintrin.h>
+#endif
+
+#include <mmd/text.hpp>
+
+size_t utf16ToUtf8(const char16_t *src, size_t len, char *dst) {
+    char *out = dst;
+    size_t i = 0;
+    while (i < len) {
+#ifdef TEXT_X86
+        // ASCII fast path, narrow 8 code units at once
+        const __m128i nonASCIIMask = _mm_set1_epi16((short)0xff80);
+        while (i + 8 <= len) {
+            __m128i units = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i nonASCII = _mm_cmpeq_epi16(_mm_and_si128(units, nonASCIIMask), _mm_setzero_si128());
+            if (_mm_movemask_epi8(nonASCII) != 0xffff) {
+                break;
+            }
+            _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(units, units));
+            out += 8;
+            i += 8;
+        }
+        if (i == len) {
+            break;
+        }
+#endif
+        uint32_t codePoint = src[i++];
+        if (codePoint >= 0xd800 && codePoint < 0xe000) {
+            if (codePoint < 0xdc00 && i < len && src[i] >= 0xdc00 && src[i] < 0xe000) {
+                codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (src[i++] - 0xdc00);
+            } else {
+                codePoint = 0xfffd;
+            }
+        }
+        if (codePoint < 0x80) {
+            *out++ = codePoint;
+        } else if (codePoint < 0x800) {
+            *out++ = 0xc0 | (codePoint >> 6);
+            *out++ = 0x80 | (codePoint & 0x3f);
+        } else if (codePoint < 0x10000) {
+            *out++ = 0xe0 | (codePoint >> 12);
+            *out++ = 0x80 | ((codePoint >> 6) & 0x3f);
+            *out++ = 0x80 | (codePoint & 0x3f);
+        } else {
+            *out++ = 0xf0 | (codePoint >> 18);
+            *out++ = 0x80 | ((codePoint >> 12) & 0x3f);
+            *out++ = 0x80 | ((codePoint >> 6) & 0x3f);
+            *out++ = 0x80 | (codePoint & 0x3f);
+        }
+    }
+    return out - dst;
+}
+
+PMXStringArena::PMXStringArena(std::pmr::memory_resource *resource_):
+    resource(resource_), blockUsed(0), blockSize(0) {}
+
+PMXStringArena::~PMXStringArena() {
+    for (auto &block: blocks) {
+        resource->deallocate(block.first, block.second, 1);
+    }
+}
+
+std::string_view PMXStringArena::store(const char *text, size_t len) {
+    if (len == 0) {
+        return std::string_view();
+    }
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    if (blockSize - blockUsed < len) {
+        // long strings get a block of their own
+        blockSize = std::max(len, (size_t)BLOCK_SIZE);
+        blocks.emplace_back((char *)resource->allocate(blockSize, 1), blockSize);
+        blockUsed = 0;
+    }
+    char *dst = blocks.back().first + blockUsed;
+    memcpy(dst, text, len);
+    blockUsed += len;
+    return std::string_view(dst, len);
+}
+
+namespace {
+
+// one converter per thread and direction, iconv descriptors keep state
+class ShiftJISConverter {
+    iconv_t cd;
+    bool fromUtf8;
+    const char *replacement;
+    size_t replacementLen;
+
+public:
+    ShiftJISConverter(bool fromUtf8_): fromUtf8(fromUtf8_) {
+        cd = fromUtf8 ? iconv_open("CP932", "UTF-8") : iconv_open("UTF-8", "CP932");
+        if (cd == (iconv_t)-1) {
+            throw std::runtime_error("Shift_JIS conversion is not available");
+        }
+        // U+FFFD has no Shift_JIS encoding
+        replacement = fromUtf8 ? "?" : "\xef\xbf\xbd";
+        replacementLen = strlen(replacement);
+    }
+    ~ShiftJISConverter() { iconv_close(cd); }
+
+    size_t convert(const char *src, size_t len, char *dst, size_t dstLen) {
+        char *in = (char *)src, *out = dst;
+        size_t inLeft = len, outLeft = dstLen;
+        while (inLeft > 0) {
+            if (iconv(cd, &in, &inLeft, &out, &outLeft) != (size_t)-1) {
+                break;
+            }
+            if (errno == E2BIG) {
+                break;
+            }
+            // invalid, unmappable or truncated sequence, replace one character
+            iconv(cd, nullptr, nullptr, nullptr, nullptr);
+            in++;
+            inLeft--;
+            while (fromUtf8 && inLeft > 0 && ((unsigned char)*in & 0xc0) == 0x80) {
+                in++;
+                inLeft--;
+            }
+            if (outLeft < replacementLen) {
+                break;
+            }
+            memcpy(out, replacement, replacementLen);
+            out += replacementLen;
+            outLeft -= replacementLen;
+        }
+        return out - dst;
+    }
+};
+
+}
+
+size_t shiftJISToUtf8(const char *src, size_t len, char *dst) {
+    // ASCII needs no conversion
+    size_t i = 0;
+    while (i < len && (unsigned char)src[i] < 0x80) {
+        dst[i] = src[i];
+        i++;
+    }
+    if (i == len) {
+        return len;
+    }
+    thread_local ShiftJISConverter decoder(false);
+    return i + decoder.convert(src + i, len - i, dst + i, 3 * (len - i));
+}
+
+size_t utf8ToShiftJIS(const char *src, size_t len, char *dst) {
+    size_t i = 0;
+    while (i < len && (unsigned char)src[i] < 0x80) {
+        dst[i] = src[i];
+        i++;
+    }
+    if (i == len) {
+        return len;
+    }
+    // no character grows, half-width katakana even shrink
+    thread_local ShiftJISConverter encoder(true);
+    return i + encoder.convert(src + i, len - i, dst + i, len - i);
+}
+
+std::string_view PMXStringArena::storeUtf16(const char16_t *text, size_t len) {
+    // names are short, transcode on the stack and copy the exact size in
+    char scratch[1024];
+    if (3 * len <= sizeof(scratch)) {
+        return store(scratch, utf16ToUtf8(text, len, scratch));
+    }
+    std::unique_ptr<char[]> buffer(new char[3 * len]);
+    return store(buffer.get(), utf16ToUtf8(text, len, buffer.get()));
+}
+
+std::string_view PMXStringArena::storeShiftJIS(const char *text, size_t len) {
+    char scratch[1024];
+    if (3 * len <= sizeof(scratch)) {
+        return store(scratch, shiftJISToUtf8(text, len, scratch));
+    }
+    std::unique_ptr<char[]> buffer(new char[3 * len]);
+    return store(buffer.get(), shiftJISToUtf8(text, len, buffer.get()));
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+#include <mmd/thread_pool.hpp>
+
+ThreadPool::ThreadPool(size_t threadNum): stopping(false) {
+    if (threadNum == 0) {
+        threadNum = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadNum; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        stopping = true;
+    }
+    tasksCond.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasksMutex);
+            tasksCond.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::parallelFor(size_t taskNum, const std::function<void(size_t)> &func) {
+    if (taskNum == 0) {
+        return;
+    }
+    if (taskNum == 1 || workers.size() <= 1) {
+        for (size_t i = 0; i < taskNum; i++) {
+            func(i);
+        }
+        return;
+    }
+
+    struct SharedState {
+        std::atomic<size_t> nextTask{0};
+        size_t doneNum = 0;
+        std::exception_ptr error;
+        std::mutex doneMutex;
+        std::condition_variable doneCond;
+    };
+    auto state = std::make_shared<SharedState>();
+    auto runTasks = [state, taskNum, &func]() {
+        size_t i;
+        while ((i = state->nextTask.fetch_add(1)) < taskNum) {
+            std::exception_ptr error;
+            try {
+                func(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(state->doneMutex);
+            if (error && !state->error) {
+                state->error = error;
+            }
+            if (++state->doneNum == taskNum) {
+                state->doneCond.notify_all();
+            }
+        }
+    };
+
+    // helpers that start after all tasks are taken return right away and
+    // never touch func, which only lives until this call returns
+    size_t helperNum = std::min(workers.size(), taskNum - 1);
+    for (size_t i = 0; i < helperNum; i++) {
+        submit(runTasks);
+    }
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(state->doneMutex);
+    state->doneCond.wait(lock, [&]() { return state->doneNum == taskNum; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,36 @@
+#version 420 core
+
+uniform mat4 trans_matrix;
+uniform mat4 mv_matrix;
+uniform mat4 proj_matrix;
+
+// attributes arrive as fractions, value = offset + fraction * scale
+uniform vec3 pos_offset;
+uniform vec3 pos_scale;
+uniform vec2 uv_offset;
+uniform vec2 uv_scale;
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec2 norm;
+layout (location = 2) in vec2 UV;
+
+out VS_OUT
+{
+    vec2 UV;
+} vs_out;
+
+// octahedral normal, the lower half folded over the upper one
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    vec3 position = pos_offset + pos * pos_scale;
+    vec3 normal = decodeNormal(norm);
+    gl_Position = proj_matrix * mv_matrix * trans_matrix * vec4(position, 1.0);
+    vs_out.UV = uv_offset + UV * uv_scale;
+}